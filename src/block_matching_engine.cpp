@@ -0,0 +1,166 @@
+#include "block_matching_engine.h"
+#include "census.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace stereo;
+
+// the window sums of the costs need to fit into 16 bits
+static const int MAX_WINDOW_SIZE = 31;
+
+// sums += add - sub for rows of n 8 bit costs, n a multiple of 16
+static inline void updateColumnSums( uint16_t *sums, const uint8_t *add, const uint8_t *sub, int n )
+{
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for( int i = 0; i < n; i += 16 )
+    {
+	const __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( add + i ) );
+	const __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( sub + i ) );
+	__m128i *s = reinterpret_cast<__m128i*>( sums + i );
+	const __m128i lo = _mm_sub_epi16( _mm_add_epi16( _mm_loadu_si128( s ), _mm_unpacklo_epi8( a, zero ) ),
+		_mm_unpacklo_epi8( b, zero ) );
+	const __m128i hi = _mm_sub_epi16( _mm_add_epi16( _mm_loadu_si128( s + 1 ), _mm_unpackhi_epi8( a, zero ) ),
+		_mm_unpackhi_epi8( b, zero ) );
+	_mm_storeu_si128( s, lo );
+	_mm_storeu_si128( s + 1, hi );
+    }
+#else
+    for( int i = 0; i < n; i++ )
+	sums[i] += add[i] - sub[i];
+#endif
+}
+
+// out = in + add - sub for rows of n 16 bit sums, n a multiple of 8. The
+// intermediate values may wrap around, the result is exact.
+static inline void updateWindowSums( uint16_t *out, const uint16_t *in,
+	const uint16_t *add, const uint16_t *sub, int n )
+{
+#ifdef __SSE2__
+    for( int i = 0; i < n; i += 8 )
+    {
+	const __m128i v = _mm_add_epi16( _mm_loadu_si128( reinterpret_cast<const __m128i*>( in + i ) ),
+		_mm_loadu_si128( reinterpret_cast<const __m128i*>( add + i ) ) );
+	_mm_storeu_si128( reinterpret_cast<__m128i*>( out + i ),
+		_mm_sub_epi16( v, _mm_loadu_si128( reinterpret_cast<const __m128i*>( sub + i ) ) ) );
+    }
+#else
+    for( int i = 0; i < n; i++ )
+	out[i] = in[i] + add[i] - sub[i];
+#endif
+}
+
+BlockMatchingEngine::BlockMatchingEngine( const BlockMatchingConfiguration &config,
+	int disp_min, int disp_max, ThreadPool *pool )
+    : config( config ), disp_min( disp_min ),
+      num_disp( std::max( 1, disp_max - disp_min + 1 ) ), pool( pool ),
+      width( 0 ), height( 0 )
+{
+    checkConfiguration( config );
+    num_disp_padded = ( num_disp + 15 ) / 16 * 16;
+}
+
+void BlockMatchingEngine::checkConfiguration( const BlockMatchingConfiguration &config )
+{
+    if( config.window_size < 1 || config.window_size > MAX_WINDOW_SIZE || config.window_size % 2 == 0 )
+	throw std::runtime_error( "The block matching window size needs to be odd and at most 31." );
+}
+
+void BlockMatchingEngine::rowCosts( int y, uint8_t *costs ) const
+{
+    y = std::min( height - 1, std::max( 0, y ) );
+    const uint32_t *left = &left_census[y * width];
+    const uint32_t *right = &right_census[y * width];
+    for( int x = 0; x < width; x++ )
+	censusCosts( left, right, x, width, disp_min, num_disp_padded, costs + x * num_disp_padded );
+}
+
+void BlockMatchingEngine::matchRows( int begin, int end, float *left_disp, float *right_disp, Scratch &scratch )
+{
+    const int nd = num_disp_padded;
+    const int radius = config.window_size / 2;
+    const size_t row_size = (size_t)width * nd;
+
+    // one more slot than rows in the window, so that the row which leaves
+    // the window is still there when the entering row is computed
+    const int slots = config.window_size + 1;
+    scratch.costs.resize( slots * row_size );
+    scratch.column_sums.assign( row_size, 0 );
+    scratch.window_sums.resize( row_size );
+    const auto slot = [&]( int y ) { return &scratch.costs[( ( y % slots + slots ) % slots ) * row_size]; };
+
+    uint16_t *columns = &scratch.column_sums[0];
+    uint16_t *sums = &scratch.window_sums[0];
+    for( int y = begin - radius; y <= begin + radius; y++ )
+    {
+	uint8_t *costs = slot( y );
+	rowCosts( y, costs );
+	for( size_t i = 0; i < row_size; i++ )
+	    columns[i] += costs[i];
+    }
+
+    for( int y = begin; y < end; y++ )
+    {
+	if( y > begin )
+	{
+	    uint8_t *costs = slot( y + radius );
+	    rowCosts( y + radius, costs );
+	    updateColumnSums( columns, costs, slot( y - radius - 1 ), row_size );
+	}
+
+	// sliding window along the row, with the border columns replicated
+	memset( sums, 0, nd * sizeof( uint16_t ) );
+	for( int i = -radius; i <= radius; i++ )
+	{
+	    const uint16_t *c = columns + std::min( width - 1, std::max( 0, i ) ) * nd;
+	    for( int d = 0; d < nd; d++ )
+		sums[d] += c[d];
+	}
+	for( int x = 1; x < width; x++ )
+	{
+	    updateWindowSums( sums + x * nd, sums + ( x - 1 ) * nd,
+		    columns + std::min( width - 1, x + radius ) * nd,
+		    columns + std::max( 0, x - radius - 1 ) * nd, nd );
+	}
+
+	selectDisparities( sums, width, nd, disp_min, num_disp, config.lr_threshold, config.subpixel,
+		left_disp + (size_t)y * width, right_disp + (size_t)y * width, scratch.select );
+    }
+}
+
+void BlockMatchingEngine::process( const uint8_t *left, const uint8_t *right,
+	float *left_disp, float *right_disp, const int32_t *dims )
+{
+    width = dims[0];
+    height = dims[1];
+    const int stride = dims[2];
+    if( width <= 0 || height <= 0 )
+	return;
+
+    left_census.resize( width * height );
+    right_census.resize( width * height );
+    censusTransform( left, width, height, stride, &left_census[0], width, pool );
+    censusTransform( right, width, height, stride, &right_census[0], width, pool );
+
+    // each chunk of rows starts its own window, which costs window_size
+    // extra rows of costs per chunk
+    const size_t chunks = pool ? pool->getNumThreads() : 1;
+    if( scratch.size() < chunks )
+	scratch.resize( chunks );
+    const auto match = [&]( size_t i )
+    {
+	const int begin = height * i / chunks, end = height * ( i + 1 ) / chunks;
+	if( begin < end )
+	    matchRows( begin, end, left_disp, right_disp, scratch[i] );
+    };
+    if( pool )
+	pool->parallelFor( chunks, match );
+    else
+	match( 0 );
+}
@@ -0,0 +1,84 @@
+#ifndef __STEREO_BLOCK_MATCHING_ENGINE_H__
+#define __STEREO_BLOCK_MATCHING_ENGINE_H__
+
+#include <stddef.h>
+#include <vector>
+#include "disparity_engine.h"
+#include "dense_stereo_types.h"
+
+namespace stereo
+{
+
+class ThreadPool;
+
+/**
+ * Block matching on center-symmetric census costs (see census.h): the
+ * hamming distances are summed up over a square window and the disparity
+ * with the smallest sum wins, optionally followed by a left/right
+ * consistency check.
+ *
+ * This is meant for a fast, coarse depth estimate, e.g. for obstacle
+ * checks, and trades the quality of libelas or SgmEngine for latency. The
+ * window sums are updated incrementally, so the runtime does not depend on
+ * the window size or the image content. The costs of 16 disparities are
+ * computed and summed up at a time with SSE2, and the rows are split up
+ * between the threads of the pool. Only a few rows of costs are kept per
+ * thread.
+ */
+class BlockMatchingEngine : public DisparityEngine
+{
+public:
+    /**
+     * @param config window size and post processing
+     * @param disp_min smallest disparity
+     * @param disp_max largest disparity
+     * @param pool if given, the rows are split up between its threads
+     */
+    BlockMatchingEngine( const BlockMatchingConfiguration &config, int disp_min, int disp_max,
+	    ThreadPool *pool = NULL );
+
+    /** throws std::runtime_error if the configuration is invalid */
+    static void checkConfiguration( const BlockMatchingConfiguration &config );
+
+    virtual void process( const uint8_t *left, const uint8_t *right,
+	    float *left_disp, float *right_disp, const int32_t *dims );
+
+private:
+    /// buffers of one thread
+    struct Scratch
+    {
+	/// costs of the rows in the window, one ring slot for each row
+	std::vector<uint8_t> costs;
+	/// costs summed up over the window rows, and over the whole window
+	std::vector<uint16_t> column_sums, window_sums;
+	/// buffer for selectDisparities
+	std::vector<uint8_t> select;
+    };
+
+    /// computes the costs of row y (clamped to the image) into costs
+    void rowCosts( int y, uint8_t *costs ) const;
+
+    /// matches the rows [begin, end)
+    void matchRows( int begin, int end, float *left_disp, float *right_disp, Scratch &scratch );
+
+    BlockMatchingConfiguration config;
+    int disp_min;
+
+    /// number of disparities, and the number rounded up to a multiple of
+    /// 16 which the costs are computed for
+    int num_disp, num_disp_padded;
+
+    ThreadPool *pool;
+
+    /// size of the current images
+    int width, height;
+
+    /// census codes of the images
+    std::vector<uint32_t> left_census, right_census;
+
+    std::vector<Scratch> scratch;
+};
+
+}
+
+#endif
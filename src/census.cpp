@@ -0,0 +1,176 @@
+#include "census.h"
+#include "thread_pool.h"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace stereo
+{
+
+static const int CENSUS_RADIUS_X = 4, CENSUS_RADIUS_Y = 3;
+static const int CENSUS_WIDTH = 2 * CENSUS_RADIUS_X + 1;
+
+#ifdef __SSE2__
+// census codes of the 16 pixels starting at x, which need to be at least
+// CENSUS_RADIUS_X away from the border. The codes are built in four byte
+// planes, one comparison (bit) at a time, and interleaved at the end.
+static inline void census16( const uint8_t *const *rows, int x, uint32_t *codes )
+{
+    // unsigned comparison with the signed instruction
+    const __m128i sign = _mm_set1_epi8( (char)0x80 );
+    __m128i planes[4] = { _mm_setzero_si128(), _mm_setzero_si128(), 
+	_mm_setzero_si128(), _mm_setzero_si128() };
+    for( int i = 0; i < CENSUS_BITS; i++ )
+    {
+	const int dy = i / CENSUS_WIDTH - CENSUS_RADIUS_Y;
+	const int dx = i % CENSUS_WIDTH - CENSUS_RADIUS_X;
+	const __m128i a = _mm_loadu_si128( 
+		reinterpret_cast<const __m128i*>( rows[CENSUS_RADIUS_Y + dy] + x + dx ) );
+	const __m128i b = _mm_loadu_si128( 
+		reinterpret_cast<const __m128i*>( rows[CENSUS_RADIUS_Y - dy] + x - dx ) );
+	const __m128i greater = _mm_cmpgt_epi8( _mm_xor_si128( a, sign ), _mm_xor_si128( b, sign ) );
+	// bit i ends up at bit 30 - i of the code
+	__m128i &plane = planes[( CENSUS_BITS - 1 - i ) / 8];
+	plane = _mm_sub_epi8( _mm_add_epi8( plane, plane ), greater );
+    }
+    const __m128i lo = _mm_unpacklo_epi8( planes[0], planes[1] );
+    const __m128i hi = _mm_unpackhi_epi8( planes[0], planes[1] );
+    const __m128i lo2 = _mm_unpacklo_epi8( planes[2], planes[3] );
+    const __m128i hi2 = _mm_unpackhi_epi8( planes[2], planes[3] );
+    __m128i *out = reinterpret_cast<__m128i*>( codes + x );
+    _mm_storeu_si128( out, _mm_unpacklo_epi16( lo, lo2 ) );
+    _mm_storeu_si128( out + 1, _mm_unpackhi_epi16( lo, lo2 ) );
+    _mm_storeu_si128( out + 2, _mm_unpacklo_epi16( hi, hi2 ) );
+    _mm_storeu_si128( out + 3, _mm_unpackhi_epi16( hi, hi2 ) );
+}
+#endif
+
+static void censusRow( const uint8_t *image, int width, int height, int stride, int y, uint32_t *codes )
+{
+    // row pointers with the replicated border
+    const uint8_t *rows[2 * CENSUS_RADIUS_Y + 1];
+    for( int i = -CENSUS_RADIUS_Y; i <= CENSUS_RADIUS_Y; i++ )
+	rows[i + CENSUS_RADIUS_Y] = image + std::min( height - 1, std::max( 0, y + i ) ) * stride;
+
+    // columns which are done with SSE2, the others (including the border)
+    // are done one by one
+    int simd_begin = 0, simd_end = 0;
+#ifdef __SSE2__
+    if( width >= 2 * CENSUS_RADIUS_X + 16 )
+    {
+	simd_begin = CENSUS_RADIUS_X;
+	simd_end = simd_begin + ( width - 2 * CENSUS_RADIUS_X ) / 16 * 16;
+	for( int x = simd_begin; x < simd_end; x += 16 )
+	    census16( rows, x, codes );
+    }
+#endif
+
+    for( int x = 0; x < width; x++ )
+    {
+	if( x == simd_begin && simd_begin < simd_end )
+	    x = simd_end;
+	if( x >= width )
+	    break;
+
+	const bool inner = x >= CENSUS_RADIUS_X && x < width - CENSUS_RADIUS_X;
+	uint32_t code = 0;
+
+	// the first half of the window in scan order, each pixel compared
+	// with its mirror at the center
+	for( int i = 0; i < CENSUS_BITS; i++ )
+	{
+	    const int dy = i / CENSUS_WIDTH - CENSUS_RADIUS_Y;
+	    const int dx = i % CENSUS_WIDTH - CENSUS_RADIUS_X;
+	    int xa = x + dx, xb = x - dx;
+	    if( !inner )
+	    {
+		xa = std::min( width - 1, std::max( 0, xa ) );
+		xb = std::min( width - 1, std::max( 0, xb ) );
+	    }
+	    code = ( code << 1 ) | 
+		( rows[CENSUS_RADIUS_Y + dy][xa] > rows[CENSUS_RADIUS_Y - dy][xb] );
+	}
+	codes[x] = code;
+    }
+}
+
+void censusTransform( const uint8_t *image, int width, int height, int stride,
+	uint32_t *codes, int code_stride, ThreadPool *pool )
+{
+    const size_t chunks = pool ? pool->getNumThreads() : 1;
+    const auto transformChunk = [&]( size_t chunk )
+    {
+	const int begin = height * chunk / chunks;
+	const int end = height * ( chunk + 1 ) / chunks;
+	for( int y = begin; y < end; y++ )
+	    censusRow( image, width, height, stride, y, codes + (size_t)y * code_stride );
+    };
+
+    if( pool )
+	pool->parallelFor( chunks, transformChunk );
+    else
+	transformChunk( 0 );
+}
+
+#ifdef __SSE2__
+// number of set bits in each 32 bit lane
+static inline __m128i popcount32( __m128i v )
+{
+    const __m128i m1 = _mm_set1_epi8( 0x55 );
+    const __m128i m2 = _mm_set1_epi8( 0x33 );
+    const __m128i m4 = _mm_set1_epi8( 0x0f );
+    v = _mm_sub_epi8( v, _mm_and_si128( _mm_srli_epi16( v, 1 ), m1 ) );
+    v = _mm_add_epi8( _mm_and_si128( v, m2 ), _mm_and_si128( _mm_srli_epi16( v, 2 ), m2 ) );
+    v = _mm_and_si128( _mm_add_epi8( v, _mm_srli_epi16( v, 4 ) ), m4 );
+    // sum up the byte counts of each lane
+    v = _mm_add_epi8( v, _mm_srli_epi32( v, 8 ) );
+    v = _mm_add_epi8( v, _mm_srli_epi32( v, 16 ) );
+    return _mm_and_si128( v, _mm_set1_epi32( 0xff ) );
+}
+#endif
+
+static inline uint8_t hamming( uint32_t a, uint32_t b )
+{
+    return __builtin_popcount( a ^ b );
+}
+
+void censusCosts( const uint32_t *left, const uint32_t *right, int x, int width,
+	int disp_min, int num_disp, uint8_t *costs )
+{
+    const uint32_t code = left[x];
+    // right column of the first disparity, decreasing with the disparity
+    const int xr = x - disp_min;
+
+    int d = 0;
+#ifdef __SSE2__
+    const __m128i code4 = _mm_set1_epi32( code );
+    for( ; d + 16 <= num_disp; d += 16 )
+    {
+	// all 16 right pixels inside the image
+	if( xr - d - 15 < 0 || xr - d >= width )
+	    break;
+
+	__m128i counts[4];
+	for( int j = 0; j < 4; j++ )
+	{
+	    // the right codes are in reverse order of the disparities
+	    const __m128i r = _mm_shuffle_epi32( 
+		    _mm_loadu_si128( reinterpret_cast<const __m128i*>( right + xr - d - 4 * j - 3 ) ),
+		    _MM_SHUFFLE( 0, 1, 2, 3 ) );
+	    counts[j] = popcount32( _mm_xor_si128( code4, r ) );
+	}
+	const __m128i packed = _mm_packus_epi16( 
+		_mm_packs_epi32( counts[0], counts[1] ), _mm_packs_epi32( counts[2], counts[3] ) );
+	_mm_storeu_si128( reinterpret_cast<__m128i*>( costs + d ), packed );
+    }
+#endif
+    for( ; d < num_disp; d++ )
+    {
+	const int r = xr - d;
+	costs[d] = r >= 0 && r < width ? hamming( code, right[r] ) : CENSUS_BITS;
+    }
+}
+
+}
@@ -0,0 +1,49 @@
+#ifndef __STEREO_CENSUS_H__
+#define __STEREO_CENSUS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace stereo
+{
+    class ThreadPool;
+
+    /// number of bits of a census code, and the largest hamming distance
+    static const int CENSUS_BITS = 31;
+
+    /** 
+     * center-symmetric census transform over a 9x7 window: each of the 31
+     * bits compares a pixel of the window with the one mirrored at the
+     * center, which is about as discriminative as the full census of the
+     * window, but fits into 32 bits. The border is replicated.
+     *
+     * @param image 8 bit grayscale image
+     * @param width width of the image
+     * @param height height of the image
+     * @param stride bytes per line of the image
+     * @param codes receives width x height census codes
+     * @param code_stride number of codes per line of the output
+     * @param pool if given, the rows are split up between its threads
+     */
+    void censusTransform( const uint8_t *image, int width, int height, int stride,
+	    uint32_t *codes, int code_stride, ThreadPool *pool = NULL );
+
+    /**
+     * hamming distances between the census code of a left pixel and the
+     * right pixels at the disparities disp_min to disp_min + num_disp - 1.
+     * The distances are computed four at a time with SSE2. Disparities
+     * for which the right pixel is outside the image get CENSUS_BITS.
+     *
+     * @param left census codes of the left row
+     * @param right census codes of the right row
+     * @param x column of the left pixel
+     * @param width width of the rows
+     * @param disp_min smallest disparity
+     * @param num_disp number of disparities, a multiple of 16
+     * @param costs receives num_disp distances
+     */
+    void censusCosts( const uint32_t *left, const uint32_t *right, int x, int width,
+	    int disp_min, int num_disp, uint8_t *costs );
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include "confidence.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace stereo
+{
+
+// difference of left and right disparity at which the consistency score
+// drops to 0
+static const float LR_TOLERANCE = 2.0f;
+
+// texture strength of a row, the saturated sum of the horizontal gradients
+// |g[x+1] - g[x-1]| at x-2 to x+2. The gradients at the border are 0.
+static void textureRow( const uint8_t *g, int width, uint8_t *texture )
+{
+    // columns which are done with SSE2, all gradients inside the image
+    int simd_begin = 0, simd_end = 0;
+#ifdef __SSE2__
+    if( width >= 22 )
+    {
+	simd_begin = 3;
+	simd_end = simd_begin + ( width - 6 ) / 16 * 16;
+	for( int x = simd_begin; x < simd_end; x += 16 )
+	{
+	    __m128i sum = _mm_setzero_si128();
+	    for( int j = -2; j <= 2; j++ )
+	    {
+		const __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( g + x + j + 1 ) );
+		const __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( g + x + j - 1 ) );
+		const __m128i diff = _mm_or_si128( _mm_subs_epu8( a, b ), _mm_subs_epu8( b, a ) );
+		sum = _mm_adds_epu8( sum, diff );
+	    }
+	    _mm_storeu_si128( reinterpret_cast<__m128i*>( texture + x ), sum );
+	}
+    }
+#endif
+
+    for( int x = 0; x < width; x++ )
+    {
+	if( x == simd_begin && simd_begin < simd_end )
+	    x = simd_end;
+	if( x >= width )
+	    break;
+
+	int sum = 0;
+	for( int i = std::max( 1, x - 2 ); i <= std::min( width - 2, x + 2 ); i++ )
+	    sum += std::abs( g[i + 1] - g[i - 1] );
+	texture[x] = std::min( 255, sum );
+    }
+}
+
+void computeConfidence( const cv::Mat &gray, const cv::Mat &left_disp, const cv::Mat &right_disp,
+	cv::Mat &confidence, ThreadPool *pool )
+{
+    if( gray.type() != CV_8UC1 || left_disp.type() != CV_32FC1
+	    || ( !right_disp.empty() && right_disp.type() != CV_32FC1 ) )
+	throw std::runtime_error( "computeConfidence expects a CV_8UC1 image and CV_32FC1 disparities." );
+    if( !right_disp.empty() && right_disp.size() != left_disp.size() )
+	throw std::runtime_error( "computeConfidence expects left and right disparities of the same size." );
+
+    // distance between the pixels of the disparity image in the gray image
+    int scale = 1;
+    if( gray.size() != left_disp.size() )
+    {
+	scale = 2;
+	if( gray.cols / 2 != left_disp.cols || gray.rows / 2 != left_disp.rows )
+	    throw std::runtime_error( "computeConfidence expects disparities of the same or half the size of the image." );
+    }
+
+    const int width = left_disp.cols, height = left_disp.rows;
+    confidence.create( height, width, CV_8UC1 );
+    const bool use_right = !right_disp.empty();
+
+    const size_t chunks = pool ? pool->getNumThreads() : 1;
+    const auto confidenceChunk = [&]( size_t chunk )
+    {
+	const int row_begin = height * chunk / chunks;
+	const int row_end = height * ( chunk + 1 ) / chunks;
+	std::vector<uint8_t> texture( gray.cols );
+	for( int y = row_begin; y < row_end; y++ )
+	{
+	    textureRow( gray.ptr<uint8_t>( y * scale ), gray.cols, &texture[0] );
+	    const float *l = left_disp.ptr<float>( y );
+	    const float *r = use_right ? right_disp.ptr<float>( y ) : NULL;
+	    uint8_t *c = confidence.ptr<uint8_t>( y );
+	    for( int x = 0; x < width; x++ )
+	    {
+		// also catches NaN
+		const float d = l[x];
+		if( !( d >= 0 ) )
+		{
+		    c[x] = 0;
+		    continue;
+		}
+
+		int score = texture[x * scale];
+		if( r )
+		{
+		    // the disparities are in pixels of the gray image
+		    const int xr = x - (int)( d / scale + 0.5f );
+		    float consistency = 0;
+		    if( xr >= 0 && r[xr] >= 0 )
+			consistency = std::max( 0.0f, 255.0f - std::fabs( d - r[xr] ) * ( 255.0f / LR_TOLERANCE ) );
+		    score = std::min( score, (int)consistency );
+		}
+		c[x] = score;
+	    }
+	}
+    };
+
+    if( pool )
+	pool->parallelFor( chunks, confidenceChunk );
+    else
+	confidenceChunk( 0 );
+}
+
+}
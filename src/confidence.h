@@ -0,0 +1,40 @@
+#ifndef __STEREO_CONFIDENCE_H__
+#define __STEREO_CONFIDENCE_H__
+
+#include <opencv2/core/core.hpp>
+
+namespace stereo
+{
+    class ThreadPool;
+
+    /**
+     * cheap per-pixel confidence of the left disparities, from 0 (invalid
+     * or not trustworthy) to 255. It is the smaller of two scores:
+     *
+     * - the texture strength, which is the sum of the absolute horizontal
+     *   gradients of the five pixels around the pixel, saturated at 255.
+     *   Matching along the epipolar lines fails where there is no
+     *   horizontal texture. It is computed 16 pixels at a time with SSE2.
+     * - the left/right consistency, which is 255 if the right disparity
+     *   of the matched right pixel is the same, and drops linearly to 0 at
+     *   a difference of two pixels. Pixels whose right pixel is invalid or
+     *   outside the image get 0.
+     *
+     * Invalid (negative) disparities get 0.
+     *
+     * @param gray left grayscale image (CV_8UC1) the disparities were
+     *        computed from, either of the same size as the disparities or
+     *        twice the size (libelas subsampling)
+     * @param left_disp left disparity image (CV_32FC1)
+     * @param right_disp right disparity image (CV_32FC1) of the same size,
+     *        may be empty, in which case only the texture is used
+     * @param confidence receives the confidence (CV_8UC1) of the size of
+     *        left_disp
+     * @param pool if given, the rows are split up between the threads of
+     *        the pool
+     */
+    void computeConfidence( const cv::Mat &gray, const cv::Mat &left_disp, const cv::Mat &right_disp,
+	    cv::Mat &confidence, ThreadPool *pool = NULL );
+}
+
+#endif
@@ -0,0 +1,198 @@
+#include "dense_stereo_pipeline.h"
+
+using namespace stereo;
+
+void DenseStereoPipeline::SlotQueue::push( size_t slot )
+{
+    {
+	std::lock_guard<std::mutex> lock( mutex );
+	slots.push_back( slot );
+    }
+    cond.notify_one();
+}
+
+bool DenseStereoPipeline::SlotQueue::pop( size_t &slot )
+{
+    std::unique_lock<std::mutex> lock( mutex );
+    while( slots.empty() && !closed )
+	cond.wait( lock );
+    if( slots.empty() )
+	return false;
+
+    slot = slots.front();
+    slots.pop_front();
+    return true;
+}
+
+void DenseStereoPipeline::SlotQueue::close()
+{
+    {
+	std::lock_guard<std::mutex> lock( mutex );
+	closed = true;
+    }
+    cond.notify_all();
+}
+
+DenseStereoPipeline::DenseStereoPipeline( DenseStereo &dense, const Callback &callback, size_t queue_size )
+    : dense( dense ), callback( callback ), in_flight( 0 )
+{
+    // one slot for each waiting frame pair, plus one for each stage
+    slots.resize( std::max( queue_size, (size_t)1 ) + 3 );
+    for( size_t i = 0; i < slots.size(); i++ )
+	free_slots.push( i );
+
+    threads.push_back( std::thread( &DenseStereoPipeline::preprocessStage, this ) );
+    threads.push_back( std::thread( &DenseStereoPipeline::matchStage, this ) );
+    threads.push_back( std::thread( &DenseStereoPipeline::distanceStage, this ) );
+}
+
+DenseStereoPipeline::~DenseStereoPipeline()
+{
+    {
+	std::unique_lock<std::mutex> lock( mutex );
+	while( in_flight > 0 )
+	    idle_cond.wait( lock );
+    }
+
+    preprocess_queue.close();
+    match_queue.close();
+    distance_queue.close();
+    for( size_t i = 0; i < threads.size(); i++ )
+	threads[i].join();
+}
+
+void DenseStereoPipeline::push( const cv::Mat &left_frame, const cv::Mat &right_frame,
+	const base::Time &time, bool isRectified )
+{
+    checkError();
+
+    // blocks until a slot becomes available
+    size_t index;
+    free_slots.pop( index );
+
+    {
+	std::lock_guard<std::mutex> lock( mutex );
+	in_flight++;
+    }
+
+    Slot &slot( slots[index] );
+    slot.time = time;
+    slot.isRectified = isRectified;
+    slot.left_frame = left_frame;
+    slot.right_frame = right_frame;
+    slot.failed = false;
+
+    preprocess_queue.push( index );
+}
+
+void DenseStereoPipeline::flush()
+{
+    {
+	std::unique_lock<std::mutex> lock( mutex );
+	while( in_flight > 0 )
+	    idle_cond.wait( lock );
+    }
+
+    checkError();
+}
+
+void DenseStereoPipeline::checkError()
+{
+    std::exception_ptr pending_error;
+    {
+	std::lock_guard<std::mutex> lock( mutex );
+	std::swap( pending_error, error );
+    }
+
+    if( pending_error )
+	std::rethrow_exception( pending_error );
+}
+
+void DenseStereoPipeline::fail( Slot &slot )
+{
+    // called from within a catch block
+    std::lock_guard<std::mutex> lock( mutex );
+    if( !error )
+	error = std::current_exception();
+    slot.failed = true;
+}
+
+void DenseStereoPipeline::preprocessStage()
+{
+    size_t index;
+    while( preprocess_queue.pop( index ) )
+    {
+	Slot &slot( slots[index] );
+	try
+	{
+	    dense.preprocessFramePair( slot.left_frame, slot.right_frame,
+		    slot.left_gray, slot.right_gray, slot.isRectified );
+	}
+	catch( ... )
+	{
+	    fail( slot );
+	}
+
+	// release the input images as early as possible
+	slot.left_frame = cv::Mat();
+	slot.right_frame = cv::Mat();
+
+	match_queue.push( index );
+    }
+}
+
+void DenseStereoPipeline::matchStage()
+{
+    size_t index;
+    while( match_queue.pop( index ) )
+    {
+	Slot &slot( slots[index] );
+	if( !slot.failed )
+	{
+	    try
+	    {
+		dense.computeDisparities( slot.left_gray, slot.right_gray,
+			slot.left_disp, slot.right_disp );
+	    }
+	    catch( ... )
+	    {
+		fail( slot );
+	    }
+	}
+
+	distance_queue.push( index );
+    }
+}
+
+void DenseStereoPipeline::distanceStage()
+{
+    size_t index;
+    while( distance_queue.pop( index ) )
+    {
+	Slot &slot( slots[index] );
+	if( !slot.failed )
+	{
+	    try
+	    {
+		dense.getDistanceImages( slot.left_disp, slot.right_disp );
+
+		Result result;
+		result.time = slot.time;
+		result.left_distance = slot.left_disp;
+		result.right_distance = slot.right_disp;
+		callback( result );
+	    }
+	    catch( ... )
+	    {
+		fail( slot );
+	    }
+	}
+
+	{
+	    std::lock_guard<std::mutex> lock( mutex );
+	    in_flight--;
+	}
+	idle_cond.notify_all();
+	free_slots.push( index );
+    }
+}
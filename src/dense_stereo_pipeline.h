@@ -0,0 +1,129 @@
+#ifndef __DENSE_STEREO_PIPELINE_H__
+#define __DENSE_STEREO_PIPELINE_H__
+
+#include "densestereo.h"
+#include <base/Time.hpp>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace stereo {
+
+/**
+ * Asynchronous front-end for DenseStereo, which overlaps the processing of
+ * consecutive frame pairs. Frame pairs are pushed into a bounded queue and
+ * run through three stages, each in its own thread:
+ *
+ *  - rectification, grayscale conversion and blur
+ *  - disparity computation with libelas
+ *  - conversion from disparity to distance
+ *
+ * So while frame N is matched, frame N+1 is already preprocessed and the
+ * distance images of frame N-1 are computed and delivered. Results are
+ * passed to the callback in the order the frames were pushed, from the
+ * thread of the last stage.
+ *
+ * The DenseStereo object needs to be fully configured before the pipeline
+ * is created and must not be used otherwise while the pipeline exists.
+ */
+class DenseStereoPipeline
+{
+public:
+  /** distance images of a single frame pair */
+  struct Result
+  {
+    /// time that was given when the frame pair was pushed
+    base::Time time;
+    /// left and right distance images, only valid during the callback
+    cv::Mat left_distance, right_distance;
+  };
+
+  typedef std::function<void (const Result&)> Callback;
+
+  /**
+   * @param dense configured dense stereo object to use for the processing
+   * @param callback is called with the result of each frame pair
+   * @param queue_size number of frame pairs which can be waiting for
+   *        processing before push blocks
+   */
+  DenseStereoPipeline( DenseStereo &dense, const Callback &callback, size_t queue_size = 2 );
+
+  /** waits for all frame pairs to be processed and stops the threads */
+  ~DenseStereoPipeline();
+
+  /**
+   * queue a frame pair for processing. Blocks if the queue is full.
+   *
+   * The images are not copied, so their content must not be changed until
+   * the result for this pair was delivered. If a previous frame pair failed
+   * to process, the error is rethrown here.
+   *
+   * @param left_frame left input frame
+   * @param right_frame right input frame
+   * @param time timestamp which is passed on to the result
+   * @param isRectified tells if the input images are already rectified
+   */
+  void push( const cv::Mat &left_frame, const cv::Mat &right_frame,
+	  const base::Time &time = base::Time(), bool isRectified = false );
+
+  /**
+   * blocks until all frame pairs that have been pushed are delivered. If
+   * one of them failed to process, the error is rethrown here.
+   */
+  void flush();
+
+private:
+  /// storage for a frame pair travelling through the stages
+  struct Slot
+  {
+    base::Time time;
+    bool isRectified;
+    cv::Mat left_frame, right_frame;
+    cv::Mat left_gray, right_gray;
+    cv::Mat left_disp, right_disp;
+    bool failed;
+  };
+
+  /// queue of slot indices handed from one stage to the next
+  class SlotQueue
+  {
+  public:
+    SlotQueue() : closed( false ) {}
+    void push( size_t slot );
+    /** @return false if the queue was closed and is empty */
+    bool pop( size_t &slot );
+    void close();
+
+  private:
+    std::deque<size_t> slots;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool closed;
+  };
+
+  void preprocessStage();
+  void matchStage();
+  void distanceStage();
+  void fail( Slot &slot );
+  void checkError();
+
+  DenseStereo &dense;
+  Callback callback;
+
+  std::vector<Slot> slots;
+  SlotQueue free_slots, preprocess_queue, match_queue, distance_queue;
+
+  std::mutex mutex;
+  std::condition_variable idle_cond;
+  size_t in_flight;
+  std::exception_ptr error;
+
+  std::vector<std::thread> threads;
+};
+
+}
+
+#endif
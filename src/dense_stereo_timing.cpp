@@ -0,0 +1,98 @@
+#include "dense_stereo_timing.h"
+#include <algorithm>
+
+using namespace stereo;
+
+base::Time& DenseStereoTiming::operator[]( TimingStage stage )
+{
+    switch( stage )
+    {
+	case TIMING_RECTIFICATION: return rectification;
+	case TIMING_GRAYSCALE: return grayscale;
+	case TIMING_MATCHING: return matching;
+	default: return distance;
+    }
+}
+
+const base::Time& DenseStereoTiming::operator[]( TimingStage stage ) const
+{
+    return const_cast<DenseStereoTiming&>( *this )[stage];
+}
+
+TimingRecorder::TimingRecorder( size_t history_size )
+    : history_size( std::max( history_size, (size_t)1 ) )
+{
+    reset();
+}
+
+void TimingRecorder::setHistorySize( size_t history_size )
+{
+    {
+	std::lock_guard<std::mutex> lock( mutex );
+	this->history_size = std::max( history_size, (size_t)1 );
+    }
+    reset();
+}
+
+void TimingRecorder::reset()
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    for( int i = 0; i < TIMING_STAGES; i++ )
+    {
+	samples[i].clear();
+	samples[i].reserve( history_size );
+	next_sample[i] = 0;
+    }
+    last = DenseStereoTiming();
+}
+
+void TimingRecorder::record( TimingStage stage, const base::Time &duration )
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    last[stage] = duration;
+
+    // the buffers are reserved, so this doesn't allocate
+    std::vector<int64_t> &s( samples[stage] );
+    if( s.size() < history_size )
+	s.push_back( duration.toMicroseconds() );
+    else
+	s[next_sample[stage]] = duration.toMicroseconds();
+    next_sample[stage] = ( next_sample[stage] + 1 ) % history_size;
+}
+
+DenseStereoTiming TimingRecorder::getLast() const
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    return last;
+}
+
+DenseStereoTimingStatistics TimingRecorder::getStatistics() const
+{
+    std::vector<int64_t> sorted[TIMING_STAGES];
+    {
+	std::lock_guard<std::mutex> lock( mutex );
+	for( int i = 0; i < TIMING_STAGES; i++ )
+	    sorted[i] = samples[i];
+    }
+
+    DenseStereoTimingStatistics stats;
+    for( int i = 0; i < TIMING_STAGES; i++ )
+    {
+	const TimingStage stage = (TimingStage)i;
+	std::vector<int64_t> &s( sorted[i] );
+	stats.frames = std::max( stats.frames, s.size() );
+	if( s.empty() )
+	    continue;
+
+	std::sort( s.begin(), s.end() );
+	int64_t sum = 0;
+	for( size_t j = 0; j < s.size(); j++ )
+	    sum += s[j];
+
+	stats.min[stage] = base::Time::fromMicroseconds( s.front() );
+	stats.max[stage] = base::Time::fromMicroseconds( s.back() );
+	stats.mean[stage] = base::Time::fromMicroseconds( sum / (int64_t)s.size() );
+	stats.p95[stage] = base::Time::fromMicroseconds( s[( s.size() * 95 + 99 ) / 100 - 1] );
+    }
+    return stats;
+}
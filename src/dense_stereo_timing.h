@@ -0,0 +1,92 @@
+#ifndef __STEREO_DENSE_STEREO_TIMING_H__
+#define __STEREO_DENSE_STEREO_TIMING_H__
+
+#include <vector>
+#include <mutex>
+#include <base/Time.hpp>
+
+namespace stereo
+{
+
+/** processing stages of DenseStereo which are timed */
+enum TimingStage
+{
+    TIMING_RECTIFICATION,
+    TIMING_GRAYSCALE,
+    TIMING_MATCHING,
+    TIMING_DISTANCE,
+    TIMING_STAGES
+};
+
+/** wall-clock durations of the processing stages of DenseStereo */
+struct DenseStereoTiming
+{
+    /// undistortion and rectification of both images
+    base::Time rectification;
+    /// conversion of both images to 8 bit grayscale, including the
+    /// gaussian blur which is fused into the conversion
+    base::Time grayscale;
+    /// disparity computation, including coarse pass, stitching of the bands
+    /// and upsampling
+    base::Time matching;
+    /// conversion to distance images or point clouds. If it is done while
+    /// matching in bands, this is the longest conversion time of a band.
+    base::Time distance;
+
+    base::Time& operator[]( TimingStage stage );
+    const base::Time& operator[]( TimingStage stage ) const;
+};
+
+/** statistics of the stage durations over a number of frames */
+struct DenseStereoTimingStatistics
+{
+    DenseStereoTimingStatistics() : frames( 0 ) {}
+
+    DenseStereoTiming min, mean, p95, max;
+    /// number of frames the statistics are taken over
+    size_t frames;
+};
+
+/**
+ * Records the durations of the processing stages and keeps the last samples
+ * of each stage for the statistics. Each stage has its own history, as not
+ * every frame passes all stages (e.g. rectification is skipped for
+ * rectified input), and with DenseStereoPipeline the stages run for
+ * different frames at the same time. Recording is thread-safe.
+ */
+class TimingRecorder
+{
+public:
+    /** @param history_size number of samples kept for each stage */
+    explicit TimingRecorder( size_t history_size = 100 );
+
+    /** set the number of samples kept for each stage, which drops all
+     * samples recorded so far
+     */
+    void setHistorySize( size_t history_size );
+
+    void record( TimingStage stage, const base::Time &duration );
+
+    /** @return the last recorded duration of each stage */
+    DenseStereoTiming getLast() const;
+
+    /** @return min, mean, 95th percentile and max over the recorded samples */
+    DenseStereoTimingStatistics getStatistics() const;
+
+    /** drop all samples */
+    void reset();
+
+private:
+    mutable std::mutex mutex;
+    size_t history_size;
+
+    /// ring buffers of samples in microseconds, and the next write position
+    std::vector<int64_t> samples[TIMING_STAGES];
+    size_t next_sample[TIMING_STAGES];
+
+    DenseStereoTiming last;
+};
+
+}
+
+#endif
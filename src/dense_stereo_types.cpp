@@ -11,3 +11,23 @@ libElasConfiguration::libElasConfiguration()
     copyFromElas( &params, this );
 }
 
+
+TemporalPriorConfiguration::TemporalPriorConfiguration()
+    : enabled( false ), margin( 8 ), min_coverage( 0.8 ), scene_cut_threshold( 20.0 )
+{
+}
+
+PointCloudConfiguration::PointCloudConfiguration()
+    : stride( 1 ), voxel_size( 0 ), max_distance( 0 )
+{
+}
+
+SgmConfiguration::SgmConfiguration()
+    : p1( 5 ), p2( 60 ), lr_threshold( 1 ), subpixel( true )
+{
+}
+
+BlockMatchingConfiguration::BlockMatchingConfiguration()
+    : window_size( 7 ), lr_threshold( 1 ), subpixel( true )
+{
+}
@@ -5,6 +5,22 @@
 
 namespace stereo {
 
+  /** Interpolation used when undistorting and rectifying the input images */
+  enum RectificationInterpolation
+  {
+    RECTIFICATION_NEAREST,
+    RECTIFICATION_LINEAR,
+    RECTIFICATION_CUBIC
+  };
+
+  /** Matcher which computes the disparities in DenseStereo */
+  enum DisparityEngineType
+  {
+    ENGINE_ELAS,                    // libelas
+    ENGINE_SGM,                     // semi-global matching on census costs, see SgmEngine
+    ENGINE_CENSUS_BM                // census block matching, see BlockMatchingEngine
+  };
+
   /** Configuration parameters for lib elas.*/
   struct libElasConfiguration
   {
@@ -37,6 +53,54 @@ namespace stereo {
                                     //       width/2 x height/2 (rounded towards zero)
   };
 
+  /** Configuration of the temporal disparity prior of DenseStereo */
+  struct TemporalPriorConfiguration
+  {
+    TemporalPriorConfiguration();
+
+    bool    enabled;                // use the previous frame to restrict the disparity search
+    int32_t margin;                 // disparities the range of the previous frame is extended by
+    float   min_coverage;           // drop the prior if the share of valid pixels falls below
+                                    // this fraction of the last frame matched without prior
+    float   scene_cut_threshold;    // mean absolute gray value difference between consecutive
+                                    // (downscaled) frames above which the prior is not used
+  };
+
+  /** Configuration of the point cloud generation of DenseStereo */
+  struct PointCloudConfiguration
+  {
+    PointCloudConfiguration();
+
+    int32_t stride;                 // only reproject every stride-th pixel in x and y
+    float   voxel_size;             // edge length of the voxel grid the points are reduced to,
+                                    // 0 disables the reduction
+    float   max_distance;           // skip points further away from the camera, 0 for no limit
+  };
+
+  /** Configuration of the semi-global matching engine. The disparity range
+   * is taken from libElasConfiguration. */
+  struct SgmConfiguration
+  {
+    SgmConfiguration();
+
+    int32_t p1;                     // penalty for disparity changes of one pixel between neighbours
+    int32_t p2;                     // penalty for larger disparity changes, at most 224
+    int32_t lr_threshold;           // disparity threshold for left/right consistency check,
+                                    // negative to disable the check
+    bool    subpixel;               // refine the left disparities with a parabola fit
+  };
+
+  /** Configuration of the census block matching engine */
+  struct BlockMatchingConfiguration
+  {
+    BlockMatchingConfiguration();
+
+    int32_t window_size;            // width and height of the matching window, odd, at most 31
+    int32_t lr_threshold;           // disparity threshold for left/right consistency check,
+                                    // negative to disable the check
+    bool    subpixel;               // refine the left disparities with a parabola fit
+  };
+
 }
 
 #endif
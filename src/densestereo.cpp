@@ -1,90 +1,348 @@
 #include "densestereo.h"
 #include "configuration.h"
+#include "disparity_conversion.h"
+#include "disparity_upsampling.h"
+#include "confidence.h"
+#include "sgm_engine.h"
+#include "block_matching_engine.h"
 #include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <mutex>
 #include <opencv2/opencv.hpp>
 
 using namespace std;
 
 namespace stereo {
 
+// adds the valid disparities of an image to a histogram
+static void accumulateHistogram( const cv::Mat &disp, std::vector<int> &bins,
+                                 int &valid, int &total )
+{
+  const int max_bin = (int)bins.size() - 1;
+  for(int y = 0; y < disp.rows; y++)
+  {
+    const float *d = disp.ptr<float>(y);
+    for(int x = 0; x < disp.cols; x++)
+    {
+      if( d[x] >= 0 )
+      {
+        bins[std::min(max_bin, (int)(d[x] + 0.5f))]++;
+        valid++;
+      }
+    }
+  }
+  total += disp.rows * disp.cols;
+}
+
 // wrapper class to hide libelas from orocos
 DenseStereo::DenseStereo() 
-    : gaussian_kernel(0), calibrationInitialized( false )
+    : gaussian_kernel(0), engine_type( ENGINE_ELAS ), engines_left_only( false ), engine_revision( 0 ), band_overlap( 32 ), upsample_subsampled( false ),
+      compact_output( false ), confidence_output( false ),
+      coarse_to_fine( false ), coarse_to_fine_bands( 8 ), coarse_to_fine_margin( 4 ),
+      coarse_engine( NULL ),
+      prior_valid( false ), prior_used( false ), prior_reference_coverage( 0 ),
+      calibrationInitialized( false ),
+      rectification_interpolation( RECTIFICATION_CUBIC ),
+      thread_pool( 2 )
 {
-  // configure Elas and instantiate it
-  Elas::parameters elasParam;
-  libElasConfiguration config;
-  copyToElas( &config, &elasParam );
-  elas = new Elas(elasParam);
+  // configure libelas with the default parameters and instantiate it
+  createEngines( 1 );
 }
 
 DenseStereo::~DenseStereo() {
-  delete elas;
+  for(size_t i = 0; i < engine_pool.size(); i++)
+    delete engine_pool[i];
+  for(size_t i = 0; i < band_engines.size(); i++)
+    delete band_engines[i];
+  delete coarse_engine;
+  for(size_t i = 0; i < batch_workers.size(); i++)
+    delete batch_workers[i];
 }
 
 //set stereo calibration
 void DenseStereo::setStereoCalibration(const frame_helper::StereoCalibration& stereoCal, const int imgWidth, const int imgHeight){
+  const cv::Size size(imgWidth, imgHeight);
   calParam.setCalibration(stereoCal);
-  calParam.setImageSize(cv::Size(imgWidth, imgHeight));
-  calParam.initCv();
+  calParam.setImageSize(size);
+
+  RectificationCache &cache = RectificationCache::instance();
+  const uint64_t key = RectificationCache::getKey(stereoCal, size);
+  if( !cache.lookup(key, rectification_cache_directory, rectification_maps) )
+  {
+    calParam.initCv();
+
+    // convert the float maps into the compact fixed-point representation
+    // once, remapping with these is a lot cheaper for every frame
+    RectificationMaps maps;
+    cv::convertMaps(calParam.camLeft.map1, calParam.camLeft.map2,
+                    maps.left_map1, maps.left_map2, CV_16SC2);
+    cv::convertMaps(calParam.camRight.map1, calParam.camRight.map2,
+                    maps.right_map1, maps.right_map2, CV_16SC2);
+    calParam.Q.copyTo(maps.Q);
+    cache.insert(key, rectification_cache_directory, maps);
+    rectification_maps = maps;
+
+    // only the fixed-point maps are used
+    calParam.camLeft.map1.release();
+    calParam.camLeft.map2.release();
+    calParam.camRight.map1.release();
+    calParam.camRight.map2.release();
+  }
+
+  // size the buffers for the calibrated image size once, so processing
+  // frames of that size doesn't need to allocate anything
+  left_gray.create(size, CV_8UC1);
+  right_gray.create(size, CV_8UC1);
+  left_filter.reserve(size);
+  right_filter.reserve(size);
+
+  point_cloud_converter.setReprojectionMatrix(rectification_maps.Q);
   
   calibrationInitialized = true;
+  updateProcessingWindow();
+}
+
+void DenseStereo::setRegionOfInterest( const cv::Rect &roi ){
+  this->roi = roi;
+  updateProcessingWindow();
+}
+
+void DenseStereo::setMask( const cv::Mat &mask ){
+  if( !mask.empty() && mask.type() != CV_8UC1 )
+    throw std::runtime_error("The mask needs to be of type CV_8UC1.");
+
+  mask.copyTo( this->mask );
+  updateProcessingWindow();
+}
+
+void DenseStereo::updateProcessingWindow(){
+  if( !calibrationInitialized )
+    return;
+
+  const cv::Size size = calParam.getImageSize();
+  const cv::Rect image_rect(0, 0, size.width, size.height);
+  invalid_mask.release();
+  invalid_mask_half.release();
+  processing_window = image_rect;
+  if( roi.area() <= 0 && mask.empty() )
+    return;
+
+  cv::Rect valid_rect = image_rect;
+  if( roi.area() > 0 )
+    valid_rect &= roi;
+
+  if( !mask.empty() )
+  {
+    if( mask.size() != size )
+      throw std::runtime_error("The mask needs to have the size of the calibrated images.");
+
+    // bounding box of the non-zero mask pixels
+    int min_x = size.width, max_x = -1, min_y = size.height, max_y = -1;
+    for(int y = 0; y < size.height; y++)
+    {
+      const uint8_t *row = mask.ptr<uint8_t>(y);
+      for(int x = 0; x < size.width; x++)
+      {
+        if( row[x] )
+        {
+          min_x = std::min(min_x, x);
+          max_x = std::max(max_x, x);
+          min_y = std::min(min_y, y);
+          max_y = std::max(max_y, y);
+        }
+      }
+    }
+    if( max_x >= 0 )
+      valid_rect &= cv::Rect(min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+    else
+      valid_rect = cv::Rect();
+  }
+
+  if( valid_rect.area() <= 0 )
+    throw std::runtime_error("The region of interest and mask don't leave any pixels to process.");
+
+  // the matcher searches the correspondences of the valid pixels up to
+  // disp_max columns to the left (left image) and right (right image)
+  // the window starts at even coordinates, so that it maps onto the half
+  // resolution output with subsampling
+  const int disp_max = std::max(0, (int)elas_config.disp_max);
+  cv::Rect window = cv::Rect(valid_rect.x - disp_max, valid_rect.y,
+                             valid_rect.width + 2 * disp_max, valid_rect.height) & image_rect;
+  const int x = window.x & ~1, y = window.y & ~1;
+  processing_window = cv::Rect(x, y, window.x + window.width - x, window.y + window.height - y);
+
+  invalid_mask.create(size, CV_8UC1);
+  invalid_mask.setTo(cv::Scalar(255));
+  invalid_mask(valid_rect).setTo(cv::Scalar(0));
+  if( !mask.empty() )
+    invalid_mask.setTo(cv::Scalar(255), mask == 0);
+
+  // the half resolution outputs of libelas subsampling contain every
+  // second pixel
+  cv::resize(invalid_mask, invalid_mask_half, cv::Size(size.width / 2, size.height / 2),
+             0, 0, cv::INTER_NEAREST);
+}
+
+cv::Rect DenseStereo::getProcessingWindow( const cv::Size &size ) const {
+  if( invalid_mask.empty() || size != invalid_mask.size() )
+    return cv::Rect(0, 0, size.width, size.height);
+  return processing_window;
+}
+
+void DenseStereo::invalidateOutsideRoi( cv::Mat &image, float value ){
+  if( invalid_mask.empty() )
+    return;
+
+  const cv::Mat *mask = &invalid_mask;
+  if( image.size() == invalid_mask_half.size() )
+    mask = &invalid_mask_half;
+  else if( image.size() != invalid_mask.size() )
+    return;
+
+  const size_t num_chunks = thread_pool.getNumThreads();
+  thread_pool.parallelFor(num_chunks, [&](size_t i)
+  {
+    const int begin = image.rows * i / num_chunks;
+    const int end = image.rows * (i + 1) / num_chunks;
+    if( begin < end )
+    {
+      cv::Mat chunk = image.rowRange(begin, end);
+      chunk.setTo(cv::Scalar(value), mask->rowRange(begin, end));
+    }
+  });
+}
+
+void DenseStereo::setGaussianKernel( int size ){
+  left_filter.setKernelSize( size );
+  right_filter.setKernelSize( size );
+  gaussian_kernel = size;
 }
 
 //load libelas parameters (if other then default)
 void DenseStereo::setLibElasConfiguration(const libElasConfiguration &libElasParam){
-  //delete default configured libelas
-  delete elas;
+  elas_config = libElasParam;
+  engine_revision++;
+  createEngines( engine_pool.size() );
+  updateProcessingWindow();
+  prior_valid = false;
+}
 
-  //configure Elas and instantiate it
-  Elas::parameters elasParam;
-  copyToElas( &libElasParam, &elasParam );
+void DenseStereo::setDisparityEngine( DisparityEngineType type ){
+  engine_type = type;
+  engine_revision++;
+  createEngines( engine_pool.size() );
+  updateProcessingWindow();
+  prior_valid = false;
+}
 
-  elas = new Elas(elasParam);
+void DenseStereo::setSgmConfiguration( const SgmConfiguration &config ){
+  sgm_config = config;
+  engine_revision++;
+  createEngines( engine_pool.size() );
+}
+
+void DenseStereo::setBlockMatchingConfiguration( const BlockMatchingConfiguration &config ){
+  // keeps the current engines if the configuration is invalid
+  BlockMatchingEngine::checkConfiguration( config );
+  bm_config = config;
+  engine_revision++;
+  createEngines( engine_pool.size() );
+}
+
+void DenseStereo::setCoarseToFine( bool enable, size_t num_bands, int margin ){
+  coarse_to_fine = enable;
+  coarse_to_fine_bands = num_bands;
+  coarse_to_fine_margin = std::max(0, margin);
+}
+
+void DenseStereo::setTemporalPrior( const TemporalPriorConfiguration &config ){
+  temporal_prior = config;
+  prior_valid = false;
+}
+
+void DenseStereo::setNumThreads( size_t num_threads ){
+  if( num_threads < 1 )
+    num_threads = 1;
+
+  thread_pool.setNumThreads( num_threads );
+  createEngines( num_threads );
+}
+
+// (re)creates the matcher instances, one for each band
+void DenseStereo::createEngines( size_t num_instances ){
+  for(size_t i = 0; i < engine_pool.size(); i++)
+    delete engine_pool[i];
+  engine_pool.clear();
+
+  for(size_t i = 0; i < num_instances; i++)
+    engine_pool.push_back( createEngine( elas_config.disp_min, elas_config.disp_max, engines_left_only ) );
+
+  band_left_disp.resize( num_instances );
+  band_right_disp.resize( num_instances );
+  band_conversion_time.resize( num_instances );
+
+  // the coarse-to-fine instances are created on demand with the new
+  // configuration
+  for(size_t i = 0; i < band_engines.size(); i++)
+    delete band_engines[i];
+  band_engines.clear();
+  band_disp_range.clear();
+  delete coarse_engine;
+  coarse_engine = NULL;
+}
+
+void DenseStereo::setEnginesLeftOnly( bool left_only ){
+  if( left_only == engines_left_only )
+    return;
+
+  // the coarse engine always computes only the left disparities
+  engines_left_only = left_only;
+  for(size_t i = 0; i < engine_pool.size(); i++)
+    engine_pool[i]->setLeftOnly( left_only );
+  for(size_t i = 0; i < band_engines.size(); i++)
+    if( band_engines[i] )
+      band_engines[i]->setLeftOnly( left_only );
+}
+
+DisparityEngine* DenseStereo::createEngine( int disp_min, int disp_max, bool left_only,
+                                            bool subsampling ){
+  if( engine_type == ENGINE_SGM )
+    return new SgmEngine( sgm_config, disp_min, disp_max, &thread_pool );
+  if( engine_type == ENGINE_CENSUS_BM )
+    return new BlockMatchingEngine( bm_config, disp_min, disp_max, &thread_pool );
+
+  Elas::parameters elasParam;
+  copyToElas( &elas_config, &elasParam );
+  elasParam.disp_min = disp_min;
+  elasParam.disp_max = disp_max;
+  elasParam.postprocess_only_left = elas_config.postprocess_only_left || left_only;
+  elasParam.subsampling = elas_config.subsampling && subsampling;
+  return new ElasEngine(elasParam);
 }
 
 // undistorts and rectifies images with opencv
-void DenseStereo::undistortAndRectify(cv::Mat &image, const frame_helper::CameraCalibrationCv& calib){
-  cv::Mat newImage;
-  
-  // undistort/rectify image
-  cv::remap(image, newImage, calib.map1, calib.map2, cv::INTER_CUBIC);
-  
-  image = newImage;
-}
-
-// converts an image to grayscale (uint8_t)
-void DenseStereo::cvtCvMatToGrayscaleImage(cv::Mat &image) {
-  //TODO: Use FrameHelper to avoid double code
-  cv::Mat newImage;
-  // convert to grayscale image
-  switch(image.type()){
-    case CV_8UC1:
-      //do nothing as the image is already grayscale
-      newImage = image;
+void DenseStereo::undistortAndRectify(const cv::Mat &image, cv::Mat &rectified,
+                                      const cv::Mat &map1, const cv::Mat &map2,
+                                      const cv::Rect &window){
+  int interpolation = cv::INTER_CUBIC;
+  switch(rectification_interpolation){
+    case RECTIFICATION_NEAREST:
+      interpolation = cv::INTER_NEAREST;
       break;
-    case CV_16UC1:
-      image.convertTo(newImage, CV_8U, 1/256.);
+    case RECTIFICATION_LINEAR:
+      interpolation = cv::INTER_LINEAR;
       break;
-    case CV_8UC3:
-      cvtColor( image, newImage, cv::COLOR_BGR2GRAY );
+    case RECTIFICATION_CUBIC:
+      interpolation = cv::INTER_CUBIC;
       break;
-    case CV_16UC3:
-      image.convertTo(newImage, CV_8U, 1/256.);
-      cvtColor( image, newImage, cv::COLOR_BGR2GRAY );
-      break;
-    default:
-      throw std::runtime_error("Unknown format. Cannot convert cv::Mat to grayscale.");
-  }
-  
-  if( gaussian_kernel > 0 )
-  {
-    cv::GaussianBlur( newImage, image, cv::Size( gaussian_kernel, gaussian_kernel ), 0 );
-  }
-  else
-  {
-    image = newImage;
   }
+
+  // undistort/rectify the processed part of the image, rectified keeps its
+  // buffer if the size and type did not change
+  rectified.create(map1.size(), image.type());
+  cv::Mat rectified_window = rectified(window);
+  cv::remap(image, rectified_window, map1(window), map2(window), interpolation);
 }
 
 // computes disparities of image input pair left_frame, right_frame
@@ -93,94 +351,620 @@ void DenseStereo::processFramePair (const cv::Mat &left_frame,
 				     cv::Mat &left_output_frame,
                                      cv::Mat &right_output_frame,
 				     bool isRectified )
+{
+  // rectify and convert images to Grayscale (uint8_t)
+  preprocessFramePair(left_frame, right_frame, left_gray, right_gray, isRectified);
+  
+  // process
+  computeDisparities(left_gray, right_gray, left_output_frame, right_output_frame);
+}
+
+void DenseStereo::processFramePair (const base::samples::frame::Frame &left_frame,
+                                     const base::samples::frame::Frame &right_frame,
+				     cv::Mat &left_output_frame,
+                                     cv::Mat &right_output_frame,
+				     bool isRectified )
+{
+  cv::Mat left, right;
+  convertFramePair(left_frame, right_frame, left, right);
+  processFramePair(left, right, left_output_frame, right_output_frame, isRectified);
+}
+
+void DenseStereo::convertFramePair(const base::samples::frame::Frame &left_frame,
+                                   const base::samples::frame::Frame &right_frame,
+                                   cv::Mat &left, cv::Mat &right)
+{
+  // only Bayer and RGB frames need work, the others are just wrapped
+  thread_pool.parallelFor( 2, [&]( size_t i )
+  {
+    if( i == 0 )
+      left = frameToMat( left_frame, left_frame_buffer );
+    else
+      right = frameToMat( right_frame, right_frame_buffer );
+  });
+}
+
+// rectifies and converts image input pair left_frame, right_frame to grayscale
+void DenseStereo::preprocessFramePair(const cv::Mat &left_frame,
+                                      const cv::Mat &right_frame,
+                                      cv::Mat &left_gray_frame,
+                                      cv::Mat &right_gray_frame,
+                                      bool isRectified )
 {
   if (!calibrationInitialized) {
       throw std::runtime_error("Call setStereoCalibration() first!");
   }
   
   // rectify and convert images to Grayscale (uint8_t)
-  cv::Mat left = left_frame;
-  cv::Mat right = right_frame;
+  const cv::Mat *left = &left_frame;
+  const cv::Mat *right = &right_frame;
   if( !isRectified )
   {
-      undistortAndRectify(left, calParam.camLeft);
-      undistortAndRectify(right, calParam.camRight);
+      // left and right are independent, so rectify them in parallel
+      const RectificationMaps &maps = rectification_maps;
+      const cv::Rect window = getProcessingWindow(maps.left_map1.size());
+      const base::Time start = base::Time::now();
+      thread_pool.parallelFor(2, [&](size_t i)
+      {
+          if( i == 0 )
+              undistortAndRectify(left_frame, left_rectified, maps.left_map1, maps.left_map2, window);
+          else
+              undistortAndRectify(right_frame, right_rectified, maps.right_map1, maps.right_map2, window);
+      });
+      left = &left_rectified;
+      right = &right_rectified;
+      timing.record(TIMING_RECTIFICATION, base::Time::now() - start);
   }
-  cvtCvMatToGrayscaleImage(left);
-  cvtCvMatToGrayscaleImage(right);
   
   // check for correct size
-  if (left.size().width <=0 || left.size().height <=0 ||
-      right.size().width <=0 || right.size().height <=0 ||
-      left.size().width != right.size().width ||
-      left.size().height != right.size().height)
+  if (left->size().width <=0 || left->size().height <=0 ||
+      right->size().width <=0 || right->size().height <=0 ||
+      left->size().width != right->size().width ||
+      left->size().height != right->size().height)
   {
     cerr << "ERROR: Images must be of same size, but" << endl;
-    cerr << "       left: " << left.size().width << " x " << left.size().height;
-    cerr << ", right: " << right.size().width << " x " << right.size().height;
+    cerr << "       left: " << left->size().width << " x " << left->size().height;
+    cerr << ", right: " << right->size().width << " x " << right->size().height;
     cerr << endl;
 
     throw std::runtime_error("Images must be of same size.");
     return;
   }
 
-  // get image width and height
-  const int32_t width  = left_frame.size().width;
-  const int32_t height = left_frame.size().height;
+  // the results are written into the provided buffers, and never share
+  // data with the input frames or the rectification buffers. Only the
+  // processing window is converted, the rest is never read by the matcher.
+  // The filters convert to grayscale and blur in a single pass over the
+  // image, left and right in parallel.
+  const cv::Rect window = getProcessingWindow(left->size());
+  left_gray_frame.create(left->size(), CV_8UC1);
+  right_gray_frame.create(right->size(), CV_8UC1);
+  cv::Mat left_gray_window = left_gray_frame(window);
+  cv::Mat right_gray_window = right_gray_frame(window);
+  const base::Time start = base::Time::now();
+  thread_pool.parallelFor(2, [&](size_t i)
+  {
+      if( i == 0 )
+          left_filter.apply((*left)(window), left_gray_window);
+      else
+          right_filter.apply((*right)(window), right_gray_window);
+  });
+  timing.record(TIMING_GRAYSCALE, base::Time::now() - start);
+}
+
+void DenseStereo::computeDisparities(const cv::Mat &left, const cv::Mat &right,
+                                     cv::Mat &left_output_frame, cv::Mat &right_output_frame)
+{
+  matchFramePair(left, right, left_output_frame, &right_output_frame, false);
+}
+
+// checks the size of an output frame, or allocates it if it is empty
+static void allocateOutput( cv::Mat &frame, const cv::Size &size,
+                            int type = cv::DataType<float>::type )
+{
+  if( !frame.data )
+    frame.create(size, type);
+  else if( frame.size() != size || frame.type() != type )
+    throw std::runtime_error("Output frames need to be of the output size and type, see getOutputSize() and setCompactOutput().");
+}
+
+cv::Size DenseStereo::getOutputSize( const cv::Size &input_size ) const
+{
+  if( isSubsampled() && !upsample_subsampled )
+    return cv::Size(input_size.width / 2, input_size.height / 2);
+  return input_size;
+}
+
+// matches into float buffers for the compact output, otherwise directly
+// into the output frames
+void DenseStereo::matchFramePair(const cv::Mat &left, const cv::Mat &right,
+                                 cv::Mat &left_output_frame, cv::Mat *right_output_frame,
+                                 bool to_distance)
+{
+  if( !compact_output )
+  {
+    matchFloat(left, right, left_output_frame, right_output_frame, to_distance);
+    return;
+  }
+
+  // the float buffers are reallocated if the output size changed
+  const bool left_only = !right_output_frame;
+  const cv::Size size = getOutputSize(left.size());
+  float_left_disp.create(size, cv::DataType<float>::type);
+  if( !left_only )
+    float_right_disp.create(size, cv::DataType<float>::type);
+  matchFloat(left, right, float_left_disp, left_only ? NULL : &float_right_disp, false);
+
+  allocateOutput(left_output_frame, size, CV_16UC1);
+  if( !left_only )
+    allocateOutput(*right_output_frame, size, CV_16UC1);
+
+  // the distances are computed while converting to the compact format
+  const base::Time start = base::Time::now();
+  if( to_distance )
+  {
+    float left_factor, right_factor;
+    getDistanceFactors(left_factor, right_factor);
+    disparityToCompactDistance(float_left_disp, left_output_frame, left_factor, &thread_pool);
+    if( !left_only )
+      disparityToCompactDistance(float_right_disp, *right_output_frame, right_factor, &thread_pool);
+    timing.record(TIMING_DISTANCE, base::Time::now() - start);
+  }
+  else
+  {
+    disparityToCompact(float_left_disp, left_output_frame, &thread_pool);
+    if( !left_only )
+      disparityToCompact(float_right_disp, *right_output_frame, &thread_pool);
+  }
+}
+
+// matches at half resolution if libelas subsampling is enabled and
+// upsampling requested, otherwise directly into the output frames
+void DenseStereo::matchFloat(const cv::Mat &left, const cv::Mat &right,
+                             cv::Mat &left_output_frame, cv::Mat *right_output_frame,
+                             bool to_distance)
+{
+  const base::Time start = base::Time::now();
+  if( !isSubsampled() || !upsample_subsampled )
+  {
+    matchImages(left, right, left_output_frame, right_output_frame, to_distance);
+    if( confidence_output )
+      confidence = match_confidence;
+    else
+      confidence.release();
+    // the conversion is part of matchImages, but recorded separately
+    timing.record(TIMING_MATCHING, base::Time::now() - start - conversion_time);
+    if( to_distance )
+      timing.record(TIMING_DISTANCE, conversion_time);
+    return;
+  }
+
+  const bool left_only = !right_output_frame;
+  matchImages(left, right, half_left_disp, left_only ? NULL : &half_right_disp, false);
+
+  allocateOutput(left_output_frame, left.size());
+  if( !left_only )
+    allocateOutput(*right_output_frame, right.size());
+
+  // the upsampling is guided by the full resolution images, so depth edges
+  // follow the image edges
+  upsampleDisparity(half_left_disp, left, left_output_frame, &thread_pool);
+  if( !left_only )
+    upsampleDisparity(half_right_disp, right, *right_output_frame, &thread_pool);
+  if( confidence_output )
+    cv::resize(match_confidence, confidence, left_output_frame.size(), 0, 0, cv::INTER_NEAREST);
+  else
+    confidence.release();
+
+  const base::Time matched = base::Time::now();
+  timing.record(TIMING_MATCHING, matched - start);
+  if( to_distance )
+  {
+    float left_factor, right_factor;
+    getDistanceFactors(left_factor, right_factor);
+    disparityToDistance(left_output_frame, left_output_frame, left_factor, &thread_pool);
+    if( !left_only )
+      disparityToDistance(*right_output_frame, *right_output_frame, right_factor, &thread_pool);
+    timing.record(TIMING_DISTANCE, base::Time::now() - matched);
+  }
+
+  const float invalid = to_distance ? std::numeric_limits<float>::quiet_NaN() : -10.0f;
+  invalidateOutsideRoi(left_output_frame, invalid);
+  if( !left_only )
+    invalidateOutsideRoi(*right_output_frame, invalid);
+  if( confidence_output )
+    invalidateOutsideRoi(confidence, 0);
+}
+
+// runs libelas on the rectified grayscale images, either on the whole image
+// or on horizontal bands of the processing window in parallel
+void DenseStereo::matchImages(const cv::Mat &left, const cv::Mat &right,
+                              cv::Mat &left_output_frame, cv::Mat *right_output_frame,
+                              bool to_distance)
+{
+  const int32_t width  = left.size().width;
+  const int32_t height = left.size().height;
+  const cv::Rect window = getProcessingWindow(left.size());
+  // the bands with their own disparity range, of coarse-to-fine or the
+  // temporal prior, are the configured ones
+  size_t num_bands = engine_pool.size();
+  if( (coarse_to_fine || temporal_prior.enabled) && coarse_to_fine_bands > 0 )
+    num_bands = coarse_to_fine_bands;
+
+  // with subsampling, libelas only outputs every second pixel in x and y
+  const int32_t scale = isSubsampled() ? 2 : 1;
+  const cv::Size output_size(width / scale, height / scale);
+
+  // without right output there is no point in post processing the right
+  // disparity image in libelas
+  const bool left_only = !right_output_frame;
+  setEnginesLeftOnly( left_only );
+  if( num_bands > band_left_disp.size() )
+  {
+    band_left_disp.resize( num_bands );
+    band_right_disp.resize( num_bands );
+    band_conversion_time.resize( num_bands );
+  }
+  conversion_time = base::Time();
 
-  // set processing dimensions
-  const int32_t dims[3] = {width,height,width}; // bytes per line = width
   // allocate memory for disparity images if not already done
-  if (!left_output_frame.data) {
-    left_output_frame = cv::Mat(left_frame.size().height,
-                                left_frame.size().width,
-                                cv::DataType<float>::type);
-  }
-  if (!right_output_frame.data) {
-    right_output_frame = cv::Mat(right_frame.size().height,
-                                 right_frame.size().width,
-                                 cv::DataType<float>::type);
- }
-  
-  // process
-  elas->process(left.ptr<uint8_t>(),
-                right.ptr<uint8_t>(),
-                left_output_frame.ptr<float>(),
-                right_output_frame.ptr<float>(),
-                dims);
+  allocateOutput(left_output_frame, output_size);
+  if( !left_only )
+    allocateOutput(*right_output_frame, output_size);
+
+  float left_factor = 0, right_factor = 0;
+  if( to_distance )
+    getDistanceFactors(left_factor, right_factor);
+
+  const bool band_ranges = coarse_to_fine || temporal_prior.enabled;
+  if( band_ranges )
+    estimateBandDisparityRanges( left, right, window, num_bands );
+
+  // the bands only write the confidence inside the processing window
+  if( confidence_output )
+  {
+    match_confidence.create(output_size, CV_8UC1);
+    if( window.width != width || window.height != height )
+      match_confidence.setTo(cv::Scalar(0));
+  }
+
+  if( num_bands == 1 && !band_ranges && window.width == width && window.height == height )
+  {
+    // libelas always needs memory for the right disparity image
+    if( left_only )
+      right_disp.create(output_size, cv::DataType<float>::type);
+    cv::Mat &right_output = left_only ? right_disp : *right_output_frame;
+
+    // bytes per line of the input, the output is written densely
+    const int32_t dims[3] = {width, height, (int32_t)left.step};
+    engine_pool[0]->process(left.ptr<uint8_t>(), right.ptr<uint8_t>(),
+                            left_output_frame.ptr<float>(),
+                            right_output.ptr<float>(),
+                            dims);
+    // the confidence needs the disparities, so it is computed before the
+    // conversion to distances
+    if( confidence_output )
+      computeConfidence(left, left_output_frame, right_output, match_confidence, &thread_pool);
+    if( to_distance )
+    {
+      const base::Time start = base::Time::now();
+      disparityToDistance(left_output_frame, left_output_frame, left_factor, &thread_pool);
+      if( !left_only )
+        disparityToDistance(right_output, right_output, right_factor, &thread_pool);
+      conversion_time = base::Time::now() - start;
+    }
+    return;
+  }
+
+  // every band is matched with some extra rows above and below, so that
+  // libelas has enough support points at the band borders. Only the core
+  // rows of each band are copied into the output. With subsampling, the
+  // window and band rows are even, so they map onto output rows.
+  thread_pool.parallelFor(num_bands, [&](size_t i)
+  {
+    int32_t core_begin, core_end, band_begin, band_end;
+    getBandRows(i, num_bands, window, core_begin, core_end, band_begin, band_end);
+    band_conversion_time[i] = base::Time();
+    // reset before any early return, so that a band without rows doesn't
+    // add the counts of an earlier frame to the prior
+    if( temporal_prior.enabled )
+    {
+      BandHistogram &histogram = prior_histogram[i];
+      histogram.bins.assign( std::max(0, (int)elas_config.disp_max) + 1, 0 );
+      histogram.valid = histogram.total = 0;
+    }
+    if( core_begin >= core_end )
+      return;
+
+    const int32_t band_height = band_end - band_begin;
+    DisparityEngine *engine = band_ranges ? band_engines[i] : engine_pool[i];
+
+    cv::Mat &band_left = band_left_disp[i];
+    cv::Mat &band_right = band_right_disp[i];
+    band_left.create(band_height / scale, window.width / scale, cv::DataType<float>::type);
+    band_right.create(band_height / scale, window.width / scale, cv::DataType<float>::type);
+
+    const int32_t dims[3] = {window.width, band_height, (int32_t)left.step};
+    engine->process(left.ptr<uint8_t>(band_begin) + window.x,
+                    right.ptr<uint8_t>(band_begin) + window.x,
+                    band_left.ptr<float>(),
+                    band_right.ptr<float>(),
+                    dims);
+
+    // stitch the core rows into the output images, converting them to
+    // distances on the way if requested
+    const int32_t row_begin = (core_begin - band_begin) / scale;
+    const int32_t row_end = std::min(band_left.rows, (core_end - band_begin) / scale);
+    if( row_begin >= row_end )
+      return;
+    const cv::Rect core(window.x / scale, core_begin / scale, band_left.cols, row_end - row_begin);
+    cv::Mat left_core = left_output_frame(core);
+    const cv::Mat band_left_core = band_left.rowRange(row_begin, row_end);
+    if( temporal_prior.enabled )
+    {
+      BandHistogram &histogram = prior_histogram[i];
+      accumulateHistogram( band_left_core, histogram.bins, histogram.valid, histogram.total );
+    }
+    const base::Time stitch_start = base::Time::now();
+    if( to_distance )
+      disparityToDistance(band_left_core, left_core, left_factor);
+    else
+      band_left_core.copyTo(left_core);
+
+    if( !left_only )
+    {
+      cv::Mat right_core = (*right_output_frame)(core);
+      const cv::Mat band_right_core = band_right.rowRange(row_begin, row_end);
+      if( to_distance )
+        disparityToDistance(band_right_core, right_core, right_factor);
+      else
+        band_right_core.copyTo(right_core);
+    }
+    if( to_distance )
+      band_conversion_time[i] = base::Time::now() - stitch_start;
+
+    if( confidence_output )
+    {
+      const cv::Mat gray = left(cv::Rect(window.x, core_begin, window.width, (row_end - row_begin) * scale));
+      cv::Mat confidence_core = match_confidence(core);
+      computeConfidence(gray, band_left_core, band_right.rowRange(row_begin, row_end), confidence_core);
+    }
+  });
+
+  // the bands are converted in parallel, so the slowest one is what the
+  // conversion adds to the frame
+  if( to_distance )
+    conversion_time = *std::max_element(band_conversion_time.begin(),
+                                        band_conversion_time.begin() + num_bands);
+
+  if( temporal_prior.enabled )
+    updateTemporalPrior();
+
+  // everything outside the region of interest is invalid, which is NaN for
+  // distances and the libelas invalid value for disparities
+  const float invalid = to_distance ? std::numeric_limits<float>::quiet_NaN() : -10.0f;
+  invalidateOutsideRoi(left_output_frame, invalid);
+  if( !left_only )
+    invalidateOutsideRoi(*right_output_frame, invalid);
+  if( confidence_output )
+    invalidateOutsideRoi(match_confidence, 0);
+}
+
+void DenseStereo::getBandRows( size_t band, size_t num_bands, const cv::Rect &window,
+                               int32_t &core_begin, int32_t &core_end,
+                               int32_t &band_begin, int32_t &band_end ) const
+{
+  // with subsampling, the bands need to start at even rows
+  const int32_t align = isSubsampled() ? 2 : 1;
+  const int32_t overlap = band_overlap / align * align;
+  core_begin = window.y + window.height * band / num_bands / align * align;
+  core_end = band + 1 == num_bands ? window.y + window.height :
+    window.y + window.height * (band + 1) / num_bands / align * align;
+  band_begin = std::max(window.y, core_begin - overlap);
+  band_end = std::min(window.y + window.height, core_end + overlap);
+}
+
+// disparity range of a band from the histogram of its disparities, using
+// the 1% and 99% quantiles, so single outliers don't widen the range
+std::pair<int, int> DenseStereo::rangeFromHistogram( const BandHistogram &histogram,
+                                                     int scale, int margin ) const
+{
+  const int disp_min = elas_config.disp_min;
+  const int disp_max = elas_config.disp_max;
+  const std::vector<int> &bins = histogram.bins;
+
+  // bands where too little was found are searched with the full range
+  if( bins.empty() || histogram.valid == 0 || histogram.valid < histogram.total / 20 )
+    return std::make_pair(disp_min, disp_max);
+
+  const int outliers = histogram.valid / 100;
+  int lo = 0, hi = (int)bins.size() - 1, count = 0;
+  while( lo < hi && count + bins[lo] <= outliers )
+    count += bins[lo++];
+  count = 0;
+  while( hi > lo && count + bins[hi] <= outliers )
+    count += bins[hi--];
+
+  std::pair<int, int> range(std::max(disp_min, scale * lo - margin),
+                            std::min(disp_max, scale * hi + margin));
+  if( range.second <= range.first )
+    return std::make_pair(disp_min, disp_max);
+  return range;
+}
+
+// compares a downscaled version of the left image with the one of the
+// previous frame
+bool DenseStereo::detectSceneCut( const cv::Mat &left, const cv::Rect &window )
+{
+  const cv::Size size(std::max(1, window.width / 8), std::max(1, window.height / 8));
+  cv::resize(left(window), prior_thumbnail_next, size, 0, 0, cv::INTER_AREA);
+
+  bool scene_cut = true;
+  if( prior_thumbnail.size() == size )
+  {
+    cv::absdiff(prior_thumbnail_next, prior_thumbnail, prior_thumbnail_diff);
+    scene_cut = cv::mean(prior_thumbnail_diff)[0] > temporal_prior.scene_cut_threshold;
+  }
+  std::swap(prior_thumbnail, prior_thumbnail_next);
+  return scene_cut;
 }
 
-void disparityToDistance( cv::Mat &disp, float dist_factor )
+// chooses the disparity range of each band, from the previous frame if the
+// temporal prior can be used, from a half resolution pass for
+// coarse-to-fine matching, or the configured range otherwise
+void DenseStereo::estimateBandDisparityRanges( const cv::Mat &left, const cv::Mat &right,
+                                               const cv::Rect &window, size_t num_bands )
 {
-    cv::MatIterator_<float> it = disp.begin<float>(), it_end = disp.end<float>();
-    for(; it != it_end; ++it)
+  const int disp_min = elas_config.disp_min;
+  const int disp_max = elas_config.disp_max;
+
+  if( band_engines.size() != num_bands )
+  {
+    for(size_t i = 0; i < band_engines.size(); i++)
+      delete band_engines[i];
+    band_engines.assign( num_bands, NULL );
+    band_disp_range.assign( num_bands, std::make_pair(disp_min, disp_max) );
+    band_histogram.resize( num_bands );
+  }
+
+  prior_used = false;
+  if( temporal_prior.enabled )
+  {
+    // the scene cut check also needs to run without prior, to have the
+    // image of the previous frame
+    const bool scene_cut = detectSceneCut( left, window );
+    prior_used = prior_valid && !scene_cut &&
+      prior_window == window && prior_histogram.size() == num_bands;
+    if( prior_histogram.size() != num_bands )
+      prior_histogram.resize( num_bands );
+    prior_window = window;
+  }
+
+  const int coarse_min = disp_min / 2;
+  const int coarse_max = (disp_max + 1) / 2;
+  const int coarse_width = window.width / 2;
+  const int coarse_height = window.height / 2;
+  const bool have_coarse = coarse_to_fine && !prior_used &&
+    coarse_width > 0 && coarse_height > 0;
+  if( have_coarse )
+  {
+    // the right disparities of the coarse pass are not used
+    // the coarse pass needs full output of the half resolution images
+    if( !coarse_engine )
+      coarse_engine = createEngine( coarse_min, coarse_max, true, false );
+
+    thread_pool.parallelFor(2, [&](size_t i)
     {
-	const float disparity = *it;
-	*it = disparity > 0 ? 
-	    dist_factor / disparity : 
-	    std::numeric_limits<float>::quiet_NaN();
+      const cv::Size coarse_size(coarse_width, coarse_height);
+      if( i == 0 )
+        cv::resize(left(window), coarse_left, coarse_size, 0, 0, cv::INTER_AREA);
+      else
+        cv::resize(right(window), coarse_right, coarse_size, 0, 0, cv::INTER_AREA);
+    });
+    coarse_left_disp.create(coarse_height, coarse_width, cv::DataType<float>::type);
+    coarse_right_disp.create(coarse_height, coarse_width, cv::DataType<float>::type);
 
+    const int32_t dims[3] = {coarse_width, coarse_height, (int32_t)coarse_left.step};
+    coarse_engine->process(coarse_left.ptr<uint8_t>(), coarse_right.ptr<uint8_t>(),
+                         coarse_left_disp.ptr<float>(), coarse_right_disp.ptr<float>(),
+                         dims);
+  }
+
+  for(size_t i = 0; i < num_bands; i++)
+  {
+    std::pair<int, int> range(disp_min, disp_max);
+    if( prior_used )
+    {
+      range = rangeFromHistogram( prior_histogram[i], 1, temporal_prior.margin );
     }
+    else if( have_coarse )
+    {
+      // histogram of the coarse disparities in the rows of the band
+      int32_t core_begin, core_end, band_begin, band_end;
+      getBandRows(i, num_bands, window, core_begin, core_end, band_begin, band_end);
+      const int row_begin = std::min(coarse_height, (band_begin - window.y) / 2);
+      const int row_end = std::min(coarse_height, (band_end - window.y + 1) / 2);
+
+      BandHistogram &histogram = band_histogram[i];
+      histogram.bins.assign( coarse_max + 1, 0 );
+      histogram.valid = histogram.total = 0;
+      accumulateHistogram( coarse_left_disp.rowRange(row_begin, row_end),
+                           histogram.bins, histogram.valid, histogram.total );
+      range = rangeFromHistogram( histogram, 2, coarse_to_fine_margin );
+    }
+
+    // creating a matcher instance is cheap, the buffers are allocated
+    // when processing
+    if( !band_engines[i] || band_disp_range[i] != range )
+    {
+      delete band_engines[i];
+      band_engines[i] = createEngine( range.first, range.second, engines_left_only );
+      band_disp_range[i] = range;
+    }
+  }
 }
 
-void DenseStereo::getDistanceImages( cv::Mat &left_disp_image, cv::Mat &right_disp_image )
+// decides if the disparities of the current frame can serve as prior for
+// the next one
+void DenseStereo::updateTemporalPrior()
+{
+  int valid = 0, total = 0;
+  for(size_t i = 0; i < prior_histogram.size(); i++)
+  {
+    valid += prior_histogram[i].valid;
+    total += prior_histogram[i].total;
+  }
+  const float coverage = total > 0 ? (float)valid / total : 0.0f;
+
+  if( !prior_used )
+  {
+    // matched with the full range, this is what the prior is measured by
+    prior_reference_coverage = coverage;
+    prior_valid = coverage > 0;
+  }
+  else if( coverage < temporal_prior.min_coverage * prior_reference_coverage )
+  {
+    // the scene changed too much for the prior, match the next frame
+    // without it
+    prior_valid = false;
+  }
+}
+
+void DenseStereo::getDistanceFactors( float &left_factor, float &right_factor )
 {
     const frame_helper::StereoCalibration &calib( calParam.getCalibration() );
+    left_factor = fabs( calib.camLeft.fx * calib.extrinsic.tx );
+    right_factor = fabs( calib.camRight.fx * calib.extrinsic.tx );
+}
+
+void DenseStereo::getDistanceImages( cv::Mat &left_disp_image, cv::Mat &right_disp_image )
+{
+    float left_factor, right_factor;
+    getDistanceFactors( left_factor, right_factor );
 
-    // perform conversion to distance image
-    disparityToDistance( left_disp_image,
-	    fabs( calib.camLeft.fx * calib.extrinsic.tx ) );
-    
-    disparityToDistance( right_disp_image,
-	    fabs( calib.camRight.fx * calib.extrinsic.tx ) );
+    // perform conversion to distance image, in the format of the
+    // disparities
+    const base::Time start = base::Time::now();
+    if( left_disp_image.type() == CV_16UC1 )
+    {
+	compactDisparityToDistance( left_disp_image, left_disp_image, left_factor, &thread_pool );
+	compactDisparityToDistance( right_disp_image, right_disp_image, right_factor, &thread_pool );
+    }
+    else
+    {
+	disparityToDistance( left_disp_image, left_disp_image, left_factor, &thread_pool );
+	disparityToDistance( right_disp_image, right_disp_image, right_factor, &thread_pool );
+    }
+    timing.record( TIMING_DISTANCE, base::Time::now() - start );
 }
 
 void DenseStereo::getDistanceImages( const cv::Mat &left_frame, const cv::Mat &right_frame,
 	cv::Mat &left_output_frame, cv::Mat &right_output_frame,
 	bool isRectified )
 {
-    processFramePair( left_frame, right_frame, left_output_frame, right_output_frame, isRectified );
-    getDistanceImages( left_output_frame, right_output_frame );
+    // the conversion to distance is done directly on the matcher output
+    preprocessFramePair( left_frame, right_frame, left_gray, right_gray, isRectified );
+    matchFramePair( left_gray, right_gray, left_output_frame, &right_output_frame, true );
 }
 
 void DenseStereo::getDistanceImages( const cv::Mat &left_frame, const cv::Mat &right_frame,
@@ -191,16 +975,160 @@ void DenseStereo::getDistanceImages( const cv::Mat &left_frame, const cv::Mat &r
 	cleft = createLeftDistanceImage( left_output_frame ),
 	cright = createRightDistanceImage( right_output_frame );
 
-    getDistanceImages( left_frame, right_frame, cleft, cright, isRectified );
+    // distance images are always float
+    preprocessFramePair( left_frame, right_frame, left_gray, right_gray, isRectified );
+    matchFloat( left_gray, right_gray, cleft, &cright, true );
+}
+
+void DenseStereo::getDistanceImages( const base::samples::frame::Frame &left_frame,
+	const base::samples::frame::Frame &right_frame,
+	base::samples::DistanceImage &left_output_frame, base::samples::DistanceImage &right_output_frame,
+	bool isRectified )
+{
+    cv::Mat left, right;
+    convertFramePair( left_frame, right_frame, left, right );
+    getDistanceImages( left, right, left_output_frame, right_output_frame, isRectified );
+}
+
+void DenseStereo::getLeftDistanceImage( const cv::Mat &left_frame, const cv::Mat &right_frame,
+	cv::Mat &left_output_frame, bool isRectified )
+{
+    preprocessFramePair( left_frame, right_frame, left_gray, right_gray, isRectified );
+    matchFramePair( left_gray, right_gray, left_output_frame, NULL, true );
+}
+
+void DenseStereo::getLeftDistanceImage( const cv::Mat &left_frame, const cv::Mat &right_frame,
+	base::samples::DistanceImage &left_output_frame, bool isRectified )
+{
+    cv::Mat cleft = createLeftDistanceImage( left_output_frame );
+    preprocessFramePair( left_frame, right_frame, left_gray, right_gray, isRectified );
+    matchFloat( left_gray, right_gray, cleft, NULL, true );
+}
+
+void DenseStereo::getPointCloud( const cv::Mat &left_frame, const cv::Mat &right_frame,
+	base::samples::Pointcloud &cloud, bool isRectified )
+{
+    preprocessFramePair( left_frame, right_frame, left_gray, right_gray, isRectified );
+    matchFloat( left_gray, right_gray, left_disp, NULL, false );
+    getPointCloud( left_disp, cloud );
+}
+
+void DenseStereo::getPointCloud( const cv::Mat &left_disp_image, base::samples::Pointcloud &cloud )
+{
+    // half resolution disparity images have every second pixel
+    const cv::Size size = calParam.getImageSize();
+    const int scale = left_disp_image.size() == size ? 1 : 2;
+    const base::Time start = base::Time::now();
+    if( left_disp_image.type() == CV_16UC1 )
+    {
+	compactToDisparity( left_disp_image, float_left_disp, &thread_pool );
+	point_cloud_converter.convert( float_left_disp, cloud, &thread_pool, scale );
+    }
+    else
+	point_cloud_converter.convert( left_disp_image, cloud, &thread_pool, scale );
+    timing.record( TIMING_DISTANCE, base::Time::now() - start );
+}
+
+void DenseStereo::copyConfiguration( const DenseStereo &other )
+{
+    calParam = other.calParam;
+    calibrationInitialized = other.calibrationInitialized;
+    rectification_maps = other.rectification_maps;
+    rectification_cache_directory = other.rectification_cache_directory;
+
+    point_cloud_converter = other.point_cloud_converter;
+    setGaussianKernel( other.gaussian_kernel );
+    rectification_interpolation = other.rectification_interpolation;
+    band_overlap = other.band_overlap;
+    coarse_to_fine = other.coarse_to_fine;
+    coarse_to_fine_bands = other.coarse_to_fine_bands;
+    coarse_to_fine_margin = other.coarse_to_fine_margin;
+    upsample_subsampled = other.upsample_subsampled;
+    compact_output = other.compact_output;
+    confidence_output = other.confidence_output;
+
+    roi = other.roi;
+    mask = other.mask;
+    temporal_prior = other.temporal_prior;
+    prior_valid = false;
+
+    // the engines are only recreated if their configuration changed
+    if( engine_revision != other.engine_revision )
+    {
+	engine_type = other.engine_type;
+	sgm_config = other.sgm_config;
+	bm_config = other.bm_config;
+	elas_config = other.elas_config;
+	engine_revision = other.engine_revision;
+	createEngines( engine_pool.size() );
+    }
+    updateProcessingWindow();
+}
+
+void DenseStereo::processBatch( const std::vector<FramePair> &pairs,
+	std::vector<cv::Mat> &left_output_frames, std::vector<cv::Mat> &right_output_frames,
+	bool isRectified )
+{
+    if( !calibrationInitialized )
+	throw std::runtime_error( "Call setStereoCalibration() first!" );
+
+    // at most as many items run at once as the pool has threads, so each
+    // of them finds a free worker. The workers match single-threaded.
+    const size_t num_workers = std::min( thread_pool.getNumThreads(), std::max( pairs.size(), (size_t)1 ) );
+    while( batch_workers.size() < num_workers )
+    {
+	batch_workers.push_back( new DenseStereo() );
+	batch_workers.back()->setNumThreads( 1 );
+    }
+    for( size_t i = 0; i < batch_workers.size(); i++ )
+    {
+	batch_workers[i]->copyConfiguration( *this );
+	// the workers get the pairs in no particular order, so the previous
+	// frame of a worker is not the previous frame of the sequence
+	batch_workers[i]->temporal_prior.enabled = false;
+    }
+
+    left_output_frames.resize( pairs.size() );
+    right_output_frames.resize( pairs.size() );
+
+    std::vector<DenseStereo*> free_workers( batch_workers );
+    std::mutex free_mutex;
+    thread_pool.parallelFor( pairs.size(), [&]( size_t i )
+    {
+	DenseStereo *worker;
+	{
+	    std::lock_guard<std::mutex> lock( free_mutex );
+	    worker = free_workers.back();
+	    free_workers.pop_back();
+	}
+
+	try
+	{
+	    worker->getDistanceImages( pairs[i].left, pairs[i].right,
+		    left_output_frames[i], right_output_frames[i], isRectified );
+	}
+	catch( ... )
+	{
+	    std::lock_guard<std::mutex> lock( free_mutex );
+	    free_workers.push_back( worker );
+	    throw;
+	}
+
+	std::lock_guard<std::mutex> lock( free_mutex );
+	free_workers.push_back( worker );
+    });
 }
 
 cv::Mat DenseStereo::createDistanceImage( 
 	frame_helper::CameraCalibrationCv const& calibcv, base::samples::DistanceImage& distanceFrame )
 {
+    // the output is half the calibrated size in subsampling mode
+    const cv::Size output_size = getOutputSize( calibcv.getImageSize() );
     const size_t 
-	width = calibcv.getImageSize().width, 
-	height = calibcv.getImageSize().height, 
+	width = output_size.width, 
+	height = output_size.height, 
 	size = width * height;
+    const float pixel_scale = output_size == calibcv.getImageSize() ? 1.0f : 2.0f;
 
     // pre-allocate the memory for the output disparity map, so we don't
     // have to copy it. This means we have to assert that the width and
@@ -215,9 +1143,11 @@ cv::Mat DenseStereo::createDistanceImage(
     // f and c values from the camera calibration. 
     //
     // so analogous for x and y we get scale = 1/f and offset = -c/f
-    // 
-    distanceFrame.scale_x = 1.0f / calib.fx;
-    distanceFrame.scale_y = 1.0f / calib.fy;
+    //
+    // pixel x of a half resolution image is pixel 2x of the full resolution
+    // image, which doubles the scale
+    distanceFrame.scale_x = pixel_scale / calib.fx;
+    distanceFrame.scale_y = pixel_scale / calib.fy;
     distanceFrame.center_x = -calib.cx / calib.fx; 
     distanceFrame.center_y = -calib.cy / calib.fy; 
 
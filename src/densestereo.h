@@ -4,13 +4,28 @@
 #define __DENSE_STEREO_H__
 
 #include <iostream>
-#include <libelas/elas.h>
+#include "disparity_engine.h"
 #include <frame_helper/CalibrationCv.h>
 #include "dense_stereo_types.h"
+#include "thread_pool.h"
+#include "gaussian_filter.h"
+#include "point_cloud.h"
+#include "dense_stereo_timing.h"
+#include "rectification_cache.h"
+#include "frame_input.h"
 #include <base/samples/DistanceImage.hpp>
 
 namespace stereo {
 
+/** a left and right input frame, see DenseStereo::processBatch */
+struct FramePair
+{
+  FramePair() {}
+  FramePair( const cv::Mat &left, const cv::Mat &right ) : left(left), right(right) {}
+
+  cv::Mat left, right;
+};
+
 /** 
  * This class performs dense stereo calculation and is mainly a wrapper to
  * libelas. After construction, the setStereoCalibration method needs to be
@@ -31,23 +46,186 @@ public:
   virtual ~DenseStereo();
   
   /** sets calibration parameters for stereo camera setup
+   *
+   * The rectification maps are cached by calibration and image size (see
+   * RectificationCache), so setting a calibration which was used before
+   * doesn't recompute them.
+   *
    * @param stereoCamCal stereo camera calibration data
    */
   void setStereoCalibration(const frame_helper::StereoCalibration& stereoCal,
                             const int imgWidth,
                             const int imgHeight);
+
+  /**
+   * directory in which the rectification maps are stored as memory mapped
+   * files, so that a restarted process doesn't need to recompute them.
+   * Empty (the default) only caches the maps in memory. Applies to the
+   * following calls of setStereoCalibration.
+   */
+  void setRectificationCacheDirectory( const std::string &directory )
+  { rectification_cache_directory = directory; }
   
   /** configures libElas
+   *
+   * With subsampling enabled, libelas only computes the disparities of
+   * every second pixel in x and y, and the disparity and distance images
+   * are of half the input size (see getOutputSize), unless setUpsampling
+   * is enabled.
+   *
    * @param libElasParam libElas configuration
    */
   void setLibElasConfiguration(const libElasConfiguration &libElasParam);
 
+  /**
+   * select the matcher which computes the disparities. The disparity range
+   * of libElasConfiguration applies to all matchers, the other libelas
+   * settings (including subsampling) only to libelas. Defaults to
+   * ENGINE_ELAS.
+   */
+  void setDisparityEngine( DisparityEngineType type );
+
+  /** configures the semi-global matching engine, see setDisparityEngine */
+  void setSgmConfiguration( const SgmConfiguration &config );
+
+  /** configures the census block matching engine, see setDisparityEngine */
+  void setBlockMatchingConfiguration( const BlockMatchingConfiguration &config );
+
+  /**
+   * with libElas subsampling, upsample the half resolution disparities to
+   * full resolution output images. The upsampling is a joint bilateral
+   * filter guided by the full resolution grayscale image, so depth edges
+   * stay at the image edges. Disabled by default.
+   */
+  void setUpsampling( bool upsample ) { upsample_subsampled = upsample; }
+
+  /** size of the disparity and distance images for input images of the
+   * given size, which is half the size with libElas subsampling (rounded
+   * towards zero) and no upsampling
+   */
+  cv::Size getOutputSize( const cv::Size &input_size ) const;
+
+  /**
+   * output disparity and distance images in the compact 16 bit format
+   * (CV_16UC1) instead of float, with disparities in 1/16 pixel and
+   * distances in millimetres (see disparity_conversion.h for the
+   * conversion helpers). Invalid pixels are COMPACT_INVALID. The
+   * conversion to the compact format includes the conversion to distances,
+   * so it doesn't add a pass over the image. The overloads with
+   * base::samples::DistanceImage and the point cloud generation always
+   * use float. Disabled by default.
+   */
+  void setCompactOutput( bool compact ) { compact_output = compact; }
+
+  /**
+   * also compute a confidence for each left disparity, see
+   * computeConfidence for how it is computed. It is available through
+   * getConfidence. Disabled by default.
+   *
+   * The confidence is not a by-product of the matching. It is a separate
+   * pass over the gray image and both disparity images, run after the
+   * matching and before the conversion to distances. When matching in
+   * bands, each band computes its own rows right after it is matched, while
+   * the data is still in the cache. Otherwise the rows are split over the
+   * threads. The pass costs about 5 ms per 1024x768 frame on one core, on
+   * top of the matching.
+   */
+  void setConfidenceOutput( bool enable ) { confidence_output = enable; }
+
+  /**
+   * confidence (CV_8UC1, 0 to 255) of the left disparities of the last
+   * frame matched by this instance (not by processBatch), with the size of
+   * the output images. Pixels outside the region of interest or mask are
+   * 0. Empty if the confidence output is disabled.
+   */
+  const cv::Mat& getConfidence() const { return confidence; }
+
   /** 
    * if set to greater than 0, the images will be preprocessed with a 
    * gaussian blur filter with a kernel of the given size. Should be
    * an odd number.
    */
-  void setGaussianKernel( int size ) { gaussian_kernel = size; }
+  void setGaussianKernel( int size );
+
+  /**
+   * select the interpolation which is used to undistort and rectify the
+   * input images. Defaults to RECTIFICATION_CUBIC.
+   */
+  void setRectificationInterpolation( RectificationInterpolation interpolation ) 
+  { rectification_interpolation = interpolation; }
+
+  /**
+   * set the number of threads used for processing. With more than one
+   * thread, the images are split into as many horizontal bands, which are
+   * matched in parallel, each with its own matcher instance. The census
+   * based engines also use the threads within a band, so they scale
+   * without bands as well.
+   */
+  void setNumThreads( size_t num_threads );
+
+  /**
+   * number of rows each band is extended by on top and bottom when matching
+   * in parallel. Larger values give the matcher more context at the band
+   * borders, at the cost of processing these rows twice. Defaults to 32.
+   */
+  void setBandOverlap( int rows ) { band_overlap = rows; }
+
+  /**
+   * restrict the processing to a rectangular region of interest of the
+   * rectified image. Only this region (extended to the left and right by
+   * the maximum disparity, so the matcher finds its correspondences) is
+   * rectified, converted, blurred and matched. Pixels outside the region
+   * are invalid (NaN) in the distance images. Pass an empty rectangle to
+   * process the whole image again.
+   */
+  void setRegionOfInterest( const cv::Rect &roi );
+
+  /**
+   * set a static mask of the pixels to process, e.g. to exclude the rover
+   * body or the sky. The mask is a CV_8UC1 image with the calibrated image
+   * size, pixels which are zero in the mask are invalid in the output.
+   * Processing is restricted to the bounding box of the non-zero pixels in
+   * the same way as with setRegionOfInterest, and both can be combined.
+   * Pass an empty image to remove the mask.
+   */
+  void setMask( const cv::Mat &mask );
+
+  /**
+   * enable coarse-to-fine matching. A first pass matches the images at half
+   * resolution, which gives the range of disparities in each horizontal
+   * band of the image. The full resolution pass then only searches that
+   * range (plus a margin) instead of the configured disp_min to disp_max,
+   * which saves most of the matching time if the range needs to be wide
+   * for close obstacles, but most of the scene is far away. Bands without
+   * enough valid disparities in the coarse pass use the full range.
+   *
+   * @param enable switch coarse-to-fine matching on or off
+   * @param num_bands number of bands which get their own disparity range.
+   *        They are matched in parallel, 0 uses one band per thread. The
+   *        temporal prior uses the same bands.
+   * @param margin number of disparities the estimated range is extended
+   *        by on each side
+   */
+  void setCoarseToFine( bool enable, size_t num_bands = 8, int margin = 4 );
+
+  /**
+   * configure the temporal disparity prior. If enabled, each band of the
+   * image is searched with the disparity range the band had in the
+   * previous frame (plus a margin) instead of the configured range, which
+   * also restricts the support point matching of libelas. This pays off
+   * if the camera moves slowly compared to the frame rate.
+   *
+   * The prior is not used for the first frame, after a scene cut, and
+   * after a frame where the share of valid pixels dropped below
+   * min_coverage of the last frame matched without prior. These frames
+   * are searched with the configured range, or the coarse-to-fine ranges
+   * if that is enabled. The bands are the ones set with the num_bands of
+   * setCoarseToFine, also if coarse-to-fine matching is off.
+   */
+  void setTemporalPrior( const TemporalPriorConfiguration &config );
+
+  /** forget the previous frame, so the next one is matched without prior */
+  void resetTemporalPrior() { prior_valid = false; }
   
   /** computes disparities of input frame pair left_frame, right_frame 
    * @param left_frame left input frame
@@ -60,6 +238,45 @@ public:
 			  cv::Mat &left_output_frame, cv::Mat &right_output_frame,
 			  bool isRectified = false );
 
+  /** processFramePair for frames as delivered by the camera drivers.
+   * Grayscale and BGR frames are used without copying, RGB frames are
+   * converted to gray and Bayer frames are converted to gray of half the
+   * size directly from the mosaic, see frameToMat. For Bayer frames, the
+   * calibration has to be the one of getHalfResolutionCalibration.
+   */
+  void processFramePair(const base::samples::frame::Frame &left_frame,
+			  const base::samples::frame::Frame &right_frame,
+			  cv::Mat &left_output_frame, cv::Mat &right_output_frame,
+			  bool isRectified = false );
+
+  /** first stage of processFramePair: rectifies the input frames if
+   * necessary and converts them to (optionally blurred) 8 bit grayscale.
+   * @param left_frame left input frame
+   * @param right_frame right input frame
+   * @param left_gray_frame receives the preprocessed left image
+   * @param right_gray_frame receives the preprocessed right image
+   * @param isRectified tells the function if the input images are already rectified
+   */
+  void preprocessFramePair(const cv::Mat &left_frame, const cv::Mat &right_frame,
+			  cv::Mat &left_gray_frame, cv::Mat &right_gray_frame,
+			  bool isRectified = false );
+
+  /** second stage of processFramePair: computes disparities of the
+   * preprocessed grayscale images.
+   * 
+   * preprocessFramePair, computeDisparities and the conversion
+   * getDistanceImages( cv::Mat&, cv::Mat& ) don't share any buffers, so they
+   * may run concurrently on different frames. DenseStereoPipeline makes use
+   * of that.
+   *
+   * @param left_gray_frame left image as returned by preprocessFramePair
+   * @param right_gray_frame right image as returned by preprocessFramePair
+   * @param left_output_frame left output frame
+   * @param right_output_frame right output frame
+   */
+  void computeDisparities(const cv::Mat &left_gray_frame, const cv::Mat &right_gray_frame,
+			  cv::Mat &left_output_frame, cv::Mat &right_output_frame);
+
   /**
    * perform conversion from disparity to distance image
    */
@@ -90,6 +307,106 @@ public:
 			  base::samples::DistanceImage &left_output_frame, base::samples::DistanceImage &right_output_frame,
 			  bool isRectified = false );
 
+  /** 
+   * getDistanceImages for frames as delivered by the camera drivers, see
+   * processFramePair( const base::samples::frame::Frame&, ... )
+   */
+  void getDistanceImages( const base::samples::frame::Frame &left_frame,
+			  const base::samples::frame::Frame &right_frame,
+			  base::samples::DistanceImage &left_output_frame, base::samples::DistanceImage &right_output_frame,
+			  bool isRectified = false );
+
+  /** 
+   * computes only the left distance image. Use this if the right distance
+   * image is not needed, as it skips allocating, copying and converting
+   * the right image, and libelas does not post process it.
+   *
+   * @param left_frame left input frame
+   * @param right_frame right input frame
+   * @param left_output_frame left distance image
+   * @param isRectified tells the function if the input images are already rectified
+   */
+  void getLeftDistanceImage( const cv::Mat &left_frame, const cv::Mat &right_frame,
+			  cv::Mat &left_output_frame, bool isRectified = false );
+
+  /** 
+   * convenience method that takes a base::samples::DistanceImage as the
+   * result object, see getLeftDistanceImage above
+   *
+   * @param left_frame left input frame
+   * @param right_frame right input frame
+   * @param left_output_frame left distance image
+   * @param isRectified tells the function if the input images are already rectified
+   */
+  void getLeftDistanceImage( const cv::Mat &left_frame, const cv::Mat &right_frame,
+			  base::samples::DistanceImage &left_output_frame, bool isRectified = false );
+
+  /**
+   * configure the point cloud generation of getPointCloud, e.g. to skip
+   * pixels or to reduce the points to a voxel grid
+   */
+  void setPointCloudConfiguration( const PointCloudConfiguration &config )
+  { point_cloud_converter.setConfiguration( config ); }
+
+  /** 
+   * computes the left disparity image and reprojects it directly into a
+   * point cloud in the left camera frame, without going through a
+   * distance image.
+   *
+   * @param left_frame left input frame
+   * @param right_frame right input frame
+   * @param cloud receives the points
+   * @param isRectified tells the function if the input images are already rectified
+   */
+  void getPointCloud( const cv::Mat &left_frame, const cv::Mat &right_frame,
+			  base::samples::Pointcloud &cloud, bool isRectified = false );
+
+  /** 
+   * reprojects a left disparity image as given by processFramePair into a
+   * point cloud in the left camera frame
+   */
+  void getPointCloud( const cv::Mat &left_disp_image, base::samples::Pointcloud &cloud );
+
+  /** 
+   * computes the distance images of many frame pairs, e.g. for the offline
+   * processing of logged data. The frame pairs are spread over as many
+   * workers as threads are set with setNumThreads, each with its own
+   * libelas instance and buffers, and configured like this object. Each
+   * frame pair is processed as a whole by one worker, which scales better
+   * than splitting single frames into bands. The workers don't use the
+   * temporal prior, since they get the pairs in no particular order, and
+   * the result would depend on the scheduling.
+   *
+   * @param pairs input frame pairs
+   * @param left_output_frames receives the left distance image of each
+   *        pair, in the order of the input
+   * @param right_output_frames receives the right distance image of each
+   *        pair, in the order of the input
+   * @param isRectified tells the function if the input images are already rectified
+   */
+  void processBatch( const std::vector<FramePair> &pairs,
+			  std::vector<cv::Mat> &left_output_frames, std::vector<cv::Mat> &right_output_frames,
+			  bool isRectified = false );
+
+  /**
+   * @return the wall-clock durations of the processing stages of the last
+   *         frame. Stages the frame didn't pass keep the duration of the
+   *         previous frame which did.
+   */
+  DenseStereoTiming getTiming() const { return timing.getLast(); }
+
+  /**
+   * @return min, mean, 95th percentile and max of the stage durations over
+   *         the last frames, see setTimingHistory
+   */
+  DenseStereoTimingStatistics getTimingStatistics() const { return timing.getStatistics(); }
+
+  /**
+   * set the number of frames the timing statistics are taken over, which
+   * also drops the statistics so far. Default is 100.
+   */
+  void setTimingHistory( size_t frames ) { timing.setHistorySize( frames ); }
+
   /** 
    * prepare a distance image from the provided camera calibration
    * the resulting cv::Mat shares the same data buffer as the dist_image
@@ -128,25 +445,295 @@ private:
   /// see if we need to apply a gaussian filter
   int gaussian_kernel;
 
-  ///instance of libElas
-  Elas *elas;
+  ///libElas configuration used for all instances
+  libElasConfiguration elas_config;
+
+  ///matcher and configuration of the other engines
+  DisparityEngineType engine_type;
+  SgmConfiguration sgm_config;
+  BlockMatchingConfiguration bm_config;
+
+  ///matcher instances, one for each band
+  std::vector<DisparityEngine*> engine_pool;
+
+  ///true if the engines were last set to compute only the left disparities
+  bool engines_left_only;
+
+  ///incremented whenever the configuration of the engines changes, so that
+  ///processBatch only recreates the engines of its workers if needed
+  size_t engine_revision;
+
+  ///number of rows the bands overlap at each side
+  int band_overlap;
+
+  ///disparity output of the individual bands
+  std::vector<cv::Mat> band_left_disp, band_right_disp;
+
+  ///upsample the half resolution output of libElas subsampling
+  bool upsample_subsampled;
+
+  ///half resolution disparities before upsampling
+  cv::Mat half_left_disp, half_right_disp;
+
+  ///output in the compact 16 bit format
+  bool compact_output;
+
+  ///float disparities before the conversion to the compact format
+  cv::Mat float_left_disp, float_right_disp;
+
+  ///compute the confidence of the left disparities
+  bool confidence_output;
+
+  ///confidence at the resolution of the matching, and of the output
+  cv::Mat match_confidence, confidence;
+
+  ///coarse-to-fine matching settings
+  bool coarse_to_fine;
+  size_t coarse_to_fine_bands;
+  int coarse_to_fine_margin;
+
+  ///matcher instance for the half resolution pass
+  DisparityEngine *coarse_engine;
+
+  ///matcher instances for the bands with their own disparity range
+  std::vector<DisparityEngine*> band_engines;
+
+  ///disparity range the band instances were created with
+  std::vector<std::pair<int, int> > band_disp_range;
+
+  ///half resolution images and disparities of the coarse pass
+  cv::Mat coarse_left, coarse_right, coarse_left_disp, coarse_right_disp;
+
+  ///histogram of the valid disparities in the rows of a band
+  struct BandHistogram
+  {
+    BandHistogram() : valid(0), total(0) {}
+    std::vector<int> bins;
+    int valid, total;
+  };
+
+  ///histogram of the coarse disparities of each band
+  std::vector<BandHistogram> band_histogram;
+
+  ///temporal prior configuration
+  TemporalPriorConfiguration temporal_prior;
+
+  ///disparity histograms of the bands of the previous frame
+  std::vector<BandHistogram> prior_histogram;
+
+  ///processing window of the previous frame
+  cv::Rect prior_window;
+
+  ///the previous frame can be used as prior
+  bool prior_valid;
+
+  ///the current frame is matched with the ranges of the prior
+  bool prior_used;
+
+  ///share of valid pixels of the last frame matched without prior
+  float prior_reference_coverage;
+
+  ///downscaled left images of the previous and current frame, which are
+  ///compared to detect scene cuts
+  cv::Mat prior_thumbnail, prior_thumbnail_next, prior_thumbnail_diff;
+
+  ///right disparity output of libElas if only the left image is requested
+  cv::Mat right_disp;
   
   ///calibration parameters
   frame_helper::StereoCalibrationCv calParam;
   
   ///calibration initialized?
   bool calibrationInitialized;
+
+  ///interpolation used for undistortion and rectification
+  RectificationInterpolation rectification_interpolation;
+
+  ///fixed-point undistortion and rectification maps and reprojection matrix
+  RectificationMaps rectification_maps;
+
+  ///directory of the rectification map files, empty for memory only
+  std::string rectification_cache_directory;
+
+  ///persistent buffers for the rectified input images
+  cv::Mat left_rectified, right_rectified;
+
+  ///preprocessed grayscale images used by processFramePair
+  cv::Mat left_gray, right_gray;
+
+  ///converted RGB or Bayer input frames
+  cv::Mat left_frame_buffer, right_frame_buffer;
+
+  ///grayscale conversion and gaussian blur for left and right image
+  GaussianFilter left_filter, right_filter;
+
+  ///worker threads for processing left and right image in parallel
+  ThreadPool thread_pool;
+
+  ///reprojection of disparities into point clouds
+  PointCloudConverter point_cloud_converter;
+
+  ///left disparity image used by getPointCloud
+  cv::Mat left_disp;
+
+  ///dense stereo instances used by processBatch
+  std::vector<DenseStereo*> batch_workers;
+
+  ///region of interest and mask as set by the user
+  cv::Rect roi;
+  cv::Mat mask;
+
+  ///part of the calibrated image which is preprocessed and matched
+  cv::Rect processing_window;
+
+  ///non-zero for the output pixels which are outside the region of
+  ///interest or the mask, empty if the whole image is processed
+  cv::Mat invalid_mask;
+
+  ///invalid_mask for half resolution output images
+  cv::Mat invalid_mask_half;
+
+  ///durations of the processing stages
+  TimingRecorder timing;
+
+  ///time the distance conversion took in the last call of matchImages,
+  ///and for each band when it is done while stitching
+  base::Time conversion_time;
+  std::vector<base::Time> band_conversion_time;
   
+  /** copies the configuration (but not the processing state) of another
+   * instance. The rectification maps and the mask are shared, as they are
+   * only read during processing.
+   */
+  void copyConfiguration(const DenseStereo &other);
+
   /** undistorts and rectifies an image with openCV 
    * @param image image which should be undistorted and rectified
-   * @param calib calibration which should be used for undistortion and rectification
+   * @param rectified buffer which receives the rectified image
+   * @param map1 fixed-point map as created by cv::convertMaps
+   * @param map2 interpolation table index map as created by cv::convertMaps
+   * @param window part of the rectified image which is computed
+   */
+  void undistortAndRectify(const cv::Mat &image, cv::Mat &rectified,
+                           const cv::Mat &map1, const cv::Mat &map2,
+                           const cv::Rect &window);
+
+  /** updates processing_window and invalid_mask after the calibration,
+   * the region of interest, the mask or the disparity range changed
    */
-  void undistortAndRectify(cv::Mat &image, const frame_helper::CameraCalibrationCv& calib);
+  void updateProcessingWindow();
+
+  /** gets the part of an image of the given size which is processed. This
+   * is the whole image, unless the size is the calibrated image size and a
+   * region of interest or mask is set.
+   */
+  cv::Rect getProcessingWindow(const cv::Size &size) const;
+
+  /** sets the pixels outside the region of interest or mask to value */
+  void invalidateOutsideRoi(cv::Mat &image, float value);
   
-  /** converts colour of an image to grayscale (uint8_t) with openCV
-   * @param image Image which is converted
+  /** (re)creates the matcher instances from the configuration
+   * @param num_instances number of instances, one for each band
+   */
+  void createEngines(size_t num_instances);
+
+  /** switches the matcher instances between computing only the left and
+   * both disparity images. Only the engines which care are affected, see
+   * DisparityEngine::setLeftOnly.
+   */
+  void setEnginesLeftOnly(bool left_only);
+
+  /** creates a matcher instance of the configured type with a different
+   * disparity range. The caller owns the instance.
+   * @param subsampling use libelas subsampling if it is configured
+   */
+  DisparityEngine* createEngine(int disp_min, int disp_max, bool left_only,
+                                bool subsampling = true);
+
+  /** true if the matcher outputs only every second pixel in x and y */
+  bool isSubsampled() const
+  { return engine_type == ENGINE_ELAS && elas_config.subsampling; }
+
+  /** gets the rows of a band of the processing window
+   * @param core_begin, core_end rows of the band which are output
+   * @param band_begin, band_end rows including the overlap, which are matched
+   */
+  void getBandRows(size_t band, size_t num_bands, const cv::Rect &window,
+                   int32_t &core_begin, int32_t &core_end,
+                   int32_t &band_begin, int32_t &band_end) const;
+
+  /** chooses the disparity range of each band from the temporal prior or
+   * the coarse pass on the half resolution images, and (re)creates the
+   * matcher instances of the bands with these ranges
+   */
+  void estimateBandDisparityRanges(const cv::Mat &left, const cv::Mat &right,
+                                   const cv::Rect &window, size_t num_bands);
+
+  /** disparity range from a histogram of disparities
+   * @param scale factor from histogram bins to disparities
+   * @param margin number of disparities the range is extended by
+   */
+  std::pair<int, int> rangeFromHistogram(const BandHistogram &histogram,
+                                         int scale, int margin) const;
+
+  /** @return true if the left image differs too much from the previous one
+   * to use the temporal prior
+   */
+  bool detectSceneCut(const cv::Mat &left, const cv::Rect &window);
+
+  /** checks the coverage of the current frame and decides if it can be
+   * used as prior for the next one
+   */
+  void updateTemporalPrior();
+
+  /** runs libElas on the preprocessed images, and converts the result
+   * to the compact format if requested. See matchFloat for the
+   * parameters.
+   */
+  void matchFramePair(const cv::Mat &left, const cv::Mat &right,
+                      cv::Mat &left_output_frame, cv::Mat *right_output_frame,
+                      bool to_distance);
+
+  /** converts both input frames with frameToMat, in parallel
+   * @param left receives the left image
+   * @param right receives the right image
+   */
+  void convertFramePair(const base::samples::frame::Frame &left_frame,
+                        const base::samples::frame::Frame &right_frame,
+                        cv::Mat &left, cv::Mat &right);
+
+  /** runs libElas on the preprocessed images, and upsamples the result if
+   * requested
+   * @param left left grayscale image
+   * @param right right grayscale image
+   * @param left_output_frame left output frame
+   * @param right_output_frame right output frame, NULL if only the left
+   *        image is needed
+   * @param to_distance convert the disparities to distances
+   */
+  void matchFloat(const cv::Mat &left, const cv::Mat &right,
+                  cv::Mat &left_output_frame, cv::Mat *right_output_frame,
+                  bool to_distance);
+
+  /** runs libElas on the preprocessed images, on the whole image or in
+   * bands in parallel
+   * @param left left grayscale image
+   * @param right right grayscale image
+   * @param left_output_frame left output frame
+   * @param right_output_frame right output frame, NULL if only the left
+   *        image is needed
+   * @param to_distance convert the disparities to distances while writing
+   *        the output frames. The time this takes is stored in
+   *        conversion_time.
+   */
+  void matchImages(const cv::Mat &left, const cv::Mat &right,
+                   cv::Mat &left_output_frame, cv::Mat *right_output_frame,
+                   bool to_distance);
+
+  /** gets the factors for converting disparity to distance, which are
+   * focal length times baseline of the respective camera
    */
-  void cvtCvMatToGrayscaleImage(cv::Mat &image);
+  void getDistanceFactors(float &left_factor, float &right_factor);
 };
 
 }
@@ -0,0 +1,257 @@
+#include "disparity_conversion.h"
+#include "thread_pool.h"
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <cmath>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace stereo
+{
+
+void disparityToDistance( const float *src, float *dst, size_t count, float dist_factor )
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    size_t i = 0;
+
+    // the division is performed for all elements, and the result replaced
+    // by NaN where the disparity was not positive. NaN disparities fail
+    // the comparison as well.
+#ifdef __AVX__
+    {
+	const __m256 factor8 = _mm256_set1_ps( dist_factor );
+	const __m256 zero8 = _mm256_setzero_ps();
+	const __m256 nan8 = _mm256_set1_ps( nan );
+	for( ; i + 8 <= count; i += 8 )
+	{
+	    const __m256 disparity = _mm256_loadu_ps( src + i );
+	    const __m256 valid = _mm256_cmp_ps( disparity, zero8, _CMP_GT_OQ );
+	    const __m256 distance = _mm256_div_ps( factor8, disparity );
+	    _mm256_storeu_ps( dst + i, _mm256_blendv_ps( nan8, distance, valid ) );
+	}
+    }
+#endif
+#ifdef __SSE__
+    {
+	const __m128 factor4 = _mm_set1_ps( dist_factor );
+	const __m128 zero4 = _mm_setzero_ps();
+	const __m128 nan4 = _mm_set1_ps( nan );
+	for( ; i + 4 <= count; i += 4 )
+	{
+	    const __m128 disparity = _mm_loadu_ps( src + i );
+	    const __m128 valid = _mm_cmpgt_ps( disparity, zero4 );
+	    const __m128 distance = _mm_div_ps( factor4, disparity );
+	    _mm_storeu_ps( dst + i, 
+		    _mm_or_ps( _mm_and_ps( valid, distance ), _mm_andnot_ps( valid, nan4 ) ) );
+	}
+    }
+#endif
+    for( ; i < count; i++ )
+    {
+	const float disparity = src[i];
+	dst[i] = disparity > 0 ? 
+	    dist_factor / disparity : 
+	    nan;
+    }
+}
+
+// applies convert( src_row, dst_row, count ) to all pixels of src, split up
+// into one chunk per thread of the pool. Continuous images are treated as
+// a single row, so the chunks are balanced for any image shape.
+template <class Src, class Dst, class F>
+static void convertImage( const cv::Mat &src, cv::Mat &dst, int src_type, int dst_type, 
+	ThreadPool *pool, const char *name, F convert )
+{
+    if( src.type() != src_type )
+	throw std::runtime_error( std::string( name ) + " got an image of the wrong type." );
+
+    const int height = src.size().height;
+    const int width = src.size().width;
+    if( dst.data != src.data )
+	dst.create( height, width, dst_type );
+    else if( src_type != dst_type )
+	throw std::runtime_error( std::string( name ) + " can't convert in place." );
+
+    // continuous images are converted in one go
+    int rows = height, cols = width;
+    if( src.isContinuous() && dst.isContinuous() )
+    {
+	cols *= rows;
+	rows = 1;
+    }
+
+    const size_t chunks = pool ? pool->getNumThreads() : 1;
+    const auto convertChunk = [&]( size_t chunk )
+    {
+	const size_t total = (size_t)rows * cols;
+	const size_t begin = total * chunk / chunks;
+	const size_t end = total * ( chunk + 1 ) / chunks;
+
+	// work through the chunk row by row
+	size_t pos = begin;
+	while( pos < end )
+	{
+	    const int row = pos / cols, col = pos % cols;
+	    const size_t count = std::min( end - pos, (size_t)( cols - col ) );
+	    convert( src.ptr<Src>( row ) + col, dst.ptr<Dst>( row ) + col, count );
+	    pos += count;
+	}
+    };
+
+    if( pool )
+	pool->parallelFor( chunks, convertChunk );
+    else
+	convertChunk( 0 );
+}
+
+void disparityToDistance( const cv::Mat &disp, cv::Mat &dist, float dist_factor, ThreadPool *pool )
+{
+    convertImage<float, float>( disp, dist, CV_32FC1, CV_32FC1, pool, "disparityToDistance",
+	    [dist_factor]( const float *src, float *dst, size_t count )
+	    { disparityToDistance( src, dst, count, dist_factor ); } );
+}
+
+// largest value which rounds to a valid compact value
+static const float COMPACT_MAX = COMPACT_INVALID - 0.5f;
+
+// compact value of scale * src, or scale / src if Reciprocal is set. Only
+// positive sources are valid, as disparities and distances can't be zero
+// or negative, and NaN fails the comparison as well.
+template <bool Reciprocal>
+static void floatToCompact( const float *src, uint16_t *dst, size_t count, float scale )
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 zero4 = _mm_setzero_ps();
+    const __m128 max4 = _mm_set1_ps( COMPACT_MAX );
+    const __m128 scale4 = _mm_set1_ps( scale );
+    const __m128i invalid4 = _mm_set1_epi32( COMPACT_INVALID );
+    const __m128i bias4 = _mm_set1_epi32( 0x8000 );
+    const __m128i unbias8 = _mm_set1_epi16( (short)0x8000 );
+    for( ; i + 8 <= count; i += 8 )
+    {
+	__m128i values[2];
+	for( int j = 0; j < 2; j++ )
+	{
+	    const __m128 s = _mm_loadu_ps( src + i + 4 * j );
+	    const __m128 v = Reciprocal ? _mm_div_ps( scale4, s ) : _mm_mul_ps( scale4, s );
+	    const __m128i valid = _mm_castps_si128( 
+		    _mm_and_ps( _mm_cmpgt_ps( s, zero4 ), _mm_cmplt_ps( v, max4 ) ) );
+	    // rounds to nearest like lrint in the scalar loop
+	    const __m128i rounded = _mm_cvtps_epi32( v );
+	    values[j] = _mm_sub_epi32( 
+		    _mm_or_si128( _mm_and_si128( valid, rounded ), _mm_andnot_si128( valid, invalid4 ) ),
+		    bias4 );
+	}
+	// SSE2 only has a signed pack, so the values are packed with a bias
+	const __m128i packed = _mm_xor_si128( _mm_packs_epi32( values[0], values[1] ), unbias8 );
+	_mm_storeu_si128( reinterpret_cast<__m128i*>( dst + i ), packed );
+    }
+#endif
+    for( ; i < count; i++ )
+    {
+	const float v = Reciprocal ? scale / src[i] : scale * src[i];
+	dst[i] = src[i] > 0 && v < COMPACT_MAX ? (uint16_t)lrintf( v ) : COMPACT_INVALID;
+    }
+}
+
+static void compactToFloat( const uint16_t *src, float *dst, size_t count, float scale, float invalid )
+{
+    for( size_t i = 0; i < count; i++ )
+	dst[i] = src[i] == COMPACT_INVALID ? invalid : src[i] * scale;
+}
+
+void disparityToCompact( const cv::Mat &disp, cv::Mat &compact, ThreadPool *pool )
+{
+    convertImage<float, uint16_t>( disp, compact, CV_32FC1, CV_16UC1, pool, "disparityToCompact",
+	    []( const float *src, uint16_t *dst, size_t count )
+	    { floatToCompact<false>( src, dst, count, COMPACT_DISPARITY_SCALE ); } );
+}
+
+void compactToDisparity( const cv::Mat &compact, cv::Mat &disp, ThreadPool *pool )
+{
+    convertImage<uint16_t, float>( compact, disp, CV_16UC1, CV_32FC1, pool, "compactToDisparity",
+	    []( const uint16_t *src, float *dst, size_t count )
+	    { compactToFloat( src, dst, count, 1.0f / COMPACT_DISPARITY_SCALE, -10.0f ); } );
+}
+
+void disparityToCompactDistance( const cv::Mat &disp, cv::Mat &compact, float dist_factor, ThreadPool *pool )
+{
+    const float scale = dist_factor * COMPACT_DISTANCE_SCALE;
+    convertImage<float, uint16_t>( disp, compact, CV_32FC1, CV_16UC1, pool, "disparityToCompactDistance",
+	    [scale]( const float *src, uint16_t *dst, size_t count )
+	    { floatToCompact<true>( src, dst, count, scale ); } );
+}
+
+void compactDisparityToDistance( const cv::Mat &compact_disp, cv::Mat &compact_dist, float dist_factor,
+	ThreadPool *pool )
+{
+    // the fixed-point scale of the disparities goes into the factor
+    const float scale = dist_factor * COMPACT_DISTANCE_SCALE * COMPACT_DISPARITY_SCALE;
+    convertImage<uint16_t, uint16_t>( compact_disp, compact_dist, CV_16UC1, CV_16UC1, pool, 
+	    "compactDisparityToDistance",
+	    [scale]( const uint16_t *src, uint16_t *dst, size_t count )
+	    {
+		for( size_t i = 0; i < count; i++ )
+		{
+		    const float v = scale / src[i];
+		    dst[i] = src[i] != COMPACT_INVALID && src[i] > 0 && v < COMPACT_MAX ? 
+			(uint16_t)lrintf( v ) : COMPACT_INVALID;
+		}
+	    } );
+}
+
+void distanceToCompact( const cv::Mat &dist, cv::Mat &compact, ThreadPool *pool )
+{
+    convertImage<float, uint16_t>( dist, compact, CV_32FC1, CV_16UC1, pool, "distanceToCompact",
+	    []( const float *src, uint16_t *dst, size_t count )
+	    { floatToCompact<false>( src, dst, count, COMPACT_DISTANCE_SCALE ); } );
+}
+
+void compactToDistance( const cv::Mat &compact, cv::Mat &dist, ThreadPool *pool )
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    convertImage<uint16_t, float>( compact, dist, CV_16UC1, CV_32FC1, pool, "compactToDistance",
+	    [nan]( const uint16_t *src, float *dst, size_t count )
+	    { compactToFloat( src, dst, count, 1.0f / COMPACT_DISTANCE_SCALE, nan ); } );
+}
+
+void compactToDistanceImage( const cv::Mat &compact, base::samples::DistanceImage &dist_image )
+{
+    dist_image.width = compact.cols;
+    dist_image.height = compact.rows;
+    dist_image.data.resize( compact.cols * compact.rows );
+    if( dist_image.data.empty() )
+	return;
+
+    // the data of the distance image is used as the output image
+    cv::Mat dist( compact.rows, compact.cols, CV_32FC1, &dist_image.data[0] );
+    compactToDistance( compact, dist );
+}
+
+void distanceImageToCompact( const base::samples::DistanceImage &dist_image, cv::Mat &compact )
+{
+    if( dist_image.data.size() != (size_t)dist_image.width * dist_image.height )
+	throw std::runtime_error( "The size of the distance image doesn't match its data." );
+    if( dist_image.data.empty() )
+    {
+	compact.release();
+	return;
+    }
+
+    const cv::Mat dist( dist_image.height, dist_image.width, CV_32FC1,
+	    const_cast<float*>( &dist_image.data[0] ) );
+    distanceToCompact( dist, compact );
+}
+
+}
@@ -0,0 +1,100 @@
+#ifndef __STEREO_DISPARITY_CONVERSION_H__
+#define __STEREO_DISPARITY_CONVERSION_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+#include <base/samples/DistanceImage.hpp>
+
+namespace stereo
+{
+    class ThreadPool;
+
+    /** 
+     * convert disparities to distances, with distance = dist_factor /
+     * disparity. Disparities that are not positive result in NaN. 
+     *
+     * The conversion is vectorized with SSE, or AVX if the library is
+     * compiled with AVX support.
+     *
+     * @param src count disparity values
+     * @param dst receives count distance values, may be the same as src
+     * @param count number of values to convert
+     * @param dist_factor product of focal length and baseline
+     */
+    void disparityToDistance( const float *src, float *dst, size_t count, float dist_factor );
+
+    /** 
+     * convert a disparity image (CV_32FC1) to a distance image.
+     *
+     * @param disp disparity image
+     * @param dist receives the distance image, may be the same as disp
+     * @param dist_factor product of focal length and baseline
+     * @param pool if given, the rows are split up between the threads of
+     *        the pool
+     */
+    void disparityToDistance( const cv::Mat &disp, cv::Mat &dist, float dist_factor, ThreadPool *pool = NULL );
+
+    /// invalid value of the compact 16 bit disparity and distance images
+    static const uint16_t COMPACT_INVALID = 0xFFFF;
+
+    /// compact disparities are in 1/16 pixel
+    static const float COMPACT_DISPARITY_SCALE = 16.0f;
+
+    /// compact distances are in millimetres, if the calibration is in metres
+    static const float COMPACT_DISTANCE_SCALE = 1000.0f;
+
+    /*
+     * Conversions between the float images (CV_32FC1) and the compact 16 bit
+     * format (CV_16UC1), which has fixed-point disparities in 1/16 pixel and
+     * distances in millimetres. Invalid pixels, and values which don't fit
+     * into the format (distances beyond 65.5 m), are COMPACT_INVALID.
+     *
+     * Unless stated otherwise, src and dst can't be the same image. If a
+     * pool is given, the rows are split up between its threads.
+     */
+
+    /** convert float disparities to compact disparities. Disparities that
+     * are not positive are invalid.
+     */
+    void disparityToCompact( const cv::Mat &disp, cv::Mat &compact, ThreadPool *pool = NULL );
+
+    /** convert compact disparities to float disparities. Invalid pixels
+     * get the libelas invalid value -10.
+     */
+    void compactToDisparity( const cv::Mat &compact, cv::Mat &disp, ThreadPool *pool = NULL );
+
+    /** convert float disparities directly to compact distances, with
+     * distance = dist_factor / disparity
+     */
+    void disparityToCompactDistance( const cv::Mat &disp, cv::Mat &compact, float dist_factor, 
+	    ThreadPool *pool = NULL );
+
+    /** convert compact disparities to compact distances, with distance =
+     * dist_factor / disparity. compact_disp and compact_dist may be the
+     * same image.
+     */
+    void compactDisparityToDistance( const cv::Mat &compact_disp, cv::Mat &compact_dist, float dist_factor,
+	    ThreadPool *pool = NULL );
+
+    /** convert float distances to compact distances. NaN distances are
+     * invalid.
+     */
+    void distanceToCompact( const cv::Mat &dist, cv::Mat &compact, ThreadPool *pool = NULL );
+
+    /** convert compact distances to float distances, invalid pixels are
+     * NaN
+     */
+    void compactToDistance( const cv::Mat &compact, cv::Mat &dist, ThreadPool *pool = NULL );
+
+    /** fill the distances of a DistanceImage from a compact distance
+     * image, and set its size. The intrinsics of the distance image are
+     * not changed, see DenseStereo::createDistanceImage.
+     */
+    void compactToDistanceImage( const cv::Mat &compact, base::samples::DistanceImage &dist_image );
+
+    /** convert the distances of a DistanceImage to a compact distance image */
+    void distanceImageToCompact( const base::samples::DistanceImage &dist_image, cv::Mat &compact );
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include "disparity_engine.h"
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace stereo;
+
+ElasEngine::ElasEngine( const Elas::parameters &param )
+    : param( param ), postprocess_only_left( param.postprocess_only_left ),
+      elas( new Elas( param ) )
+{
+}
+
+ElasEngine::~ElasEngine()
+{
+    delete elas;
+}
+
+void ElasEngine::process( const uint8_t *left, const uint8_t *right, 
+	float *left_disp, float *right_disp, const int32_t *dims )
+{
+    // libelas doesn't write to the input images
+    elas->process( const_cast<uint8_t*>( left ), const_cast<uint8_t*>( right ),
+	    left_disp, right_disp, dims );
+}
+
+void ElasEngine::setLeftOnly( bool left_only )
+{
+    const bool only_left = postprocess_only_left || left_only;
+    if( only_left == param.postprocess_only_left )
+	return;
+
+    param.postprocess_only_left = only_left;
+    delete elas;
+    elas = new Elas( param );
+}
+
+#ifdef __SSE2__
+// a where mask is set, b elsewhere
+static inline __m128i select( __m128i mask, __m128i a, __m128i b )
+{
+    return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) );
+}
+
+// reverses the order of the 16 bit lanes
+static inline __m128i reverse16( __m128i v )
+{
+    v = _mm_shuffle_epi32( v, _MM_SHUFFLE( 0, 1, 2, 3 ) );
+    v = _mm_shufflelo_epi16( v, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+    return _mm_shufflehi_epi16( v, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+}
+#endif
+
+void stereo::selectDisparities( const uint16_t *costs, int width, int stride, int disp_min, int num_disp,
+	int lr_threshold, bool subpixel, float *left_disp, float *right_disp,
+	std::vector<uint8_t> &scratch )
+{
+    scratch.resize( std::max( scratch.size(), (size_t)( width * 3 * sizeof( int16_t ) ) ) );
+    int16_t *left_k = reinterpret_cast<int16_t*>( &scratch[0] );
+    int16_t *right_k = left_k + width;
+    uint16_t *right_cost = reinterpret_cast<uint16_t*>( right_k + width );
+    for( int x = 0; x < width; x++ )
+    {
+	right_k[x] = -1;
+	right_cost[x] = 0x7fff;
+    }
+
+    for( int x = 0; x < width; x++ )
+    {
+	// disparities for which the right pixel is inside the image
+	const int k_begin = std::max( 0, x - disp_min - ( width - 1 ) );
+	const int k_end = std::min( num_disp, x - disp_min + 1 );
+	left_k[x] = -1;
+	if( k_begin >= k_end )
+	    continue;
+
+	const uint16_t *s = costs + x * stride;
+	int best = k_begin;
+	int k = k_begin;
+#ifdef __SSE2__
+	// 8 disparities at a time. The costs are below 0x8000, so the signed
+	// comparisons work. The right pixels are in reverse order of the
+	// disparities, so the costs are reversed for them.
+	if( k_end - k >= 8 )
+	{
+	    const __m128i step = _mm_set1_epi16( 8 );
+	    __m128i kv = _mm_add_epi16( _mm_set1_epi16( k ), _mm_setr_epi16( 0, 1, 2, 3, 4, 5, 6, 7 ) );
+	    __m128i kr = reverse16( kv );
+	    __m128i min_cost = _mm_set1_epi16( 0x7fff ), min_k = kv;
+	    for( ; k + 8 <= k_end; k += 8 )
+	    {
+		const __m128i c = _mm_loadu_si128( reinterpret_cast<const __m128i*>( s + k ) );
+		min_k = select( _mm_cmplt_epi16( c, min_cost ), kv, min_k );
+		min_cost = _mm_min_epi16( min_cost, c );
+
+		const int xr = x - disp_min - k - 7;
+		__m128i *rc = reinterpret_cast<__m128i*>( right_cost + xr );
+		__m128i *rk = reinterpret_cast<__m128i*>( right_k + xr );
+		const __m128i cr = reverse16( c );
+		const __m128i old_cost = _mm_loadu_si128( rc );
+		_mm_storeu_si128( rk, select( _mm_cmplt_epi16( cr, old_cost ), kr, _mm_loadu_si128( rk ) ) );
+		_mm_storeu_si128( rc, _mm_min_epi16( cr, old_cost ) );
+
+		kv = _mm_add_epi16( kv, step );
+		kr = _mm_add_epi16( kr, step );
+	    }
+
+	    // the smallest cost, and the smallest disparity with that cost
+	    int16_t lane_cost[8], lane_k[8];
+	    _mm_storeu_si128( reinterpret_cast<__m128i*>( lane_cost ), min_cost );
+	    _mm_storeu_si128( reinterpret_cast<__m128i*>( lane_k ), min_k );
+	    best = lane_k[0];
+	    for( int i = 1; i < 8; i++ )
+	    {
+		if( lane_cost[i] < s[best] || ( lane_cost[i] == s[best] && lane_k[i] < best ) )
+		    best = lane_k[i];
+	    }
+	}
+#endif
+	for( ; k < k_end; k++ )
+	{
+	    if( s[k] < s[best] )
+		best = k;
+	    // the right pixel of this disparity
+	    const int xr = x - disp_min - k;
+	    if( s[k] < right_cost[xr] )
+	    {
+		right_cost[xr] = s[k];
+		right_k[xr] = k;
+	    }
+	}
+	left_k[x] = best;
+    }
+
+    // left/right consistency check on the integer disparities
+    for( int x = 0; x < width; x++ )
+    {
+	float d = -10.0f;
+	const int k = left_k[x];
+	if( k >= 0 )
+	{
+	    const int xr = x - disp_min - k;
+	    if( lr_threshold < 0 || std::abs( right_k[xr] - k ) <= lr_threshold )
+	    {
+		d = disp_min + k;
+		const uint16_t *s = costs + x * stride;
+		if( subpixel && k > 0 && k + 1 < num_disp && x - disp_min - k - 1 >= 0 )
+		{
+		    // vertex of the parabola through the costs around the minimum
+		    const int c0 = s[k - 1], c1 = s[k], c2 = s[k + 1];
+		    const int denom = c0 - 2 * c1 + c2;
+		    if( denom > 0 )
+			d += 0.5f * ( c0 - c2 ) / denom;
+		}
+	    }
+	}
+	left_disp[x] = d;
+    }
+
+    for( int xr = 0; xr < width; xr++ )
+    {
+	float d = -10.0f;
+	const int k = right_k[xr];
+	if( k >= 0 )
+	{
+	    const int x = xr + disp_min + k;
+	    if( lr_threshold < 0 || ( x < width && left_k[x] >= 0 && std::abs( left_k[x] - k ) <= lr_threshold ) )
+		d = disp_min + k;
+	}
+	right_disp[xr] = d;
+    }
+}
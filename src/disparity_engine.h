@@ -0,0 +1,91 @@
+#ifndef __STEREO_DISPARITY_ENGINE_H__
+#define __STEREO_DISPARITY_ENGINE_H__
+
+#include <stdint.h>
+#include <vector>
+#include <libelas/elas.h>
+
+namespace stereo
+{
+
+/**
+ * Interface of the matchers which compute the disparities of a rectified
+ * image pair in DenseStereo. The interface follows the one of libelas, so
+ * that the engines can be used for whole images and bands of an image
+ * alike. Engines don't need to be thread-safe, DenseStereo uses one
+ * instance per band.
+ */
+class DisparityEngine
+{
+public:
+    virtual ~DisparityEngine() {}
+
+    /**
+     * compute the disparities of a rectified image pair. Invalid
+     * disparities are set to -10, like libelas does.
+     *
+     * @param left left 8 bit grayscale image
+     * @param right right 8 bit grayscale image
+     * @param left_disp receives the left disparities, written densely
+     * @param right_disp receives the right disparities, written densely
+     * @param dims width, height and bytes per line of the input images
+     */
+    virtual void process( const uint8_t *left, const uint8_t *right, 
+	    float *left_disp, float *right_disp, const int32_t *dims ) = 0;
+
+    /** only the left disparities are needed until the next call, so the
+     * right ones don't need to be post processed. Engines which compute both
+     * images the same way ignore it.
+     */
+    virtual void setLeftOnly( bool left_only ) {}
+};
+
+/** libelas as a disparity engine */
+class ElasEngine : public DisparityEngine
+{
+public:
+    explicit ElasEngine( const Elas::parameters &param );
+    virtual ~ElasEngine();
+
+    virtual void process( const uint8_t *left, const uint8_t *right, 
+	    float *left_disp, float *right_disp, const int32_t *dims );
+
+    /** recreates the libelas instance with postprocess_only_left set, which
+     * is cheap since libelas allocates its buffers in process
+     */
+    virtual void setLeftOnly( bool left_only );
+
+private:
+    Elas::parameters param;
+    /// postprocess_only_left of the configuration
+    bool postprocess_only_left;
+    Elas *elas;
+};
+
+/**
+ * winner-take-all on the matching costs of a row, for the engines which
+ * compute a cost for every disparity. The right disparities are the
+ * integer minima over the same costs. Pixels which fail the left/right
+ * consistency check, or whose disparities would leave the image, are set
+ * to -10.
+ *
+ * @param costs costs of the row, stride values for each pixel, starting
+ *              with disp_min
+ * @param width width of the row
+ * @param stride number of costs of each pixel, at least num_disp
+ * @param disp_min smallest disparity
+ * @param num_disp number of disparities
+ * @param lr_threshold largest difference between left and right
+ *                     disparities, negative to disable the check
+ * @param subpixel refine the left disparities with a parabola fit
+ * @param left_disp receives the left disparities of the row
+ * @param right_disp receives the right disparities of the row
+ * @param scratch buffer, which is kept between calls
+ */
+void selectDisparities( const uint16_t *costs, int width, int stride, int disp_min, int num_disp,
+	int lr_threshold, bool subpixel, float *left_disp, float *right_disp,
+	std::vector<uint8_t> &scratch );
+
+}
+
+#endif
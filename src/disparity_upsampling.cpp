@@ -0,0 +1,78 @@
+#include "disparity_upsampling.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+namespace stereo
+{
+
+void upsampleDisparity( const cv::Mat &half_disp, const cv::Mat &guide, cv::Mat &disp, 
+	ThreadPool *pool, float sigma_color )
+{
+    if( half_disp.type() != CV_32FC1 || guide.type() != CV_8UC1 )
+	throw std::runtime_error( "upsampleDisparity expects a CV_32FC1 disparity and a CV_8UC1 guide image." );
+
+    const int width = guide.cols, height = guide.rows;
+    const int half_width = half_disp.cols, half_height = half_disp.rows;
+    if( half_width != width / 2 || half_height != height / 2 || half_width == 0 || half_height == 0 )
+	throw std::runtime_error( "upsampleDisparity expects a disparity image of half the size of the guide image." );
+
+    disp.create( height, width, CV_32FC1 );
+
+    // weights for the guide differences and the offsets between output
+    // pixel and disparity pixel, which are between -2 and 5 in each axis
+    // (the last row and column of odd sized images are furthest away)
+    float color_weight[256];
+    for( int i = 0; i < 256; i++ )
+	color_weight[i] = std::exp( -0.5f * i * i / ( sigma_color * sigma_color ) );
+    float spatial_weight[11];
+    for( int i = 0; i < 11; i++ )
+	spatial_weight[i] = std::exp( -0.5f * ( i - 4 ) * ( i - 4 ) );
+
+    const size_t chunks = pool ? pool->getNumThreads() : 1;
+    const auto upsampleChunk = [&]( size_t chunk )
+    {
+	const int row_begin = height * chunk / chunks;
+	const int row_end = height * ( chunk + 1 ) / chunks;
+	for( int y = row_begin; y < row_end; y++ )
+	{
+	    const uint8_t *g = guide.ptr<uint8_t>( y );
+	    float *d = disp.ptr<float>( y );
+	    const int cy = std::min( y / 2, half_height - 1 );
+	    const int v_begin = std::max( 0, cy - 1 ), v_end = std::min( half_height, cy + 2 );
+
+	    for( int x = 0; x < width; x++ )
+	    {
+		const int cx = std::min( x / 2, half_width - 1 );
+		const int u_begin = std::max( 0, cx - 1 ), u_end = std::min( half_width, cx + 2 );
+
+		float sum = 0, weight_sum = 0;
+		for( int v = v_begin; v < v_end; v++ )
+		{
+		    const float *hd = half_disp.ptr<float>( v );
+		    const uint8_t *hg = guide.ptr<uint8_t>( 2 * v );
+		    const float wy = spatial_weight[y - 2 * v + 4];
+		    for( int u = u_begin; u < u_end; u++ )
+		    {
+			if( hd[u] < 0 )
+			    continue;
+			const float w = wy * spatial_weight[x - 2 * u + 4] *
+			    color_weight[std::abs( (int)g[x] - (int)hg[2 * u] )];
+			sum += w * hd[u];
+			weight_sum += w;
+		    }
+		}
+
+		d[x] = weight_sum > 1e-6f ? sum / weight_sum : -10.0f;
+	    }
+	}
+    };
+
+    if( pool )
+	pool->parallelFor( chunks, upsampleChunk );
+    else
+	upsampleChunk( 0 );
+}
+
+}
@@ -0,0 +1,32 @@
+#ifndef __STEREO_DISPARITY_UPSAMPLING_H__
+#define __STEREO_DISPARITY_UPSAMPLING_H__
+
+#include <opencv2/core/core.hpp>
+
+namespace stereo
+{
+    class ThreadPool;
+
+    /** 
+     * upsample a half resolution disparity image, as computed by libelas
+     * with subsampling, to full resolution with a joint bilateral filter.
+     * Each output pixel is the weighted mean of the valid disparities in
+     * the 3x3 neighbourhood of half resolution pixels, where the weights
+     * depend on the distance and the difference of the guide image at the
+     * output pixel and at the pixel of the disparity. This keeps depth
+     * edges at the edges of the guide image. Pixels without valid
+     * disparities around are invalid (-10, like in libelas).
+     *
+     * @param half_disp disparity image (CV_32FC1) with every second pixel
+     *        of the full resolution image, negative values are invalid
+     * @param guide full resolution grayscale image (CV_8UC1)
+     * @param disp receives the full resolution disparity image
+     * @param pool if given, the rows are split up between the threads of
+     *        the pool
+     * @param sigma_color standard deviation of the guide image differences
+     */
+    void upsampleDisparity( const cv::Mat &half_disp, const cv::Mat &guide, cv::Mat &disp, 
+	    ThreadPool *pool = NULL, float sigma_color = 10.0f );
+}
+
+#endif
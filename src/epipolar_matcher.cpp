@@ -0,0 +1,189 @@
+#include "epipolar_matcher.h"
+#include "thread_pool.h"
+#include "hamming_matcher.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace stereo
+{
+
+static float l2Distance( const float *a, const float *b, int size )
+{
+    int i = 0;
+    float sum = 0;
+#ifdef __SSE2__
+    __m128 acc = _mm_setzero_ps();
+    for( ; i + 4 <= size; i += 4 )
+    {
+	const __m128 d = _mm_sub_ps( _mm_loadu_ps( a + i ), _mm_loadu_ps( b + i ) );
+	acc = _mm_add_ps( acc, _mm_mul_ps( d, d ) );
+    }
+    float parts[4];
+    _mm_storeu_ps( parts, acc );
+    sum = parts[0] + parts[1] + parts[2] + parts[3];
+#endif
+    for( ; i < size; i++ )
+    {
+	const float d = a[i] - b[i];
+	sum += d * d;
+    }
+    return std::sqrt( sum );
+}
+
+EpipolarMatcher::EpipolarMatcher( float max_y_deviation, float max_disparity, float distance_factor )
+    : max_y_deviation( max_y_deviation ), max_disparity( max_disparity ), distance_factor( distance_factor )
+{
+}
+
+void EpipolarMatcher::buildIndex( const std::vector<cv::KeyPoint> &keypoints, RowIndex &index )
+{
+    // counting sort by row, then by x within the rows. The rows start at
+    // the one of the smallest y, rectified keypoints may be above the image.
+    index.first_row = 0;
+    int rows = 0;
+    if( !keypoints.empty() )
+    {
+	int last_row = index.first_row = (int)std::floor( keypoints[0].pt.y );
+	for( size_t i = 1; i < keypoints.size(); i++ )
+	{
+	    const int row = (int)std::floor( keypoints[i].pt.y );
+	    index.first_row = std::min( index.first_row, row );
+	    last_row = std::max( last_row, row );
+	}
+	rows = last_row - index.first_row + 1;
+    }
+
+    index.row_begin.assign( rows + 1, 0 );
+    for( size_t i = 0; i < keypoints.size(); i++ )
+	index.row_begin[(int)std::floor( keypoints[i].pt.y ) - index.first_row + 1]++;
+    for( int r = 0; r < rows; r++ )
+	index.row_begin[r + 1] += index.row_begin[r];
+
+    index.order.resize( keypoints.size() );
+    std::vector<int> fill( index.row_begin.begin(), index.row_begin.end() - 1 );
+    for( size_t i = 0; i < keypoints.size(); i++ )
+	index.order[fill[(int)std::floor( keypoints[i].pt.y ) - index.first_row]++] = i;
+
+    for( int r = 0; r < rows; r++ )
+    {
+	std::sort( index.order.begin() + index.row_begin[r], index.order.begin() + index.row_begin[r + 1],
+		[&]( int a, int b ) { return keypoints[a].pt.x < keypoints[b].pt.x; } );
+    }
+    index.x.resize( keypoints.size() );
+    index.y.resize( keypoints.size() );
+    for( size_t i = 0; i < keypoints.size(); i++ )
+    {
+	index.x[i] = keypoints[index.order[i]].pt.x;
+	index.y[i] = keypoints[index.order[i]].pt.y;
+    }
+}
+
+void EpipolarMatcher::findCandidates( const std::vector<cv::KeyPoint> &query_keypoints, const cv::Mat &query_descriptors,
+	const RowIndex &train_index, const cv::Mat &train_descriptors, bool query_left,
+	std::vector<Candidate> &candidates, ThreadPool *pool ) const
+{
+    const size_t count = query_keypoints.size();
+    candidates.resize( count );
+    const int rows = (int)train_index.row_begin.size() - 1;
+    const int size = query_descriptors.cols;
+    const bool hamming = query_descriptors.depth() == CV_8U;
+    const float max_disp = max_disparity > 0 ? max_disparity : std::numeric_limits<float>::max();
+
+    const size_t chunks = pool ? pool->getNumThreads() : 1;
+    const auto candidateChunk = [&]( size_t chunk )
+    {
+	for( size_t q = count * chunk / chunks; q < count * ( chunk + 1 ) / chunks; q++ )
+	{
+	    Candidate &best = candidates[q];
+	    best.index = -1;
+	    best.distance = best.second_distance = std::numeric_limits<float>::max();
+
+	    // the right feature is left of the left one, by at most max_disp
+	    const cv::Point2f &pt = query_keypoints[q].pt;
+	    const float x_min = query_left ? pt.x - max_disp : pt.x;
+	    const float x_max = query_left ? pt.x : pt.x + max_disp;
+	    const int row_min = std::max( (int)std::floor( pt.y - max_y_deviation ) - train_index.first_row, 0 );
+	    const int row_max = std::min( (int)std::floor( pt.y + max_y_deviation ) - train_index.first_row, rows - 1 );
+	    for( int r = row_min; r <= row_max; r++ )
+	    {
+		const std::vector<float>::const_iterator row_begin = train_index.x.begin() + train_index.row_begin[r];
+		const std::vector<float>::const_iterator row_end = train_index.x.begin() + train_index.row_begin[r + 1];
+		for( std::vector<float>::const_iterator it = std::lower_bound( row_begin, row_end, x_min );
+			it != row_end && *it <= x_max; ++it )
+		{
+		    const size_t i = it - train_index.x.begin();
+		    // the disparity must be positive and the rows within the band
+		    const float disparity = query_left ? pt.x - *it : *it - pt.x;
+		    if( disparity <= 0 || disparity > max_disp
+			    || std::fabs( pt.y - train_index.y[i] ) >= max_y_deviation )
+			continue;
+
+		    const int t = train_index.order[i];
+
+		    const float distance = hamming ?
+			hammingDistance( query_descriptors.ptr<uint8_t>( q ), train_descriptors.ptr<uint8_t>( t ), size ) :
+			l2Distance( query_descriptors.ptr<float>( q ), train_descriptors.ptr<float>( t ), size );
+		    if( distance < best.distance )
+		    {
+			best.second_distance = best.distance;
+			best.distance = distance;
+			best.index = t;
+		    }
+		    else if( distance < best.second_distance )
+			best.second_distance = distance;
+		}
+	    }
+	}
+    };
+
+    if( pool )
+	pool->parallelFor( chunks, candidateChunk );
+    else
+	candidateChunk( 0 );
+}
+
+bool EpipolarMatcher::isDistinct( const Candidate &candidate ) const
+{
+    // a single candidate has second_distance max
+    return distance_factor <= 1 || candidate.distance * distance_factor < candidate.second_distance;
+}
+
+void EpipolarMatcher::match( const std::vector<cv::KeyPoint> &left_keypoints, const cv::Mat &left_descriptors,
+	const std::vector<cv::KeyPoint> &right_keypoints, const cv::Mat &right_descriptors,
+	std::vector<cv::DMatch> &matches, ThreadPool *pool )
+{
+    if( left_descriptors.rows != (int)left_keypoints.size() || right_descriptors.rows != (int)right_keypoints.size() )
+	throw std::runtime_error( "EpipolarMatcher expects a descriptor for each keypoint." );
+    if( left_descriptors.type() != right_descriptors.type() || left_descriptors.cols != right_descriptors.cols
+	    || ( left_descriptors.type() != CV_32FC1 && left_descriptors.type() != CV_8UC1 ) )
+	throw std::runtime_error( "EpipolarMatcher expects float or 8 bit descriptors of the same size left and right." );
+
+    matches.clear();
+    if( left_keypoints.empty() || right_keypoints.empty() )
+	return;
+
+    buildIndex( left_keypoints, left_index );
+    buildIndex( right_keypoints, right_index );
+    findCandidates( left_keypoints, left_descriptors, right_index, right_descriptors, true, left_candidates, pool );
+    findCandidates( right_keypoints, right_descriptors, left_index, left_descriptors, false, right_candidates, pool );
+
+    // the search bands are symmetric, so both directions see the same pairs
+    for( size_t l = 0; l < left_candidates.size(); l++ )
+    {
+	const Candidate &forward = left_candidates[l];
+	if( forward.index < 0 || !isDistinct( forward ) )
+	    continue;
+	const Candidate &backward = right_candidates[forward.index];
+	if( backward.index != (int)l || !isDistinct( backward ) )
+	    continue;
+	matches.push_back( cv::DMatch( l, forward.index, forward.distance ) );
+    }
+}
+
+}
@@ -0,0 +1,84 @@
+#ifndef __STEREO_EPIPOLAR_MATCHER_H__
+#define __STEREO_EPIPOLAR_MATCHER_H__
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace stereo
+{
+
+class ThreadPool;
+
+/**
+ * descriptor matcher for the features of a rectified stereo pair. The
+ * keypoints of both images are bucketed by their row, and each feature is
+ * only compared with the features of the other image which lie within the
+ * epipolar band and the valid disparity range. Instead of comparing all
+ * pairs, each feature is compared with the few candidates of a handful of
+ * rows.
+ *
+ * A match is kept if the features are each other's best candidate (cross
+ * check), and, if a distance factor is set, if the second best candidate of
+ * both is further away by that factor. A feature with a single candidate
+ * passes the factor test.
+ *
+ * Float descriptors (e.g. SURF) are compared with the L2 distance, 8 bit
+ * descriptors with the Hamming distance.
+ */
+class EpipolarMatcher
+{
+public:
+    /**
+     * @param max_y_deviation a match may differ by less than this in y
+     * @param max_disparity largest disparity of a match, 0 for no limit.
+     *        The disparity must always be positive.
+     * @param distance_factor the second best candidate must be further
+     *        away than the best by this factor. Values <= 1 disable the test.
+     */
+    EpipolarMatcher( float max_y_deviation = 5, float max_disparity = 0, float distance_factor = 0 );
+
+    /**
+     * @param matches receives the matches, with the left features as query
+     *        and the right features as train index, ordered by query index
+     * @param pool optional thread pool the left features are distributed on
+     */
+    void match( const std::vector<cv::KeyPoint> &left_keypoints, const cv::Mat &left_descriptors,
+	    const std::vector<cv::KeyPoint> &right_keypoints, const cv::Mat &right_descriptors,
+	    std::vector<cv::DMatch> &matches, ThreadPool *pool = NULL );
+
+private:
+    /// keypoints sorted by row and x, with the first entry of each row
+    struct RowIndex
+    {
+	std::vector<int> order;
+	std::vector<float> x, y;
+	std::vector<int> row_begin;
+	/// row of row_begin[0], the one of the smallest y, which may be negative
+	int first_row;
+    };
+
+    /// best candidate of a feature and the distances of the best two
+    struct Candidate
+    {
+	int index;
+	float distance, second_distance;
+    };
+
+    static void buildIndex( const std::vector<cv::KeyPoint> &keypoints, RowIndex &index );
+
+    void findCandidates( const std::vector<cv::KeyPoint> &query_keypoints, const cv::Mat &query_descriptors,
+	    const RowIndex &train_index, const cv::Mat &train_descriptors, bool query_left,
+	    std::vector<Candidate> &candidates, ThreadPool *pool ) const;
+
+    bool isDistinct( const Candidate &candidate ) const;
+
+    float max_y_deviation, max_disparity, distance_factor;
+
+    RowIndex left_index, right_index;
+    std::vector<Candidate> left_candidates, right_candidates;
+};
+
+}
+
+#endif
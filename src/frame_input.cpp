@@ -0,0 +1,164 @@
+#include "frame_input.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace base::samples::frame;
+
+namespace stereo
+{
+
+// 8 bit fixed-point weights of red, one of the greens and blue, which sum
+// up to 256 with both greens
+static const uint16_t BAYER_R = 77, BAYER_G = 75, BAYER_B = 29;
+
+// weights of the even and odd pixel of the first and second row of a 2x2
+// cell, or false if the mode is not a Bayer mode with known pattern
+static bool getCellWeights( frame_mode_t mode, uint16_t weights[4] )
+{
+    switch( mode )
+    {
+	case MODE_BAYER_RGGB:
+	    weights[0] = BAYER_R; weights[1] = BAYER_G; weights[2] = BAYER_G; weights[3] = BAYER_B;
+	    return true;
+	case MODE_BAYER_GRBG:
+	    weights[0] = BAYER_G; weights[1] = BAYER_R; weights[2] = BAYER_B; weights[3] = BAYER_G;
+	    return true;
+	case MODE_BAYER_BGGR:
+	    weights[0] = BAYER_B; weights[1] = BAYER_G; weights[2] = BAYER_G; weights[3] = BAYER_R;
+	    return true;
+	case MODE_BAYER_GBRG:
+	    weights[0] = BAYER_G; weights[1] = BAYER_B; weights[2] = BAYER_R; weights[3] = BAYER_G;
+	    return true;
+	default:
+	    return false;
+    }
+}
+
+bool isBayerFrame( const Frame &frame )
+{
+    uint16_t weights[4];
+    return getCellWeights( frame.getFrameMode(), weights );
+}
+
+static void bayerRow8( const uint8_t *row0, const uint8_t *row1, int width,
+	const uint16_t w[4], uint8_t *gray )
+{
+    int x = 0;
+#ifdef __SSE2__
+    // the products of a cell sum up to at most 255 * 256, so 16 bits are
+    // enough
+    const __m128i low = _mm_set1_epi16( 0xff );
+    const __m128i round = _mm_set1_epi16( 128 );
+    const __m128i w00 = _mm_set1_epi16( w[0] ), w01 = _mm_set1_epi16( w[1] );
+    const __m128i w10 = _mm_set1_epi16( w[2] ), w11 = _mm_set1_epi16( w[3] );
+    for( ; x + 16 <= width; x += 16 )
+    {
+	__m128i result[2];
+	for( int i = 0; i < 2; i++ )
+	{
+	    const __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( row0 + 2 * x + 16 * i ) );
+	    const __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( row1 + 2 * x + 16 * i ) );
+	    __m128i sum = _mm_add_epi16( round, _mm_mullo_epi16( _mm_and_si128( a, low ), w00 ) );
+	    sum = _mm_add_epi16( sum, _mm_mullo_epi16( _mm_srli_epi16( a, 8 ), w01 ) );
+	    sum = _mm_add_epi16( sum, _mm_mullo_epi16( _mm_and_si128( b, low ), w10 ) );
+	    sum = _mm_add_epi16( sum, _mm_mullo_epi16( _mm_srli_epi16( b, 8 ), w11 ) );
+	    result[i] = _mm_srli_epi16( sum, 8 );
+	}
+	_mm_storeu_si128( reinterpret_cast<__m128i*>( gray + x ), _mm_packus_epi16( result[0], result[1] ) );
+    }
+#endif
+    for( ; x < width; x++ )
+    {
+	gray[x] = ( row0[2 * x] * w[0] + row0[2 * x + 1] * w[1]
+		+ row1[2 * x] * w[2] + row1[2 * x + 1] * w[3] + 128 ) >> 8;
+    }
+}
+
+static void bayerRow16( const uint16_t *row0, const uint16_t *row1, int width,
+	const uint16_t w[4], uint8_t *gray )
+{
+    // weighting and scaling to 8 bit in one step, 8 + 8 bits
+    for( int x = 0; x < width; x++ )
+    {
+	const uint32_t sum = row0[2 * x] * w[0] + row0[2 * x + 1] * w[1]
+	    + row1[2 * x] * w[2] + row1[2 * x + 1] * w[3];
+	gray[x] = std::min( 255u, ( sum + ( 1u << 15 ) ) >> 16 );
+    }
+}
+
+void bayerToHalfGray( const Frame &frame, cv::Mat &gray )
+{
+    uint16_t weights[4];
+    if( !getCellWeights( frame.getFrameMode(), weights ) )
+	throw std::runtime_error( "bayerToHalfGray expects a Bayer frame with known pattern." );
+    const int bytes = frame.getPixelSize();
+    if( bytes != 1 && bytes != 2 )
+	throw std::runtime_error( "bayerToHalfGray expects a Bayer frame with 8 or 16 bit." );
+
+    const int width = frame.getWidth() / 2, height = frame.getHeight() / 2;
+    const size_t row_size = frame.getRowSize();
+    gray.create( height, width, CV_8UC1 );
+    for( int y = 0; y < height; y++ )
+    {
+	const uint8_t *row0 = frame.getImageConstPtr() + 2 * y * row_size;
+	const uint8_t *row1 = row0 + row_size;
+	if( bytes == 1 )
+	    bayerRow8( row0, row1, width, weights, gray.ptr<uint8_t>( y ) );
+	else
+	    bayerRow16( reinterpret_cast<const uint16_t*>( row0 ), reinterpret_cast<const uint16_t*>( row1 ),
+		    width, weights, gray.ptr<uint8_t>( y ) );
+    }
+}
+
+cv::Mat frameToMat( const Frame &frame, cv::Mat &buffer )
+{
+    if( isBayerFrame( frame ) )
+    {
+	bayerToHalfGray( frame, buffer );
+	return buffer;
+    }
+
+    const frame_mode_t mode = frame.getFrameMode();
+    const int channels = mode == MODE_GRAYSCALE ? 1 : 3;
+    if( mode != MODE_GRAYSCALE && mode != MODE_BGR && mode != MODE_RGB )
+	throw std::runtime_error( "frameToMat supports grayscale, BGR, RGB and Bayer frames." );
+    if( frame.getPixelSize() != (uint32_t)channels && frame.getPixelSize() != 2u * channels )
+	throw std::runtime_error( "frameToMat supports frames with 8 or 16 bit per channel." );
+
+    const int depth = frame.getPixelSize() == (uint32_t)channels ? CV_8U : CV_16U;
+    const cv::Mat image( frame.getHeight(), frame.getWidth(), CV_MAKETYPE( depth, channels ),
+	    const_cast<uint8_t*>( frame.getImageConstPtr() ), frame.getRowSize() );
+    if( mode != MODE_RGB )
+	return image;
+
+    // the stereo code expects BGR, and only needs gray
+    cv::cvtColor( image, buffer, cv::COLOR_RGB2GRAY );
+    return buffer;
+}
+
+frame_helper::StereoCalibration getHalfResolutionCalibration( const frame_helper::StereoCalibration &calib )
+{
+    frame_helper::StereoCalibration half = calib;
+    frame_helper::CameraCalibration *cameras[2] = { &half.camLeft, &half.camRight };
+    for( int i = 0; i < 2; i++ )
+    {
+	// the distortion is in normalized coordinates and doesn't change.
+	// The centers of the half resolution pixels are between the full
+	// resolution pixels.
+	frame_helper::CameraCalibration &cam = *cameras[i];
+	cam.fx /= 2;
+	cam.fy /= 2;
+	cam.cx = ( cam.cx - 0.5 ) / 2;
+	cam.cy = ( cam.cy - 0.5 ) / 2;
+	cam.width /= 2;
+	cam.height /= 2;
+    }
+    return half;
+}
+
+}
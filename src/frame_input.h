@@ -0,0 +1,56 @@
+#ifndef __STEREO_FRAME_INPUT_H__
+#define __STEREO_FRAME_INPUT_H__
+
+#include <opencv2/core/core.hpp>
+#include <base/samples/frame/Frame.hpp>
+#include <frame_helper/CalibrationCv.h>
+
+namespace stereo
+{
+    /** @return true for the Bayer modes with a known pattern */
+    bool isBayerFrame( const base::samples::frame::Frame &frame );
+
+    /**
+     * provides the image of a frame in a form DenseStereo and
+     * StereoFeatures accept, copying as little as possible:
+     *
+     * - grayscale and BGR frames (8 or 16 bit) are wrapped in a cv::Mat
+     *   header without copying, the frame must outlive the result
+     * - RGB frames are converted to grayscale into buffer
+     * - Bayer frames are converted to grayscale of half the size into
+     *   buffer with bayerToHalfGray, without demosaicing
+     *
+     * Other modes throw std::runtime_error.
+     *
+     * @param frame input frame
+     * @param buffer buffer for the converted image, kept between calls
+     * @return the image, which shares its data with the frame or buffer
+     */
+    cv::Mat frameToMat( const base::samples::frame::Frame &frame, cv::Mat &buffer );
+
+    /**
+     * luminance of a Bayer mosaic at half resolution: each 2x2 cell, which
+     * holds one red, two green and one blue value, gives one gray pixel
+     * with the weights 0.30, 0.59 (both greens together) and 0.11 in 8 bit
+     * fixed-point. 16 bit mosaics are scaled by 1/256 like in
+     * GaussianFilter. The 8 bit conversion does 16 pixels at a time with
+     * SSE2.
+     *
+     * The gray pixel (u, v) is centered at (2u + 0.5, 2v + 0.5) of the
+     * mosaic, see getHalfResolutionCalibration.
+     *
+     * @param frame Bayer frame (MODE_BAYER_RGGB, _GRBG, _BGGR or _GBRG)
+     * @param gray receives the gray image (CV_8UC1) of half the size
+     */
+    void bayerToHalfGray( const base::samples::frame::Frame &frame, cv::Mat &gray );
+
+    /**
+     * calibration of the half resolution images of bayerToHalfGray, from
+     * the calibration of the full resolution camera. The images given to
+     * setStereoCalibration and StereoFeatures::setCalibration need to be
+     * of half the size then as well.
+     */
+    frame_helper::StereoCalibration getHalfResolutionCalibration( const frame_helper::StereoCalibration &calib );
+}
+
+#endif
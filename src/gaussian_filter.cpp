@@ -0,0 +1,223 @@
+#include "gaussian_filter.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace stereo;
+
+// border handling equivalent to cv::BORDER_REFLECT_101
+static inline int reflect101( int i, int size )
+{
+    if( size == 1 )
+	return 0;
+    while( i < 0 || i >= size )
+    {
+	if( i < 0 )
+	    i = -i;
+	else
+	    i = 2 * size - 2 - i;
+    }
+    return i;
+}
+
+// fixed-point coefficients of cv::cvtColor for BGR to gray, with 14 bits
+static const uint32_t GRAY_B = 1868, GRAY_G = 9617, GRAY_R = 4899;
+
+GaussianFilter::GaussianFilter()
+    : kernel_size( 0 )
+{
+}
+
+void GaussianFilter::setKernelSize( int size )
+{
+    kernel.clear();
+    kernel_size = size;
+    if( size <= 1 )
+	return;
+
+    if( size % 2 == 0 )
+	throw std::runtime_error( "The size of the gaussian kernel needs to be odd." );
+
+    // get the floating point kernel from opencv (sigma derived from the
+    // size) and convert it to 8 bit fixed-point. Any rounding error is put
+    // into the center coefficient, so that the kernel sums up to 256.
+    cv::Mat fkernel = cv::getGaussianKernel( size, 0, CV_64F );
+    int sum = 0;
+    for( int i = 0; i < size; i++ )
+    {
+	kernel.push_back( cvRound( fkernel.at<double>( i ) * 256.0 ) );
+	sum += kernel.back();
+    }
+    kernel[size / 2] += 256 - sum;
+
+    rows.resize( size );
+    ring_rows.assign( size, -1 );
+}
+
+void GaussianFilter::reserve( const cv::Size &size )
+{
+    const int radius = std::max( 0, kernel_size / 2 );
+    line.reserve( size.width + 2 * radius );
+    ring.reserve( size.width * std::max( 1, kernel_size ) );
+}
+
+void GaussianFilter::convertRow( const cv::Mat &src, int y, uint8_t *gray )
+{
+    const int width = src.cols;
+    switch( src.type() )
+    {
+	case CV_8UC1:
+	{
+	    const uint8_t *s = src.ptr<uint8_t>( y );
+	    if( s != gray )
+		memcpy( gray, s, width );
+	    break;
+	}
+	case CV_16UC1:
+	{
+	    // rounded division by 256, which saturates for the top values
+	    const uint16_t *s = src.ptr<uint16_t>( y );
+	    for( int x = 0; x < width; x++ )
+		gray[x] = std::min( 255, ( s[x] + 128 ) >> 8 );
+	    break;
+	}
+	case CV_8UC3:
+	{
+	    const uint8_t *s = src.ptr<uint8_t>( y );
+	    for( int x = 0; x < width; x++, s += 3 )
+		gray[x] = ( s[0] * GRAY_B + s[1] * GRAY_G + s[2] * GRAY_R + ( 1 << 13 ) ) >> 14;
+	    break;
+	}
+	case CV_16UC3:
+	{
+	    // gray conversion and scaling to 8 bit in one step, 14 + 8 bits
+	    const uint16_t *s = src.ptr<uint16_t>( y );
+	    for( int x = 0; x < width; x++, s += 3 )
+		gray[x] = std::min( 255u,
+			( s[0] * GRAY_B + s[1] * GRAY_G + s[2] * GRAY_R + ( 1u << 21 ) ) >> 22 );
+	    break;
+	}
+	default:
+	    throw std::runtime_error( "Unknown format. Cannot convert cv::Mat to grayscale." );
+    }
+}
+
+void GaussianFilter::filterRow( const cv::Mat &src, int y, uint16_t *out )
+{
+    const int width = src.cols;
+    const int radius = kernel_size / 2;
+
+    // gray row with reflected borders, so that the filter loop doesn't need
+    // any border handling
+    uint8_t *l = &line[0];
+    convertRow( src, y, l + radius );
+    for( int i = 1; i <= radius; i++ )
+    {
+	l[radius - i] = l[radius + reflect101( -i, width )];
+	l[radius + width - 1 + i] = l[radius + reflect101( width - 1 + i, width )];
+    }
+
+    // the products are at most 255 * 256, and as the kernel sums up to
+    // 256, the sums fit into 16 bits
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for( ; x + 8 <= width; x += 8 )
+    {
+	__m128i acc = zero;
+	for( int i = 0; i < kernel_size; i++ )
+	{
+	    const __m128i v = _mm_unpacklo_epi8(
+		    _mm_loadl_epi64( reinterpret_cast<const __m128i*>( l + x + i ) ), zero );
+	    acc = _mm_add_epi16( acc, _mm_mullo_epi16( v, _mm_set1_epi16( kernel[i] ) ) );
+	}
+	_mm_storeu_si128( reinterpret_cast<__m128i*>( out + x ), acc );
+    }
+#endif
+    for( ; x < width; x++ )
+    {
+	unsigned int acc = 0;
+	for( int i = 0; i < kernel_size; i++ )
+	    acc += kernel[i] * l[x + i];
+	out[x] = acc;
+    }
+}
+
+void GaussianFilter::apply( const cv::Mat &src, cv::Mat &dst )
+{
+    const int width = src.size().width;
+    const int height = src.size().height;
+    const int radius = kernel_size / 2;
+
+    // dst keeps its buffer (or the view into a larger image) if the size
+    // matches. For in-place filtering src stays valid, as each input row is
+    // read before the output row with the same index is written.
+    dst.create( height, width, CV_8UC1 );
+    if( width == 0 || height == 0 )
+	return;
+
+    if( kernel.empty() )
+    {
+	for( int y = 0; y < height; y++ )
+	    convertRow( src, y, dst.ptr<uint8_t>( y ) );
+	return;
+    }
+
+    line.resize( width + 2 * radius );
+    ring.resize( width * kernel_size );
+    std::fill( ring_rows.begin(), ring_rows.end(), -1 );
+
+    for( int y = 0; y < height; y++ )
+    {
+	// the rows needed for one output row are a contiguous range of at
+	// most kernel_size rows, so their ring slots never collide. Each
+	// input row is converted and filtered only once.
+	for( int i = 0; i < kernel_size; i++ )
+	{
+	    const int r = reflect101( y + i - radius, height );
+	    const int slot = r % kernel_size;
+	    uint16_t *ring_row = &ring[slot * width];
+	    if( ring_rows[slot] != r )
+	    {
+		filterRow( src, r, ring_row );
+		ring_rows[slot] = r;
+	    }
+	    rows[i] = ring_row;
+	}
+
+	uint8_t *d = dst.ptr<uint8_t>( y );
+	int x = 0;
+#ifdef __SSE2__
+	// 16x16 bit products widened to 32 bits from the low and high halves
+	const __m128i round = _mm_set1_epi32( 1 << 15 );
+	for( ; x + 8 <= width; x += 8 )
+	{
+	    __m128i acc_lo = round, acc_hi = round;
+	    for( int i = 0; i < kernel_size; i++ )
+	    {
+		const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( rows[i] + x ) );
+		const __m128i k = _mm_set1_epi16( kernel[i] );
+		const __m128i lo = _mm_mullo_epi16( v, k );
+		const __m128i hi = _mm_mulhi_epu16( v, k );
+		acc_lo = _mm_add_epi32( acc_lo, _mm_unpacklo_epi16( lo, hi ) );
+		acc_hi = _mm_add_epi32( acc_hi, _mm_unpackhi_epi16( lo, hi ) );
+	    }
+	    const __m128i result = _mm_packs_epi32(
+		    _mm_srli_epi32( acc_lo, 16 ), _mm_srli_epi32( acc_hi, 16 ) );
+	    _mm_storel_epi64( reinterpret_cast<__m128i*>( d + x ), _mm_packus_epi16( result, result ) );
+	}
+#endif
+	for( ; x < width; x++ )
+	{
+	    uint32_t acc = 1 << 15;
+	    for( int i = 0; i < kernel_size; i++ )
+		acc += kernel[i] * rows[i][x];
+	    d[x] = acc >> 16;
+	}
+    }
+}
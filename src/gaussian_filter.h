@@ -0,0 +1,75 @@
+#ifndef __STEREO_GAUSSIAN_FILTER_H__
+#define __STEREO_GAUSSIAN_FILTER_H__
+
+#include <vector>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+
+namespace stereo
+{
+
+/**
+ * Conversion to 8 bit grayscale and gaussian blur in a single pass. The
+ * input can be 8 or 16 bit, mono or BGR. The blur uses a separable
+ * fixed-point kernel with reflected borders (like cv::GaussianBlur with
+ * default arguments).
+ *
+ * The image is streamed row by row: each input row is converted to gray and
+ * filtered horizontally into a ring of kernel size rows, from which the
+ * output rows are filtered vertically. Both passes use SSE2 if available.
+ * The converted and intermediate images never exist as a whole, and the
+ * buffers are kept between calls, so processing images of the same width
+ * does not allocate any memory. An instance must not be used from more than
+ * one thread at a time.
+ */
+class GaussianFilter
+{
+public:
+    GaussianFilter();
+
+    /** set the kernel size, which needs to be odd. A size of 0 or 1
+     * disables the filter. The sigma is derived from the size the same way
+     * cv::GaussianBlur does it.
+     */
+    void setKernelSize( int size );
+
+    int getKernelSize() const { return kernel_size; }
+
+    /** allocate the buffers for images of the given size */
+    void reserve( const cv::Size &size );
+
+    /** convert src (CV_8UC1, CV_16UC1, CV_8UC3 or CV_16UC3, colour in BGR
+     * order) to grayscale and blur it into dst (CV_8UC1). The conversion
+     * uses the same coefficients as cv::cvtColor, and 16 bit values are
+     * scaled by 1/256. For CV_8UC1 input, src and dst may be the same
+     * image.
+     */
+    void apply( const cv::Mat &src, cv::Mat &dst );
+
+private:
+    /// convert row y of src to 8 bit grayscale
+    static void convertRow( const cv::Mat &src, int y, uint8_t *gray );
+
+    /// convert row y of src and filter it horizontally into the ring
+    void filterRow( const cv::Mat &src, int y, uint16_t *out );
+
+    int kernel_size;
+
+    /// fixed-point kernel coefficients, which sum up to 256
+    std::vector<uint16_t> kernel;
+
+    /// gray row with the reflected border on both sides
+    std::vector<uint8_t> line;
+
+    /// ring of horizontally filtered rows in 8.8 fixed-point, and the
+    /// image row held by each slot
+    std::vector<uint16_t> ring;
+    std::vector<int> ring_rows;
+
+    /// ring rows contributing to the current output row
+    std::vector<const uint16_t*> rows;
+};
+
+}
+
+#endif
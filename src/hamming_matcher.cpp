@@ -0,0 +1,199 @@
+#include "hamming_matcher.h"
+#include "thread_pool.h"
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace stereo
+{
+
+// number of bits a substring may differ in to be looked up, the number of
+// lookups per substring grows with 16^r
+static const int MAX_SUBSTRING_RADIUS = 2;
+
+static const int BUCKETS = 1 << 16;
+
+int hammingDistance( const uint8_t *a, const uint8_t *b, int size )
+{
+    int i = 0, bits = 0;
+#ifdef __SSE2__
+    // bit counts of the bytes, summed up with the sum of absolute differences
+    const __m128i m1 = _mm_set1_epi8( 0x55 ), m2 = _mm_set1_epi8( 0x33 ), m4 = _mm_set1_epi8( 0x0f );
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for( ; i + 16 <= size; i += 16 )
+    {
+	__m128i x = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( a + i ) ),
+		_mm_loadu_si128( reinterpret_cast<const __m128i*>( b + i ) ) );
+	x = _mm_sub_epi8( x, _mm_and_si128( _mm_srli_epi16( x, 1 ), m1 ) );
+	x = _mm_add_epi8( _mm_and_si128( x, m2 ), _mm_and_si128( _mm_srli_epi16( x, 2 ), m2 ) );
+	x = _mm_and_si128( _mm_add_epi8( x, _mm_srli_epi16( x, 4 ) ), m4 );
+	acc = _mm_add_epi64( acc, _mm_sad_epu8( x, zero ) );
+    }
+    bits = _mm_cvtsi128_si32( acc ) + _mm_cvtsi128_si32( _mm_unpackhi_epi64( acc, acc ) );
+#endif
+    for( ; i + 8 <= size; i += 8 )
+    {
+	uint64_t wa, wb;
+	memcpy( &wa, a + i, 8 );
+	memcpy( &wb, b + i, 8 );
+	bits += __builtin_popcountll( wa ^ wb );
+    }
+    for( ; i < size; i++ )
+	bits += __builtin_popcount( a[i] ^ b[i] );
+    return bits;
+}
+
+// matches of the same distance are ordered by the train index, which is
+// the order a brute force search finds them in
+static bool isBetterMatch( const cv::DMatch &a, const cv::DMatch &b )
+{
+    return a.distance < b.distance || ( a.distance == b.distance && a.trainIdx < b.trainIdx );
+}
+
+// insert a match into the list of the best k, sorted by isBetterMatch
+static void insertMatch( std::vector<cv::DMatch> &result, int k, const cv::DMatch &match )
+{
+    if( (int)result.size() == k && !isBetterMatch( match, result.back() ) )
+	return;
+    std::vector<cv::DMatch>::iterator it = result.end();
+    while( it != result.begin() && isBetterMatch( match, *( it - 1 ) ) )
+	--it;
+    result.insert( it, match );
+    if( (int)result.size() > k )
+	result.pop_back();
+}
+
+static uint16_t getSubstring( const uint8_t *descriptor, int j )
+{
+    uint16_t value;
+    memcpy( &value, descriptor + 2 * j, 2 );
+    return value;
+}
+
+HammingMatcher::HammingMatcher( size_t min_index_size )
+    : min_index_size( min_index_size ), substrings( 0 )
+{
+}
+
+void HammingMatcher::buildIndex( const cv::Mat &train )
+{
+    // counting sort of the train indices by each substring
+    substrings = train.cols / 2;
+    const int count = train.rows;
+    bucket_begin.assign( (size_t)substrings * ( BUCKETS + 1 ), 0 );
+    bucket_items.resize( (size_t)substrings * count );
+    std::vector<uint32_t> fill( BUCKETS );
+    for( int j = 0; j < substrings; j++ )
+    {
+	uint32_t *begin = &bucket_begin[(size_t)j * ( BUCKETS + 1 )];
+	for( int i = 0; i < count; i++ )
+	    begin[getSubstring( train.ptr<uint8_t>( i ), j ) + 1]++;
+	for( int b = 0; b < BUCKETS; b++ )
+	    begin[b + 1] += begin[b];
+
+	std::copy( begin, begin + BUCKETS, fill.begin() );
+	int *items = &bucket_items[(size_t)j * count];
+	for( int i = 0; i < count; i++ )
+	    items[fill[getSubstring( train.ptr<uint8_t>( i ), j )]++] = i;
+    }
+}
+
+void HammingMatcher::searchIndex( const cv::Mat &query, int q, const cv::Mat &train, int k,
+	std::vector<cv::DMatch> &result, std::vector<uint32_t> &visited, uint32_t stamp ) const
+{
+    const uint8_t *descriptor = query.ptr<uint8_t>( q );
+    const int count = train.rows, size = train.cols;
+    const auto visitBucket = [&]( int j, uint16_t key )
+    {
+	const uint32_t *begin = &bucket_begin[(size_t)j * ( BUCKETS + 1 )];
+	const int *items = &bucket_items[(size_t)j * count];
+	for( uint32_t b = begin[key]; b < begin[key + 1]; b++ )
+	{
+	    const int t = items[b];
+	    if( visited[t] == stamp )
+		continue;
+	    visited[t] = stamp;
+	    insertMatch( result, k, cv::DMatch( q, t, hammingDistance( descriptor, train.ptr<uint8_t>( t ), size ) ) );
+	}
+    };
+
+    for( int radius = 0; radius <= MAX_SUBSTRING_RADIUS; radius++ )
+    {
+	for( int j = 0; j < substrings; j++ )
+	{
+	    const uint16_t key = getSubstring( descriptor, j );
+	    if( radius == 0 )
+		visitBucket( j, key );
+	    else if( radius == 1 )
+	    {
+		for( int b = 0; b < 16; b++ )
+		    visitBucket( j, key ^ ( 1 << b ) );
+	    }
+	    else
+	    {
+		for( int b1 = 0; b1 < 16; b1++ )
+		    for( int b2 = b1 + 1; b2 < 16; b2++ )
+			visitBucket( j, key ^ ( 1 << b1 ) ^ ( 1 << b2 ) );
+	    }
+	}
+
+	// all descriptors not seen yet differ in more than radius bits in
+	// each substring
+	if( (int)result.size() == k && result.back().distance < substrings * ( radius + 1 ) )
+	    return;
+    }
+
+    for( int t = 0; t < count; t++ )
+    {
+	if( visited[t] != stamp )
+	    insertMatch( result, k, cv::DMatch( q, t, hammingDistance( descriptor, train.ptr<uint8_t>( t ), size ) ) );
+    }
+}
+
+void HammingMatcher::knnMatch( const cv::Mat &query, const cv::Mat &train,
+	std::vector<std::vector<cv::DMatch> > &matches, int k, ThreadPool *pool )
+{
+    if( query.type() != CV_8UC1 || train.type() != CV_8UC1 || ( query.cols != train.cols && !train.empty() && !query.empty() ) )
+	throw std::runtime_error( "HammingMatcher expects 8 bit descriptors of the same size." );
+
+    matches.resize( query.rows );
+    const int count = train.rows, size = train.cols;
+    // the substrings need an even descriptor size
+    const bool indexed = (size_t)count >= min_index_size && size % 2 == 0 && size > 0;
+    if( indexed )
+	buildIndex( train );
+
+    const size_t chunks = pool ? pool->getNumThreads() : 1;
+    const auto matchChunk = [&]( size_t chunk )
+    {
+	std::vector<uint32_t> visited( indexed ? count : 0, 0 );
+	uint32_t stamp = 0;
+	for( int q = query.rows * chunk / chunks; q < (int)( query.rows * ( chunk + 1 ) / chunks ); q++ )
+	{
+	    std::vector<cv::DMatch> &result = matches[q];
+	    result.clear();
+	    if( k <= 0 )
+		continue;
+	    if( indexed )
+		searchIndex( query, q, train, k, result, visited, ++stamp );
+	    else
+	    {
+		const uint8_t *descriptor = query.ptr<uint8_t>( q );
+		for( int t = 0; t < count; t++ )
+		    insertMatch( result, k, cv::DMatch( q, t, hammingDistance( descriptor, train.ptr<uint8_t>( t ), size ) ) );
+	    }
+	}
+    };
+
+    if( pool )
+	pool->parallelFor( chunks, matchChunk );
+    else
+	matchChunk( 0 );
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef __STEREO_HAMMING_MATCHER_H__
+#define __STEREO_HAMMING_MATCHER_H__
+
+#include <vector>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace stereo
+{
+
+class ThreadPool;
+
+/** @return the number of differing bits of two bit strings of size bytes.
+ * 16 bytes at a time are counted with SSE2.
+ */
+int hammingDistance( const uint8_t *a, const uint8_t *b, int size );
+
+/**
+ * exact k nearest neighbour matcher for binary descriptors (CV_8UC1, one
+ * packed descriptor per row) under the Hamming distance.
+ *
+ * Small train sets are searched brute force. Larger ones are indexed by
+ * multi-index hashing: each descriptor is split into 16 bit substrings,
+ * and each substring is put into a hash table of its own. A query looks up
+ * the buckets of its substrings, and of the substrings which differ by one
+ * and then two bits, and only computes the full distance for the
+ * descriptors found there. Since a descriptor which is not found after
+ * looking up radius r differs by more than r bits in each of the m
+ * substrings, the search stops as soon as the k-th best distance is below
+ * m * ( r + 1 ). If that doesn't happen, the remaining descriptors are
+ * searched brute force, so the result is always the exact one. Matches
+ * of the same distance are ordered by their train index, so the result
+ * doesn't depend on the order the descriptors are visited in. The index
+ * pays off when the k-th neighbour is close, as the best match of a feature
+ * in another view usually is, so mostly for k = 1.
+ */
+class HammingMatcher
+{
+public:
+    /** @param min_index_size train sets of at least this many descriptors
+     *         are indexed, smaller ones are searched brute force
+     */
+    explicit HammingMatcher( size_t min_index_size = 2048 );
+
+    /**
+     * @param matches receives the up to k best train descriptors of each
+     *        query descriptor, with increasing distance
+     * @param pool optional thread pool the queries are distributed on
+     */
+    void knnMatch( const cv::Mat &query, const cv::Mat &train,
+	    std::vector<std::vector<cv::DMatch> > &matches, int k, ThreadPool *pool = NULL );
+
+private:
+    void buildIndex( const cv::Mat &train );
+    void searchIndex( const cv::Mat &query, int q, const cv::Mat &train, int k,
+	    std::vector<cv::DMatch> &result, std::vector<uint32_t> &visited, uint32_t stamp ) const;
+
+    size_t min_index_size;
+
+    /// number of 16 bit substrings of the indexed descriptors
+    int substrings;
+    /// for each substring, the first entry of each of the 65536 buckets in
+    /// bucket_items, and the end
+    std::vector<uint32_t> bucket_begin;
+    /// for each substring, the train indices sorted by bucket
+    std::vector<int> bucket_items;
+};
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include "keypoint_rectifier.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace stereo
+{
+
+KeypointRectifier::KeypointRectifier( int grid_step )
+    : grid_step( std::max( grid_step, 1 ) )
+{
+}
+
+void KeypointRectifier::init( const frame_helper::StereoCalibrationCv &calib, const cv::Size &size )
+{
+    buildTable( calib.camLeft, calib.R1, calib.P1, size, left_table );
+    buildTable( calib.camRight, calib.R2, calib.P2, size, right_table );
+}
+
+void KeypointRectifier::clear()
+{
+    left_table.release();
+    right_table.release();
+}
+
+void KeypointRectifier::buildTable( const frame_helper::CameraCalibrationCv &camera, const cv::Mat &R, const cv::Mat &P,
+	const cv::Size &size, cv::Mat &table ) const
+{
+    // the grid covers the whole image including the last row and column
+    const int columns = ( size.width - 1 ) / grid_step + 2;
+    const int rows = ( size.height - 1 ) / grid_step + 2;
+    cv::Mat points( rows * columns, 1, CV_32FC2 );
+    for( int y = 0; y < rows; y++ )
+	for( int x = 0; x < columns; x++ )
+	    points.at<cv::Point2f>( y * columns + x ) = cv::Point2f( x * grid_step, y * grid_step );
+
+    cv::Mat rectified;
+    cv::undistortPoints( points, rectified, camera.camMatrix, camera.distCoeffs, R, P );
+    table = rectified.reshape( 2, rows );
+}
+
+cv::Point2f KeypointRectifier::rectify( const cv::Point2f &point, bool left ) const
+{
+    const cv::Mat &table = left ? left_table : right_table;
+
+    // cell of the grid and position in the cell, points outside the image
+    // are extrapolated from the border cells
+    const float gx = point.x / grid_step, gy = point.y / grid_step;
+    const int x = std::min( std::max( (int)std::floor( gx ), 0 ), table.cols - 2 );
+    const int y = std::min( std::max( (int)std::floor( gy ), 0 ), table.rows - 2 );
+    const float fx = gx - x, fy = gy - y;
+
+    const cv::Point2f *row0 = table.ptr<cv::Point2f>( y ) + x;
+    const cv::Point2f *row1 = table.ptr<cv::Point2f>( y + 1 ) + x;
+    const cv::Point2f top = row0[0] * ( 1 - fx ) + row0[1] * fx;
+    const cv::Point2f bottom = row1[0] * ( 1 - fx ) + row1[1] * fx;
+    return top * ( 1 - fy ) + bottom * fy;
+}
+
+void KeypointRectifier::rectify( std::vector<cv::KeyPoint> &keypoints, bool left ) const
+{
+    for( size_t i = 0; i < keypoints.size(); i++ )
+	keypoints[i].pt = rectify( keypoints[i].pt, left );
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef __STEREO_KEYPOINT_RECTIFIER_H__
+#define __STEREO_KEYPOINT_RECTIFIER_H__
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+#include <frame_helper/CalibrationCv.h>
+
+namespace stereo
+{
+
+/**
+ * undistorts and rectifies single image coordinates instead of whole
+ * images, for feature based processing which detects on the raw images.
+ *
+ * The rectified position of every grid_step-th pixel is computed once per
+ * calibration with cv::undistortPoints and kept in a lookup table per
+ * camera. The positions in between are interpolated bilinearly, which is
+ * accurate to a small fraction of a pixel for the smooth lens distortion
+ * models of OpenCV.
+ */
+class KeypointRectifier
+{
+public:
+    /** @param grid_step distance in pixels between the lookup table entries */
+    explicit KeypointRectifier( int grid_step = 4 );
+
+    /** compute the lookup tables from the rectification R1, R2 and the
+     * projections P1, P2 of the initialized calibration
+     * @param size size of the raw images
+     */
+    void init( const frame_helper::StereoCalibrationCv &calib, const cv::Size &size );
+
+    /** forget the lookup tables, e.g. when the calibration changes */
+    void clear();
+
+    /** @return true if init has been called since the last clear */
+    bool isInitialized() const { return !left_table.empty(); }
+
+    /** @return the rectified position of a raw image position of the left
+     * or right camera
+     */
+    cv::Point2f rectify( const cv::Point2f &point, bool left ) const;
+
+    /** replace the positions of the keypoints by the rectified ones */
+    void rectify( std::vector<cv::KeyPoint> &keypoints, bool left ) const;
+
+private:
+    void buildTable( const frame_helper::CameraCalibrationCv &camera, const cv::Mat &R, const cv::Mat &P,
+	    const cv::Size &size, cv::Mat &table ) const;
+
+    int grid_step;
+
+    /// rectified positions of the grid points (CV_32FC2)
+    cv::Mat left_table, right_table;
+};
+
+}
+
+#endif
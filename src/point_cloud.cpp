@@ -0,0 +1,209 @@
+#include "point_cloud.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <stdexcept>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+using namespace stereo;
+
+PointCloudConverter::PointCloudConverter()
+{
+    for( int i = 0; i < 16; i++ )
+	q[i] = ( i % 5 == 0 ) ? 1.0f : 0.0f;
+}
+
+void PointCloudConverter::setReprojectionMatrix( const cv::Mat &Q )
+{
+    if( Q.rows != 4 || Q.cols != 4 || Q.type() != CV_64F )
+	throw std::runtime_error( "The reprojection matrix needs to be a 4x4 CV_64F matrix." );
+
+    for( int r = 0; r < 4; r++ )
+	for( int c = 0; c < 4; c++ )
+	    q[r * 4 + c] = Q.at<double>( r, c );
+
+    // depending on the sign of the baseline, Q maps positive disparities to
+    // points behind the camera. Negating the homogeneous coordinate mirrors
+    // them to the front.
+    if( q[3 * 4 + 2] * q[2 * 4 + 3] < 0 )
+    {
+	for( int c = 0; c < 4; c++ )
+	    q[3 * 4 + c] = -q[3 * 4 + c];
+    }
+}
+
+void PointCloudConverter::addPoint( float x, float y, float z, Chunk &chunk ) const
+{
+    if( config.voxel_size <= 0 )
+    {
+	chunk.points.push_back( x );
+	chunk.points.push_back( y );
+	chunk.points.push_back( z );
+	return;
+    }
+
+    // 21 bits per axis, which covers +-2^20 voxels
+    const float inv_size = 1.0f / config.voxel_size;
+    const uint64_t mask = ( 1 << 21 ) - 1;
+    const uint64_t key =
+	( ( (uint64_t)( (int64_t)std::floor( x * inv_size ) + ( 1 << 20 ) ) & mask ) << 42 ) |
+	( ( (uint64_t)( (int64_t)std::floor( y * inv_size ) + ( 1 << 20 ) ) & mask ) << 21 ) |
+	( ( (uint64_t)( (int64_t)std::floor( z * inv_size ) + ( 1 << 20 ) ) & mask ) );
+
+    Voxel &voxel( chunk.voxels[key] );
+    voxel.x += x;
+    voxel.y += y;
+    voxel.z += z;
+    voxel.count++;
+}
+
+void PointCloudConverter::convertRows( const cv::Mat &disp, int row_begin, int row_end, int pixel_scale,
+	Chunk &chunk ) const
+{
+    const int width = disp.cols;
+    const int stride = std::max( 1, (int)config.stride );
+    const float max_dist2 = config.max_distance * config.max_distance;
+
+    for( int y = row_begin; y < row_end; y += stride )
+    {
+	const float *d = disp.ptr<float>( y );
+
+	// contribution of the row and the constant column of Q
+	float row_part[4];
+	for( int r = 0; r < 4; r++ )
+	    row_part[r] = q[r * 4 + 1] * y * pixel_scale + q[r * 4 + 3];
+
+	int x = 0;
+#ifdef __SSE__
+	const __m128 zero4 = _mm_setzero_ps();
+	const __m128 offsets = _mm_set_ps( 3 * stride * pixel_scale, 2 * stride * pixel_scale, 
+		stride * pixel_scale, 0 );
+	const __m128 max_dist4 = _mm_set1_ps( max_dist2 );
+	for( ; x + 3 * stride < width; x += 4 * stride )
+	{
+	    const __m128 xv = _mm_add_ps( _mm_set1_ps( x * pixel_scale ), offsets );
+	    const __m128 dv = stride == 1 ?
+		_mm_loadu_ps( d + x ) :
+		_mm_set_ps( d[x + 3 * stride], d[x + 2 * stride], d[x + stride], d[x] );
+
+	    __m128 p[4];
+	    for( int r = 0; r < 4; r++ )
+		p[r] = _mm_add_ps(
+			_mm_add_ps( _mm_mul_ps( _mm_set1_ps( q[r * 4] ), xv ),
+			    _mm_mul_ps( _mm_set1_ps( q[r * 4 + 2] ), dv ) ),
+			_mm_set1_ps( row_part[r] ) );
+
+	    const __m128 inv_w = _mm_div_ps( _mm_set1_ps( 1.0f ), p[3] );
+	    const __m128 px = _mm_mul_ps( p[0], inv_w );
+	    const __m128 py = _mm_mul_ps( p[1], inv_w );
+	    const __m128 pz = _mm_mul_ps( p[2], inv_w );
+
+	    __m128 valid = _mm_cmpgt_ps( dv, zero4 );
+	    if( max_dist2 > 0 )
+	    {
+		const __m128 dist2 = _mm_add_ps( _mm_add_ps(
+			    _mm_mul_ps( px, px ), _mm_mul_ps( py, py ) ), _mm_mul_ps( pz, pz ) );
+		valid = _mm_and_ps( valid, _mm_cmple_ps( dist2, max_dist4 ) );
+	    }
+
+	    const int valid_mask = _mm_movemask_ps( valid );
+	    if( !valid_mask )
+		continue;
+
+	    float xs[4], ys[4], zs[4];
+	    _mm_storeu_ps( xs, px );
+	    _mm_storeu_ps( ys, py );
+	    _mm_storeu_ps( zs, pz );
+	    for( int i = 0; i < 4; i++ )
+		if( valid_mask & ( 1 << i ) )
+		    addPoint( xs[i], ys[i], zs[i], chunk );
+	}
+#endif
+	for( ; x < width; x += stride )
+	{
+	    if( !( d[x] > 0 ) )
+		continue;
+
+	    float p[4];
+	    for( int r = 0; r < 4; r++ )
+		p[r] = q[r * 4] * x * pixel_scale + q[r * 4 + 2] * d[x] + row_part[r];
+	    const float inv_w = 1.0f / p[3];
+	    const float px = p[0] * inv_w, py = p[1] * inv_w, pz = p[2] * inv_w;
+	    if( max_dist2 > 0 && px * px + py * py + pz * pz > max_dist2 )
+		continue;
+
+	    addPoint( px, py, pz, chunk );
+	}
+    }
+}
+
+void PointCloudConverter::convert( const cv::Mat &disp, base::samples::Pointcloud &cloud, ThreadPool *pool,
+	int pixel_scale )
+{
+    if( disp.type() != CV_32FC1 )
+	throw std::runtime_error( "PointCloudConverter expects CV_32FC1 disparity images." );
+
+    // split the sampled rows evenly between the threads. The chunks keep
+    // their buffers, so the allocations settle after a few frames.
+    const int stride = std::max( 1, (int)config.stride );
+    const int sampled_rows = ( disp.rows + stride - 1 ) / stride;
+    const size_t num_chunks = pool ? pool->getNumThreads() : 1;
+    if( chunks.size() < num_chunks )
+	chunks.resize( num_chunks );
+
+    const auto convertChunk = [&]( size_t i )
+    {
+	Chunk &chunk( chunks[i] );
+	chunk.points.clear();
+	chunk.voxels.clear();
+	const int begin = sampled_rows * i / num_chunks;
+	const int end = sampled_rows * ( i + 1 ) / num_chunks;
+	convertRows( disp, begin * stride, std::min( disp.rows, end * stride ), pixel_scale, chunk );
+    };
+
+    if( pool )
+	pool->parallelFor( num_chunks, convertChunk );
+    else
+	convertChunk( 0 );
+
+    cloud.points.clear();
+    cloud.colors.clear();
+    if( config.voxel_size <= 0 )
+    {
+	size_t count = 0;
+	for( size_t i = 0; i < num_chunks; i++ )
+	    count += chunks[i].points.size() / 3;
+	cloud.points.reserve( count );
+
+	for( size_t i = 0; i < num_chunks; i++ )
+	{
+	    const std::vector<float> &points( chunks[i].points );
+	    for( size_t p = 0; p < points.size(); p += 3 )
+		cloud.points.push_back( base::Vector3d( points[p], points[p + 1], points[p + 2] ) );
+	}
+	return;
+    }
+
+    // voxels at the chunk borders can be in more than one chunk
+    VoxelMap &voxels( chunks[0].voxels );
+    for( size_t i = 1; i < num_chunks; i++ )
+    {
+	for( VoxelMap::const_iterator it = chunks[i].voxels.begin(); it != chunks[i].voxels.end(); ++it )
+	{
+	    Voxel &voxel( voxels[it->first] );
+	    voxel.x += it->second.x;
+	    voxel.y += it->second.y;
+	    voxel.z += it->second.z;
+	    voxel.count += it->second.count;
+	}
+    }
+
+    cloud.points.reserve( voxels.size() );
+    for( VoxelMap::const_iterator it = voxels.begin(); it != voxels.end(); ++it )
+    {
+	const Voxel &voxel( it->second );
+	cloud.points.push_back( base::Vector3d( voxel.x, voxel.y, voxel.z ) / voxel.count );
+    }
+}
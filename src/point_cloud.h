@@ -0,0 +1,87 @@
+#ifndef __STEREO_POINT_CLOUD_H__
+#define __STEREO_POINT_CLOUD_H__
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+#include <base/samples/Pointcloud.hpp>
+#include "dense_stereo_types.h"
+
+namespace stereo
+{
+
+class ThreadPool;
+
+/**
+ * Reprojects disparity images into point clouds with the Q matrix of the
+ * stereo rectification. The points are computed four at a time with SSE,
+ * optionally only for every n-th pixel, and can be reduced to the centroids
+ * of a voxel grid while they are computed, so that the full resolution
+ * point cloud never exists in memory.
+ *
+ * The sign of Q is normalized, so that the points are in front of the left
+ * camera (positive z) and in the unit of the calibration, like the
+ * distance images of DenseStereo.
+ */
+class PointCloudConverter
+{
+public:
+    PointCloudConverter();
+
+    /** set the reprojection matrix (4x4, CV_64F) as given by the stereo
+     * rectification
+     */
+    void setReprojectionMatrix( const cv::Mat &Q );
+
+    void setConfiguration( const PointCloudConfiguration &config ) { this->config = config; }
+
+    const PointCloudConfiguration& getConfiguration() const { return config; }
+
+    /**
+     * reproject a disparity image (CV_32FC1) into a point cloud. Pixels
+     * with a disparity that is not positive are skipped.
+     *
+     * @param disp left disparity image
+     * @param cloud receives the points, previous content is removed
+     * @param pool if given, the rows are split up between its threads
+     * @param pixel_scale distance between the pixels of the disparity
+     *        image in pixels of the calibrated image, 2 for the half
+     *        resolution output of libelas subsampling
+     */
+    void convert( const cv::Mat &disp, base::samples::Pointcloud &cloud, ThreadPool *pool = NULL,
+	    int pixel_scale = 1 );
+
+private:
+    /// sum of the points falling into a voxel
+    struct Voxel
+    {
+	Voxel() : x(0), y(0), z(0), count(0) {}
+	float x, y, z;
+	int count;
+    };
+
+    typedef std::unordered_map<uint64_t, Voxel> VoxelMap;
+
+    /// result of the rows processed by one thread
+    struct Chunk
+    {
+	std::vector<float> points;
+	VoxelMap voxels;
+    };
+
+    void convertRows( const cv::Mat &disp, int row_begin, int row_end, int pixel_scale,
+	    Chunk &chunk ) const;
+    void addPoint( float x, float y, float z, Chunk &chunk ) const;
+
+    PointCloudConfiguration config;
+
+    /// row major reprojection matrix
+    float q[16];
+
+    std::vector<Chunk> chunks;
+};
+
+}
+
+#endif
@@ -0,0 +1,272 @@
+#include "rectification_cache.h"
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace stereo;
+
+// version of the file layout, part of the key
+static const uint32_t CACHE_FORMAT_VERSION = 1;
+
+static const char CACHE_MAGIC[8] = { 'S', 'T', 'R', 'E', 'C', 'T', 'M', 'P' };
+
+// layout of a cache file: the header, Q as 16 doubles, and then the maps
+// of the left and right camera, each map1 (2 x int16) followed by map2
+// (uint16) without padding
+struct CacheFileHeader
+{
+    char magic[8];
+    uint64_t key;
+    int32_t width, height;
+    uint32_t version;
+    uint32_t reserved;
+};
+
+static size_t getMapBytes( int width, int height )
+{
+    return (size_t)width * height * ( 2 * sizeof( int16_t ) + sizeof( uint16_t ) );
+}
+
+static size_t getFileSize( int width, int height )
+{
+    return sizeof( CacheFileHeader ) + 16 * sizeof( double ) + 2 * getMapBytes( width, height );
+}
+
+namespace
+{
+    class Fnv1a
+    {
+    public:
+	Fnv1a() : hash( 14695981039346656037ULL ) {}
+
+	template <class T>
+	void add( const T &value )
+	{
+	    const uint8_t *bytes = reinterpret_cast<const uint8_t*>( &value );
+	    for( size_t i = 0; i < sizeof( T ); i++ )
+	    {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	    }
+	}
+
+	void add( const frame_helper::CameraCalibration &calib )
+	{
+	    add( calib.fx ); add( calib.fy ); add( calib.cx ); add( calib.cy );
+	    add( calib.d0 ); add( calib.d1 ); add( calib.d2 ); add( calib.d3 );
+	    add( calib.width ); add( calib.height );
+	}
+
+	uint64_t hash;
+    };
+
+    // unmaps a cache file when the last map pointing into it is released
+    struct MappedFile
+    {
+	MappedFile( void *data, size_t size ) : data( data ), size( size ) {}
+	~MappedFile() { munmap( data, size ); }
+	void *data;
+	size_t size;
+    };
+}
+
+RectificationCache::RectificationCache()
+    : capacity( 4 )
+{
+}
+
+RectificationCache& RectificationCache::instance()
+{
+    static RectificationCache cache;
+    return cache;
+}
+
+uint64_t RectificationCache::getKey( const frame_helper::StereoCalibration &calib, const cv::Size &size )
+{
+    // the fields are hashed one by one, the structs may contain padding
+    Fnv1a fnv;
+    fnv.add( calib.camLeft );
+    fnv.add( calib.camRight );
+    fnv.add( calib.extrinsic.tx ); fnv.add( calib.extrinsic.ty ); fnv.add( calib.extrinsic.tz );
+    fnv.add( calib.extrinsic.rx ); fnv.add( calib.extrinsic.ry ); fnv.add( calib.extrinsic.rz );
+    fnv.add( (int32_t)size.width );
+    fnv.add( (int32_t)size.height );
+
+    // the fixed-point maps depend on the OpenCV version
+    fnv.add( (int32_t)CV_MAJOR_VERSION );
+    fnv.add( (int32_t)CV_MINOR_VERSION );
+    fnv.add( CACHE_FORMAT_VERSION );
+    return fnv.hash;
+}
+
+std::string RectificationCache::getFileName( uint64_t key, const std::string &directory )
+{
+    std::ostringstream name;
+    name << directory << "/stereo_rectification_" << std::hex << std::setw( 16 ) << std::setfill( '0' )
+	<< key << ".bin";
+    return name.str();
+}
+
+bool RectificationCache::lookup( uint64_t key, const std::string &directory, RectificationMaps &maps )
+{
+    {
+	std::lock_guard<std::mutex> lock( mutex );
+	for( std::list< std::pair<uint64_t, RectificationMaps> >::iterator it = entries.begin();
+		it != entries.end(); ++it )
+	{
+	    if( it->first == key )
+	    {
+		entries.splice( entries.begin(), entries, it );
+		maps = it->second;
+		return true;
+	    }
+	}
+    }
+
+    // the file is loaded without holding the lock, loading the same file
+    // twice does no harm
+    if( directory.empty() || !load( key, getFileName( key, directory ), maps ) )
+	return false;
+
+    std::lock_guard<std::mutex> lock( mutex );
+    insertLocked( key, maps );
+    return true;
+}
+
+void RectificationCache::insert( uint64_t key, const std::string &directory, const RectificationMaps &maps )
+{
+    {
+	std::lock_guard<std::mutex> lock( mutex );
+	insertLocked( key, maps );
+    }
+    if( !directory.empty() )
+	store( key, getFileName( key, directory ), maps );
+}
+
+void RectificationCache::insertLocked( uint64_t key, const RectificationMaps &maps )
+{
+    for( std::list< std::pair<uint64_t, RectificationMaps> >::iterator it = entries.begin();
+	    it != entries.end(); ++it )
+    {
+	if( it->first == key )
+	{
+	    entries.erase( it );
+	    break;
+	}
+    }
+    entries.push_front( std::make_pair( key, maps ) );
+    while( entries.size() > capacity )
+	entries.pop_back();
+}
+
+void RectificationCache::setCapacity( size_t entries )
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    capacity = entries;
+    while( this->entries.size() > capacity )
+	this->entries.pop_back();
+}
+
+void RectificationCache::clear()
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    entries.clear();
+}
+
+bool RectificationCache::load( uint64_t key, const std::string &file_name, RectificationMaps &maps )
+{
+    const int fd = open( file_name.c_str(), O_RDONLY );
+    if( fd < 0 )
+	return false;
+
+    struct stat info;
+    void *data = MAP_FAILED;
+    if( fstat( fd, &info ) == 0 && (size_t)info.st_size >= sizeof( CacheFileHeader ) )
+    {
+	// private mapping, so that writing to the maps can't change the file
+	data = mmap( NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    }
+    // the mapping stays valid after closing the file
+    close( fd );
+    if( data == MAP_FAILED )
+	return false;
+
+    std::shared_ptr<MappedFile> file( new MappedFile( data, info.st_size ) );
+    const CacheFileHeader *header = static_cast<const CacheFileHeader*>( data );
+    if( memcmp( header->magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) ) != 0 || header->key != key
+	    || header->version != CACHE_FORMAT_VERSION || header->width <= 0 || header->height <= 0
+	    || (size_t)info.st_size != getFileSize( header->width, header->height ) )
+	return false;
+
+    // matrix headers pointing into the mapping
+    const int width = header->width, height = header->height;
+    uint8_t *p = static_cast<uint8_t*>( data ) + sizeof( CacheFileHeader );
+    maps.Q = cv::Mat( 4, 4, CV_64F, p );
+    p += 16 * sizeof( double );
+    cv::Mat *map_pairs[2][2] = { { &maps.left_map1, &maps.left_map2 }, { &maps.right_map1, &maps.right_map2 } };
+    for( int i = 0; i < 2; i++ )
+    {
+	*map_pairs[i][0] = cv::Mat( height, width, CV_16SC2, p );
+	p += (size_t)width * height * 2 * sizeof( int16_t );
+	*map_pairs[i][1] = cv::Mat( height, width, CV_16UC1, p );
+	p += (size_t)width * height * sizeof( uint16_t );
+    }
+    maps.storage = file;
+    return true;
+}
+
+void RectificationCache::store( uint64_t key, const std::string &file_name, const RectificationMaps &maps )
+{
+    const cv::Size size = maps.left_map1.size();
+    CacheFileHeader header;
+    memcpy( header.magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) );
+    header.key = key;
+    header.width = size.width;
+    header.height = size.height;
+    header.version = CACHE_FORMAT_VERSION;
+    header.reserved = 0;
+
+    cv::Mat Q;
+    maps.Q.convertTo( Q, CV_64F );
+    if( Q.rows != 4 || Q.cols != 4 || maps.left_map1.type() != CV_16SC2 )
+	return;
+
+    // written under a temporary name and renamed, which replaces the file
+    // atomically. The name is unique per process and call, so instances
+    // storing the same calibration on different threads don't share it,
+    // and O_EXCL makes sure no one else writes to it.
+    static std::atomic<unsigned> tmp_counter( 0 );
+    std::ostringstream tmp_name;
+    tmp_name << file_name << "." << getpid() << "." << tmp_counter++ << ".tmp";
+    const int fd = open( tmp_name.str().c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666 );
+    if( fd < 0 )
+	return;
+    FILE *file = fdopen( fd, "wb" );
+    if( !file )
+    {
+	close( fd );
+	remove( tmp_name.str().c_str() );
+	return;
+    }
+
+    bool ok = fwrite( &header, sizeof( header ), 1, file ) == 1;
+    for( int r = 0; r < 4 && ok; r++ )
+	ok = fwrite( Q.ptr<double>( r ), sizeof( double ), 4, file ) == 4;
+    const cv::Mat *map_list[4] = { &maps.left_map1, &maps.left_map2, &maps.right_map1, &maps.right_map2 };
+    for( int i = 0; i < 4 && ok; i++ )
+    {
+	const size_t row_bytes = size.width * map_list[i]->elemSize();
+	for( int y = 0; y < size.height && ok; y++ )
+	    ok = fwrite( map_list[i]->ptr( y ), 1, row_bytes, file ) == row_bytes;
+    }
+    ok = fclose( file ) == 0 && ok;
+
+    if( !ok || rename( tmp_name.str().c_str(), file_name.c_str() ) != 0 )
+	remove( tmp_name.str().c_str() );
+}
@@ -0,0 +1,96 @@
+#ifndef __STEREO_RECTIFICATION_CACHE_H__
+#define __STEREO_RECTIFICATION_CACHE_H__
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+#include <frame_helper/CalibrationCv.h>
+
+namespace stereo
+{
+
+/**
+ * what DenseStereo needs from the rectification of a calibration: the
+ * fixed-point undistortion and rectification maps (CV_16SC2 and CV_16UC1,
+ * see cv::convertMaps) and the reprojection matrix Q (4x4 CV_64F).
+ */
+struct RectificationMaps
+{
+    cv::Mat left_map1, left_map2, right_map1, right_map2;
+    cv::Mat Q;
+
+    /// keeps the memory mapped file alive if the matrices point into it
+    std::shared_ptr<const void> storage;
+};
+
+/**
+ * Process-wide cache of rectification maps, so that setting the same
+ * calibration again, also from another DenseStereo instance, doesn't
+ * recompute the maps.
+ *
+ * Optionally, the maps are also stored in a directory, one binary file per
+ * calibration, which is memory mapped when it is loaded. A restarted
+ * process then only touches the pages of the maps it actually uses. The
+ * files are written to a temporary name and renamed, so concurrent
+ * processes never see partial files, and files which don't match the
+ * expected layout are ignored. The format depends on the OpenCV version,
+ * which is part of the key.
+ *
+ * All methods are thread-safe.
+ */
+class RectificationCache
+{
+public:
+    /** @return the cache shared by all DenseStereo instances */
+    static RectificationCache& instance();
+
+    /** FNV-1a hash of the calibration, the image size and the format */
+    static uint64_t getKey( const frame_helper::StereoCalibration &calib, const cv::Size &size );
+
+    /**
+     * look up the maps in memory, and if they are not there, in the
+     * directory
+     * @param directory cache directory, empty to only look in memory
+     * @return true if the maps were found
+     */
+    bool lookup( uint64_t key, const std::string &directory, RectificationMaps &maps );
+
+    /**
+     * add the maps to the memory cache, and write them to the directory if
+     * one is given. Failing to write the file is not an error, the maps
+     * are recomputed by the next process then.
+     */
+    void insert( uint64_t key, const std::string &directory, const RectificationMaps &maps );
+
+    /** number of calibrations kept in memory, the least recently used are
+     * dropped first. Defaults to 4.
+     */
+    void setCapacity( size_t entries );
+
+    /** drop all maps from memory, the files are kept */
+    void clear();
+
+    /** @return the name of the cache file of a key in the directory */
+    static std::string getFileName( uint64_t key, const std::string &directory );
+
+private:
+    RectificationCache();
+
+    static bool load( uint64_t key, const std::string &file_name, RectificationMaps &maps );
+    static void store( uint64_t key, const std::string &file_name, const RectificationMaps &maps );
+
+    void insertLocked( uint64_t key, const RectificationMaps &maps );
+
+    std::mutex mutex;
+    size_t capacity;
+
+    /// cached maps, most recently used first
+    std::list< std::pair<uint64_t, RectificationMaps> > entries;
+};
+
+}
+
+#endif
@@ -0,0 +1,214 @@
+#include "sgm_engine.h"
+#include "census.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace stereo;
+
+// path costs of a pixel are stored with a guard element before and after
+// the disparities, which keeps the neighbour access of the path step
+// branch-free
+static const uint8_t PATH_GUARD = 0xff;
+
+// one step along a path: computes the path costs cur of a pixel from its
+// matching costs and the path costs prev of the previous pixel on the path,
+// and writes (init) or adds them to the aggregated costs. Returns the
+// smallest path cost of the pixel.
+static inline uint8_t pathStep( const uint8_t *costs, const uint8_t *prev, uint8_t prev_min,
+	uint8_t *cur, uint16_t *sum, int num_disp, uint8_t p1, uint8_t p2, bool init )
+{
+    const uint8_t jump = std::min( 255, prev_min + p2 );
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i p1v = _mm_set1_epi8( p1 );
+    const __m128i jumpv = _mm_set1_epi8( jump );
+    const __m128i prev_minv = _mm_set1_epi8( prev_min );
+    __m128i minv = _mm_set1_epi8( (char)0xff );
+    for( int d = 0; d < num_disp; d += 16 )
+    {
+	const __m128i p = _mm_loadu_si128( reinterpret_cast<const __m128i*>( prev + d ) );
+	const __m128i pm = _mm_loadu_si128( reinterpret_cast<const __m128i*>( prev + d - 1 ) );
+	const __m128i pp = _mm_loadu_si128( reinterpret_cast<const __m128i*>( prev + d + 1 ) );
+	const __m128i t = _mm_min_epu8( _mm_min_epu8( p, jumpv ),
+		_mm_min_epu8( _mm_adds_epu8( pm, p1v ), _mm_adds_epu8( pp, p1v ) ) );
+	const __m128i lr = _mm_adds_epu8( 
+		_mm_loadu_si128( reinterpret_cast<const __m128i*>( costs + d ) ),
+		_mm_subs_epu8( t, prev_minv ) );
+	_mm_storeu_si128( reinterpret_cast<__m128i*>( cur + d ), lr );
+	minv = _mm_min_epu8( minv, lr );
+
+	__m128i *s = reinterpret_cast<__m128i*>( sum + d );
+	__m128i lo = _mm_unpacklo_epi8( lr, zero ), hi = _mm_unpackhi_epi8( lr, zero );
+	if( !init )
+	{
+	    lo = _mm_add_epi16( lo, _mm_loadu_si128( s ) );
+	    hi = _mm_add_epi16( hi, _mm_loadu_si128( s + 1 ) );
+	}
+	_mm_storeu_si128( s, lo );
+	_mm_storeu_si128( s + 1, hi );
+    }
+    minv = _mm_min_epu8( minv, _mm_srli_si128( minv, 8 ) );
+    minv = _mm_min_epu8( minv, _mm_srli_si128( minv, 4 ) );
+    minv = _mm_min_epu8( minv, _mm_srli_si128( minv, 2 ) );
+    minv = _mm_min_epu8( minv, _mm_srli_si128( minv, 1 ) );
+    return _mm_cvtsi128_si32( minv ) & 0xff;
+#else
+    uint8_t min_cost = 0xff;
+    for( int d = 0; d < num_disp; d++ )
+    {
+	const int t = std::min( std::min<int>( prev[d], jump ), 
+		std::min( prev[d - 1], prev[d + 1] ) + p1 );
+	const uint8_t lr = std::min( 255, costs[d] + t - prev_min );
+	cur[d] = lr;
+	min_cost = std::min( min_cost, lr );
+	sum[d] = init ? lr : sum[d] + lr;
+    }
+    return min_cost;
+#endif
+}
+
+// path costs of the first pixel of a path, which are just its costs
+static void resetPath( uint8_t *path, int num_disp )
+{
+    path[-1] = PATH_GUARD;
+    memset( path, 0, num_disp );
+    path[num_disp] = PATH_GUARD;
+}
+
+SgmEngine::SgmEngine( const SgmConfiguration &config, int disp_min, int disp_max, ThreadPool *pool )
+    : config( config ), disp_min( disp_min ), 
+      num_disp( std::max( 1, disp_max - disp_min + 1 ) ), pool( pool ),
+      width( 0 ), height( 0 )
+{
+    num_disp_padded = ( num_disp + 15 ) / 16 * 16;
+    this->config.p1 = std::min( 255, std::max( 0, (int)config.p1 ) );
+    this->config.p2 = std::min( 255 - CENSUS_BITS, std::max( 0, (int)config.p2 ) );
+}
+
+void SgmEngine::aggregateRows( int begin, int end, std::vector<uint8_t> &scratch )
+{
+    const int nd = num_disp_padded;
+    scratch.resize( std::max( scratch.size(), (size_t)( width * nd + 2 * ( nd + 2 ) ) ) );
+    uint8_t *costs = &scratch[0];
+    uint8_t *path[2] = { costs + width * nd + 1, costs + width * nd + nd + 3 };
+
+    for( int y = begin; y < end; y++ )
+    {
+	// the costs of the row are shared by both directions
+	const uint32_t *left = &left_census[y * width];
+	const uint32_t *right = &right_census[y * width];
+	for( int x = 0; x < width; x++ )
+	{
+	    uint8_t *c = costs + x * nd;
+	    censusCosts( left, right, x, width, disp_min, nd, c );
+	    memset( c + num_disp, CENSUS_BITS, nd - num_disp );
+	}
+
+	uint16_t *sum = &aggregated[(size_t)y * width * nd];
+	for( int dir = 0; dir < 2; dir++ )
+	{
+	    resetPath( path[0], nd );
+	    resetPath( path[1], nd );
+	    uint8_t prev_min = 0;
+	    for( int i = 0; i < width; i++ )
+	    {
+		const int x = dir == 0 ? i : width - 1 - i;
+		prev_min = pathStep( costs + x * nd, path[i & 1], prev_min, path[( i + 1 ) & 1],
+			sum + x * nd, nd, config.p1, config.p2, dir == 0 );
+	    }
+	}
+    }
+}
+
+void SgmEngine::aggregateColumns( int begin, int end, std::vector<uint8_t> &scratch )
+{
+    const int nd = num_disp_padded;
+    const int columns = end - begin;
+    const int stride = nd + 2;
+    scratch.resize( std::max( scratch.size(), (size_t)( columns * nd + 2 * columns * stride + columns ) ) );
+    uint8_t *costs = &scratch[0];
+    uint8_t *paths[2] = { costs + columns * nd + 1, costs + columns * nd + columns * stride + 1 };
+    uint8_t *prev_min = costs + columns * nd + 2 * columns * stride;
+
+    for( int dir = 0; dir < 2; dir++ )
+    {
+	for( int c = 0; c < columns; c++ )
+	{
+	    resetPath( paths[0] + c * stride, nd );
+	    resetPath( paths[1] + c * stride, nd );
+	    prev_min[c] = 0;
+	}
+
+	for( int i = 0; i < height; i++ )
+	{
+	    const int y = dir == 0 ? i : height - 1 - i;
+	    const uint32_t *left = &left_census[y * width];
+	    const uint32_t *right = &right_census[y * width];
+	    uint16_t *sum = &aggregated[( (size_t)y * width + begin ) * nd];
+	    uint8_t *prev = paths[i & 1], *cur = paths[( i + 1 ) & 1];
+	    for( int c = 0; c < columns; c++ )
+	    {
+		censusCosts( left, right, begin + c, width, disp_min, nd, costs + c * nd );
+		memset( costs + c * nd + num_disp, CENSUS_BITS, nd - num_disp );
+		prev_min[c] = pathStep( costs + c * nd, prev + c * stride, prev_min[c], cur + c * stride,
+			sum + c * nd, nd, config.p1, config.p2, false );
+	    }
+	}
+    }
+}
+
+void SgmEngine::process( const uint8_t *left, const uint8_t *right, 
+	float *left_disp, float *right_disp, const int32_t *dims )
+{
+    width = dims[0];
+    height = dims[1];
+    const int stride = dims[2];
+    if( width <= 0 || height <= 0 )
+	return;
+
+    left_census.resize( width * height );
+    right_census.resize( width * height );
+    aggregated.resize( (size_t)width * height * num_disp_padded );
+    censusTransform( left, width, height, stride, &left_census[0], width, pool );
+    censusTransform( right, width, height, stride, &right_census[0], width, pool );
+
+    const size_t chunks = pool ? pool->getNumThreads() : 1;
+    if( scratch.size() < chunks )
+	scratch.resize( chunks );
+
+    // the horizontal paths initialize the aggregated costs, so they need
+    // to be done before the vertical ones
+    const auto forChunks = [&]( int count, void (SgmEngine::*step)( int, int, std::vector<uint8_t>& ) )
+    {
+	const auto chunk = [&]( size_t i )
+	{
+	    const int begin = count * i / chunks, end = count * ( i + 1 ) / chunks;
+	    if( begin < end )
+		(this->*step)( begin, end, scratch[i] );
+	};
+	if( pool )
+	    pool->parallelFor( chunks, chunk );
+	else
+	    chunk( 0 );
+    };
+    forChunks( height, &SgmEngine::aggregateRows );
+    forChunks( width, &SgmEngine::aggregateColumns );
+
+    const auto select = [&]( size_t i )
+    {
+	const int begin = height * i / chunks, end = height * ( i + 1 ) / chunks;
+	for( int y = begin; y < end; y++ )
+	    selectDisparities( &aggregated[(size_t)y * width * num_disp_padded], width, num_disp_padded,
+		    disp_min, num_disp, config.lr_threshold, config.subpixel,
+		    left_disp + (size_t)y * width, right_disp + (size_t)y * width, scratch[i] );
+    };
+    if( pool )
+	pool->parallelFor( chunks, select );
+    else
+	select( 0 );
+}
@@ -0,0 +1,76 @@
+#ifndef __STEREO_SGM_ENGINE_H__
+#define __STEREO_SGM_ENGINE_H__
+
+#include <stddef.h>
+#include <vector>
+#include "disparity_engine.h"
+#include "dense_stereo_types.h"
+
+namespace stereo
+{
+
+class ThreadPool;
+
+/**
+ * Semi-global matching on center-symmetric census costs (see census.h),
+ * aggregated along four paths (left, right, top, bottom).
+ *
+ * Unlike libelas, the amount of work only depends on the image size and the
+ * disparity range, not on the image content, so the runtime is
+ * predictable. The path costs are computed for 16 disparities at a time
+ * with saturating 8 bit SSE2 arithmetic. The horizontal paths are split up
+ * by rows and the vertical paths by columns between the threads of the
+ * pool.
+ *
+ * The aggregated costs of the whole image are kept, which takes
+ * width x height x disparities x 2 bytes. The right disparities are
+ * integer, they are mainly used for the left/right consistency check.
+ */
+class SgmEngine : public DisparityEngine
+{
+public:
+    /**
+     * @param config penalties and post processing
+     * @param disp_min smallest disparity
+     * @param disp_max largest disparity
+     * @param pool if given, the work is split up between its threads
+     */
+    SgmEngine( const SgmConfiguration &config, int disp_min, int disp_max, ThreadPool *pool = NULL );
+
+    virtual void process( const uint8_t *left, const uint8_t *right, 
+	    float *left_disp, float *right_disp, const int32_t *dims );
+
+private:
+    /// path costs of the horizontal paths of the rows [begin, end), which
+    /// initialize the aggregated costs
+    void aggregateRows( int begin, int end, std::vector<uint8_t> &scratch );
+
+    /// path costs of the vertical paths of the columns [begin, end), which
+    /// are added to the aggregated costs
+    void aggregateColumns( int begin, int end, std::vector<uint8_t> &scratch );
+
+    SgmConfiguration config;
+    int disp_min;
+
+    /// number of disparities, and the number rounded up to a multiple of
+    /// 16 which the costs are computed for
+    int num_disp, num_disp_padded;
+
+    ThreadPool *pool;
+
+    /// size of the current images
+    int width, height;
+
+    /// census codes of the images
+    std::vector<uint32_t> left_census, right_census;
+
+    /// aggregated costs of all pixels and disparities
+    std::vector<uint16_t> aggregated;
+
+    /// scratch buffers, one for each thread
+    std::vector< std::vector<uint8_t> > scratch;
+};
+
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include "ransac.hpp"
 #include "psurf.h"
 #include <thread>
+#include <algorithm>
 
 #ifdef OPENCV_HAS_SURF_GPU
 #include <opencv2/gpu/gpu.hpp>
@@ -29,7 +30,8 @@ Eigen::Vector2d cv2eigen( const cv::Point& point )
 
 
 StereoFeatures::StereoFeatures()
-    : dist_left( NULL ), dist_right( NULL )
+    : dist_left( NULL ), dist_right( NULL ),
+    thread_pool( std::min( std::max( std::thread::hardware_concurrency(), 1u ), 8u ) )
 {
     descriptorMatcher = cv::DescriptorMatcher::create("FlannBased");
     initDetector( config.targetNumFeatures );
@@ -40,6 +42,14 @@ StereoFeatures::StereoFeatures()
 void StereoFeatures::setCalibration( const frame_helper::StereoCalibration &calib )
 {
     this->calib.setCalibration( calib );
+    // the rectification is computed again with the next frame
+    this->calib.setImageSize( cv::Size() );
+    keypoint_rectifier.clear();
+}
+
+void StereoFeatures::setNumThreads( size_t num_threads )
+{
+    thread_pool.setNumThreads( std::max( num_threads, (size_t)1 ) );
 }
 
 void StereoFeatures::setDetectorConfiguration( const DetectorConfiguration &detector_config )
@@ -52,12 +62,20 @@ void StereoFeatures::setConfiguration( const FeatureConfiguration &config )
     this->config = config;
     initDetector( config.targetNumFeatures );
 
+    // the distance factor only applies to kNN matching with knn >= 2
+    epipolar_matcher = EpipolarMatcher( config.maxStereoYDeviation, config.maxStereoDisparity,
+	    config.knn > 1 ? config.distanceFactor : 0 );
+
     if( config.descriptorType == stereo::DESCRIPTOR_PSURF )
 	descriptorExtractor = new cv::PSurfDescriptorExtractor(4, 3, false);
 #ifdef OPENCV_HAS_SURF
     else if( config.descriptorType == stereo::DESCRIPTOR_SURF )
 	descriptorExtractor = new cv::SurfDescriptorExtractor(4, 3, false);
 #endif
+    else if( config.descriptorType == stereo::DESCRIPTOR_ORB )
+	descriptorExtractor = new cv::OrbDescriptorExtractor();
+    else if( config.descriptorType == stereo::DESCRIPTOR_BRIEF )
+	descriptorExtractor = new cv::BriefDescriptorExtractor(32);
     else
 	throw std::runtime_error( "Unknown descriptorType" );
 }
@@ -157,6 +175,12 @@ void StereoFeatures::initDetector( size_t lastNumFeatures )
 		detector = new cv::FastFeatureDetector(fastParam);
 	    }
 	    break;
+	case DETECTOR_ORB:
+	    {
+		// int nfeatures, the strongest features are kept
+		detector = new cv::OrbFeatureDetector(targetNumFeatures);
+	    }
+	    break;
 #ifdef OPENCV_HAS_SURF_GPU
         case DETECTOR_SURF_CV_GPU:
             {
@@ -183,70 +207,210 @@ void StereoFeatures::initDetector( size_t lastNumFeatures )
     }
 }
 
-void StereoFeatures::findFeatures_threading( const cv::Mat &image, FeatureInfo& info, bool left_frame, int crop_left, int crop_right )
+// keypoints closer than this, with a similar size, found by different
+// tiles are considered the same feature
+static const float DUPLICATE_RADIUS = 1.0f;
+static const float DUPLICATE_SIZE_RATIO = 0.8f;
+
+// the keypoints are put into a spatial hash of cells of DUPLICATE_RADIUS,
+// so each keypoint is only compared with the keypoints in the neighbouring
+// cells
+void stereo::removeDuplicateKeypoints( std::vector<cv::KeyPoint> &keypoints, std::vector<int> &tile_ids )
 {
-  // parameter for border overlap (to minimize aliasing at borders)
-  int border = 50;
-  int start = crop_left;
-  if(!left_frame)
-    start = crop_right;
-  cv::Mat image_c(image, cv::Rect(start, 0, image.size().width - crop_left - crop_right, image.size().height));
-  // create sub-images
-  cv::Mat sub1( image_c, cv::Rect( 0, 0, image_c.size().width / 2 + border, image_c.size().height / 2 + border ) );
-  cv::Mat sub2( image_c, cv::Rect( image_c.size().width / 2 - border, 0, image_c.size().width / 2 + border, image_c.size().height / 2 + border) );
-  cv::Mat sub3( image_c, cv::Rect( 0, image_c.size().height / 2 - border, image_c.size().width / 2 + border, image_c.size().height / 2 + border) );
-  cv::Mat sub4( image_c, cv::Rect( image_c.size().width / 2 - border, image_c.size().height / 2 - border, image_c.size().width / 2 + border, image_c.size().height / 2 + border) );
-  // create temporary storages
-  FeatureInfo info1, info2, info3, info4;
-
-  // run threads
-  std::thread t1(&StereoFeatures::findFeatures2, this, sub1, std::ref(info1), left_frame, crop_left, crop_right);
-  std::thread t2(&StereoFeatures::findFeatures2, this, sub2, std::ref(info2), left_frame, crop_left, crop_right);
-  std::thread t3(&StereoFeatures::findFeatures2, this, sub3, std::ref(info3), left_frame, crop_left, crop_right);
-  std::thread t4(&StereoFeatures::findFeatures2, this, sub4, std::ref(info4), left_frame, crop_left, crop_right);
-
-  // wait for finishing
-  t1.join();
-  t2.join();
-  t3.join();
-  t4.join();
-
-  // now copy the keypoints from temp storage into return value. For the last 3, add x/y offset.
-  for(size_t i = 0; i < info1.keypoints.size(); ++i)
-  {
-    cv::KeyPoint kp = info1.keypoints[i];
-    kp.pt.x += start;
-    info.keypoints.push_back(kp);
-  }
+    const size_t count = keypoints.size();
+    std::vector<int> order( count );
+    for( size_t i = 0; i < count; i++ )
+	order[i] = i;
+    std::sort( order.begin(), order.end(), [&]( int a, int b ) 
+	    { return keypoints[a].response > keypoints[b].response; } );
+
+    // buckets of the hash table hold lists of kept keypoints, linked by next
+    size_t table_size = 16;
+    while( table_size < 2 * count )
+	table_size *= 2;
+    std::vector<int> buckets( table_size, -1 ), next( count, -1 );
+    const auto bucket = [&]( int cx, int cy ) 
+	{ return ( (size_t)cx * 73856093u ^ (size_t)cy * 19349663u ) & ( table_size - 1 ); };
+
+    std::vector<bool> keep( count, false );
+    for( size_t i = 0; i < count; i++ )
+    {
+	const int k = order[i];
+	const cv::KeyPoint &kp = keypoints[k];
+	const int cx = cvFloor( kp.pt.x / DUPLICATE_RADIUS ), cy = cvFloor( kp.pt.y / DUPLICATE_RADIUS );
+	bool duplicate = false;
+	for( int y = cy - 1; y <= cy + 1 && !duplicate; y++ )
+	{
+	    for( int x = cx - 1; x <= cx + 1 && !duplicate; x++ )
+	    {
+		for( int j = buckets[bucket( x, y )]; j >= 0 && !duplicate; j = next[j] )
+		{
+		    const cv::KeyPoint &other = keypoints[j];
+		    const cv::Point2f d = kp.pt - other.pt;
+		    duplicate = tile_ids[j] != tile_ids[k]
+			&& d.x * d.x + d.y * d.y < DUPLICATE_RADIUS * DUPLICATE_RADIUS
+			&& std::min( kp.size, other.size ) >= DUPLICATE_SIZE_RATIO * std::max( kp.size, other.size );
+		}
+	    }
+	}
+	if( duplicate )
+	    continue;
 
-  for(size_t i = 0; i < info2.keypoints.size(); ++i)
-  {
-    cv::KeyPoint kp = info2.keypoints[i];
-    kp.pt.x += image_c.size().width / 2 - border + start;
-    info.keypoints.push_back(kp);
-  }
+	keep[k] = true;
+	const size_t b = bucket( cx, cy );
+	next[k] = buckets[b];
+	buckets[b] = k;
+    }
 
-  for(size_t i = 0; i < info3.keypoints.size(); ++i)
-  {
-    cv::KeyPoint kp = info3.keypoints[i];
-    kp.pt.x += start;
-    kp.pt.y += image_c.size().height / 2 - border;
-    info.keypoints.push_back(kp);
-  }
+    // compact, keeping the order of the tiles
+    size_t kept = 0;
+    for( size_t i = 0; i < count; i++ )
+    {
+	if( keep[i] )
+	{
+	    keypoints[kept] = keypoints[i];
+	    tile_ids[kept] = tile_ids[i];
+	    kept++;
+	}
+    }
+    keypoints.resize( kept );
+    tile_ids.resize( kept );
+}
 
-  for(size_t i = 0; i < info4.keypoints.size(); ++i)
-  {
-    cv::KeyPoint kp = info4.keypoints[i];
-    kp.pt.x += image_c.size().width / 2 - border + start;
-    kp.pt.y += image_c.size().height / 2 - border;
-    info.keypoints.push_back(kp);
-  }
+// keeps the n strongest keypoints. Unlike cv::KeyPointsFilter::retainBest,
+// which also keeps the ones of the same response as the n-th, these are at
+// most n.
+static void retainStrongest( std::vector<cv::KeyPoint> &keypoints, size_t n )
+{
+    if( keypoints.size() <= n )
+	return;
+    std::nth_element( keypoints.begin(), keypoints.begin() + n, keypoints.end(),
+	    []( const cv::KeyPoint &a, const cv::KeyPoint &b ) { return a.response > b.response; } );
+    keypoints.resize( n );
+}
+
+void StereoFeatures::findFeaturesTiled( const cv::Mat *images[], FeatureInfo *infos[], const bool left_frames[], size_t num_images, int crop_left, int crop_right )
+{
+    // the GPU detector processes whole images
+    if( use_gpu_detector )
+    {
+	for( size_t i = 0; i < num_images; i++ )
+	    findFeatures2( *images[i], *infos[i], left_frames[i], crop_left, crop_right );
+	return;
+    }
+
+    const int columns = std::max( config.tileColumns, 1 ), rows = std::max( config.tileRows, 1 );
+    const int overlap = std::max( config.tileOverlap, 0 );
+    const size_t tiles_per_image = columns * rows;
+    const size_t budget = ( std::max( config.targetNumFeatures, 1 ) + tiles_per_image - 1 ) / tiles_per_image;
+
+    tiles.resize( num_images * tiles_per_image );
+    std::vector<cv::Mat> cropped( num_images );
+    for( size_t i = 0; i < num_images; i++ )
+    {
+	const int start = left_frames[i] ? crop_left : crop_right;
+	cropped[i] = cv::Mat( *images[i], cv::Rect( start, 0, images[i]->cols - crop_left - crop_right, images[i]->rows ) );
+	const int width = cropped[i].cols, height = cropped[i].rows;
+	for( int r = 0; r < rows; r++ )
+	{
+	    for( int c = 0; c < columns; c++ )
+	    {
+		FeatureTile &tile = tiles[i * tiles_per_image + r * columns + c];
+		tile.core = cv::Rect( cv::Point( width * c / columns, height * r / rows ), 
+			cv::Point( width * ( c + 1 ) / columns, height * ( r + 1 ) / rows ) );
+		const cv::Rect extended( cv::Point( std::max( tile.core.x - overlap, 0 ), std::max( tile.core.y - overlap, 0 ) ),
+			cv::Point( std::min( tile.core.br().x + overlap, width ), std::min( tile.core.br().y + overlap, height ) ) );
+		tile.image = cv::Mat( cropped[i], extended );
+		tile.offset = extended.tl();
+		tile.image_index = i;
+	    }
+	}
+    }
 
-  // copy descriptors from temp storage into return value
-  info.descriptors.push_back(info1.descriptors);
-  info.descriptors.push_back(info2.descriptors);
-  info.descriptors.push_back(info3.descriptors);
-  info.descriptors.push_back(info4.descriptors);
+    // detect in all tiles
+    base::Time start = base::Time::now();
+    thread_pool.parallelFor( tiles.size(), [&]( size_t t )
+    {
+	FeatureTile &tile = tiles[t];
+	detector->detect( tile.image, tile.keypoints );
+	for( size_t j = 0; j < tile.keypoints.size(); j++ )
+	    tile.keypoints[j].pt += tile.offset;
+    });
+    const base::Time detector_time = base::Time::now() - start;
+
+    // remove the features found twice in the overlaps, and hand the others
+    // to the tile whose core contains them
+    std::vector<cv::KeyPoint> keypoints;
+    std::vector<int> tile_ids;
+    for( size_t i = 0; i < num_images; i++ )
+    {
+	keypoints.clear();
+	tile_ids.clear();
+	for( size_t t = i * tiles_per_image; t < ( i + 1 ) * tiles_per_image; t++ )
+	{
+	    keypoints.insert( keypoints.end(), tiles[t].keypoints.begin(), tiles[t].keypoints.end() );
+	    tile_ids.insert( tile_ids.end(), tiles[t].keypoints.size(), t );
+	    tiles[t].keypoints.clear();
+	}
+	if( overlap > 0 )
+	    removeDuplicateKeypoints( keypoints, tile_ids );
+
+	const int width = cropped[i].cols, height = cropped[i].rows;
+	for( size_t j = 0; j < keypoints.size(); j++ )
+	{
+	    const cv::Point2f &pt = keypoints[j].pt;
+	    const int c = std::min( std::max( (int)( pt.x * columns / width ), 0 ), columns - 1 );
+	    const int r = std::min( std::max( (int)( pt.y * rows / height ), 0 ), rows - 1 );
+	    // the grid cell is a guess because of rounding, the core decides
+	    size_t t = i * tiles_per_image + r * columns + c;
+	    if( !tiles[t].core.contains( cv::Point( pt.x, pt.y ) ) )
+		t = tile_ids[j];
+	    tiles[t].keypoints.push_back( keypoints[j] );
+	    tiles[t].keypoints.back().pt -= tiles[t].offset;
+	}
+    }
+
+    // keep the strongest features each tile owns, and describe each
+    // feature once, in the tile which owns it
+    start = base::Time::now();
+    thread_pool.parallelFor( tiles.size(), [&]( size_t t )
+    {
+	FeatureTile &tile = tiles[t];
+	if( config.tileFeatureBudget )
+	    retainStrongest( tile.keypoints, budget );
+	tile.descriptors.release();
+	if( !tile.keypoints.empty() )
+	    descriptorExtractor->compute( tile.image, tile.keypoints, tile.descriptors );
+    });
+    const base::Time descriptor_time = base::Time::now() - start;
+
+    for( size_t i = 0; i < num_images; i++ )
+    {
+	FeatureInfo &info = *infos[i];
+	const float start_x = left_frames[i] ? crop_left : crop_right;
+	for( size_t t = i * tiles_per_image; t < ( i + 1 ) * tiles_per_image; t++ )
+	{
+	    const FeatureTile &tile = tiles[t];
+	    for( size_t j = 0; j < tile.keypoints.size(); j++ )
+	    {
+		cv::KeyPoint kp = tile.keypoints[j];
+		kp.pt += tile.offset + cv::Point2f( start_x, 0 );
+		info.keypoints.push_back( kp );
+	    }
+	    if( !tile.keypoints.empty() )
+		info.descriptors.push_back( tile.descriptors );
+	}
+	info.detectorTime = detector_time;
+	info.descriptorTime = descriptor_time;
+    }
+}
+
+void StereoFeatures::findFeatures_threading( const cv::Mat &image, FeatureInfo& info, bool left_frame, int crop_left, int crop_right )
+{
+    const cv::Mat *images[1] = { &image };
+    FeatureInfo *infos[1] = { &info };
+    const bool left_frames[1] = { left_frame };
+    findFeaturesTiled( images, infos, left_frames, 1, crop_left, crop_right );
 }
 
 
@@ -331,6 +495,11 @@ void StereoFeatures::processFramePair( const cv::Mat &left_image, const cv::Mat
     calculateDepthInformationBetweenCorrespondences(stereo_features);
 }
 
+void StereoFeatures::processFramePair( const base::samples::frame::Frame &left_frame, const base::samples::frame::Frame &right_frame, StereoFeatureArray *stereo_features )
+{
+    processFramePair( frameToMat( left_frame, left_frame_buffer ), frameToMat( right_frame, right_frame_buffer ), stereo_features );
+}
+
 void StereoFeatures::findFeatures( const cv::Mat &leftImage, const cv::Mat &rightImage, int use_threading, int crop_left, int crop_right )
 {
     // initialize the calibration structure
@@ -340,7 +509,10 @@ void StereoFeatures::findFeatures( const cv::Mat &leftImage, const cv::Mat &righ
     {
 	calib.setImageSize( imageSize );
 	calib.initCv();
+	keypoint_rectifier.clear();
     }
+    if( config.rectifyKeypoints && !keypoint_rectifier.isInitialized() )
+	keypoint_rectifier.init( calib, imageSize );
 
     // this is the right time to set the distance images
     // in the extractor if they are available, then run
@@ -350,46 +522,66 @@ void StereoFeatures::findFeatures( const cv::Mat &leftImage, const cv::Mat &righ
     if( dist_left && psurf )
 	psurf->setDistanceImage( dist_left );
 
-    std::thread *t1 = NULL, *t2 = NULL;
     leftFeatures.keypoints.clear();
     rightFeatures.keypoints.clear();
+    leftFeatures.descriptors.release();
+    rightFeatures.descriptors.release();
 
-    switch(use_threading)
+    if( use_threading > 0 && ( dist_left || dist_right ) && psurf )
     {
-      case 2: // use internal and external threading (e.g. one thread per stereo image and four threads per individual image = 8 threads)
-        t1 = new std::thread(&StereoFeatures::findFeatures_threading, this, leftImage, std::ref(leftFeatures), true, crop_left, crop_right);
-        break;
-      case 1: // only use external threading (e.g. one thread per stereo image = 2 threads
-        t1 = new std::thread(&StereoFeatures::findFeatures2, this, leftImage, std::ref(leftFeatures), true, crop_left, crop_right);
-        break;
-      default: // use no threading
-        findFeatures2( leftImage, leftFeatures, true, crop_left, crop_right );
-        break;
+	// the extractor holds the distance image of one image, so the images
+	// are processed one after another. The tiles of an image may still
+	// run in parallel.
+	for( int i = 0; i < 2; i++ )
+	{
+	    const bool left_frame = i == 0;
+	    const base::samples::DistanceImage *dist = left_frame ? dist_left : dist_right;
+	    if( dist && !left_frame )
+		psurf->setDistanceImage( dist );
+	    const cv::Mat &image = left_frame ? leftImage : rightImage;
+	    FeatureInfo &info = left_frame ? leftFeatures : rightFeatures;
+	    if( use_threading == 2 )
+		findFeatures_threading( image, info, left_frame, crop_left, crop_right );
+	    else
+		findFeatures2( image, info, left_frame, crop_left, crop_right );
+	}
     }
-
-    if( dist_right && psurf ) 
-	psurf->setDistanceImage( dist_right );
-
-    switch(use_threading)
+    else
     {
-      case 2: // use internal and external threading (e.g. one thread per stereo image and four threads per individual image = 8 threads)
-        t2 = new std::thread(&StereoFeatures::findFeatures_threading, this, rightImage, std::ref(rightFeatures), false, crop_left, crop_right);
-        break;
-      case 1: // only use external threading (e.g. one thread per stereo image = 2 threads
-        t2 = new std::thread(&StereoFeatures::findFeatures2, this, rightImage, std::ref(rightFeatures), false, crop_left, crop_right);
-        break;
-      default: // use no threading
-        findFeatures2( rightImage, rightFeatures, false, crop_left, crop_right );
-        break;
+	switch(use_threading)
+	{
+	  case 2: // use internal and external threading (one task per tile of each image, see FeatureConfiguration::tileColumns)
+	    {
+	      const cv::Mat *images[2] = { &leftImage, &rightImage };
+	      FeatureInfo *infos[2] = { &leftFeatures, &rightFeatures };
+	      const bool left_frames[2] = { true, false };
+	      findFeaturesTiled( images, infos, left_frames, 2, crop_left, crop_right );
+	    }
+	    break;
+	  case 1: // only use external threading (e.g. one task per stereo image = 2 tasks)
+	    thread_pool.parallelFor( 2, [&]( size_t i )
+	    {
+	      if( i == 0 )
+		findFeatures2( leftImage, leftFeatures, true, crop_left, crop_right );
+	      else
+		findFeatures2( rightImage, rightFeatures, false, crop_left, crop_right );
+	    });
+	    break;
+	  default: // use no threading
+	    findFeatures2( leftImage, leftFeatures, true, crop_left, crop_right );
+	    if( dist_right && psurf ) 
+		psurf->setDistanceImage( dist_right );
+	    findFeatures2( rightImage, rightFeatures, false, crop_left, crop_right );
+	    break;
+	}
     }
 
-    if(use_threading > 0)
+    // everything after the detection, the stereo matching and filtering
+    // and the triangulation, expects rectified positions
+    if( config.rectifyKeypoints )
     {
-      t1->join();
-      t2->join();
-
-      delete t1;
-      delete t2;
+	keypoint_rectifier.rectify( leftFeatures.keypoints, true );
+	keypoint_rectifier.rectify( rightFeatures.keypoints, false );
     }
 
     if( config.adaptiveDetectorParam )
@@ -444,8 +636,17 @@ bool robustMatch( std::vector<cv::DMatch>& matches, float distanceFactor = 2.0 )
 void StereoFeatures::crossCheckMatching( const cv::Mat& descriptors1, const cv::Mat& descriptors2, std::vector<cv::DMatch>& filteredMatches12, int knn, float distanceFactor )
 {
   std::vector<std::vector<cv::DMatch> > matches12, matches21;
-  descriptorMatcher->knnMatch( descriptors1, descriptors2, matches12, knn );
-  descriptorMatcher->knnMatch( descriptors2, descriptors1, matches21, knn );
+  if( descriptors1.depth() == CV_8U )
+  {
+    // binary descriptors, which the kd-trees of FLANN can't index
+    hamming_matcher.knnMatch( descriptors1, descriptors2, matches12, knn, &thread_pool );
+    hamming_matcher.knnMatch( descriptors2, descriptors1, matches21, knn, &thread_pool );
+  }
+  else
+  {
+    descriptorMatcher->knnMatch( descriptors1, descriptors2, matches12, knn );
+    descriptorMatcher->knnMatch( descriptors2, descriptors1, matches21, knn );
+  }
   crossCheckMatching(matches12, matches21, filteredMatches12, knn, distanceFactor);
 }
 
@@ -494,8 +695,18 @@ bool StereoFeatures::getPutativeStereoCorrespondences()
     // is unavailable
     if(!use_gpu_detector)
     {
-        // do good cross check matching
-        crossCheckMatching( leftFeatures.descriptors, rightFeatures.descriptors, stereoCorrespondences, config.knn, config.distanceFactor);
+        if( config.filterType == FILTER_STEREO )
+        {
+            // only match features which can pass the stereo filter, all
+            // others would be dropped by refineFeatureCorrespondences
+            epipolar_matcher.match( leftFeatures.keypoints, leftFeatures.descriptors,
+                    rightFeatures.keypoints, rightFeatures.descriptors, stereoCorrespondences, &thread_pool );
+        }
+        else
+        {
+            // do good cross check matching
+            crossCheckMatching( leftFeatures.descriptors, rightFeatures.descriptors, stereoCorrespondences, config.knn, config.distanceFactor);
+        }
     }
 #ifdef OPENCV_HAS_SURF_GPU
     else
@@ -621,7 +832,8 @@ bool StereoFeatures::refineFeatureCorrespondences()
             {
 		const double ydev = fabs( leftPutativeMatches.keypoints[i].pt.y - rightPutativeMatches.keypoints[i].pt.y );
 		const double disparity = leftPutativeMatches.keypoints[i].pt.x - rightPutativeMatches.keypoints[i].pt.x;
-                if( ydev < config.maxStereoYDeviation && disparity > 0 )
+                if( ydev < config.maxStereoYDeviation && disparity > 0
+                        && ( config.maxStereoDisparity <= 0 || disparity <= config.maxStereoDisparity ) )
                 {
                     matchesMask[i] = 1;
                     numberOfGood++;
@@ -704,8 +916,8 @@ void StereoFeatures::calculateDepthInformationBetweenCorrespondences(StereoFeatu
 
     stereo_feature_pointer->clear();
 
-    // currently we always use the surf descriptor (might change)
-    stereo_feature_pointer->descriptorType = stereo::DESCRIPTOR_SURF;
+    stereo_feature_pointer->descriptorType = config.descriptorType;
+    const bool binary = isBinaryDescriptor( config.descriptorType );
 
     // get Q Projection Matrix as Eigen
     Eigen::Matrix4d Q;
@@ -741,10 +953,15 @@ void StereoFeatures::calculateDepthInformationBetweenCorrespondences(StereoFeatu
 	kp.response = leftMatches.keypoints[i].response;
 	kp.pt = leftMatches.keypoints[i].pt ;
 
-	stereo_feature_pointer->push_back( 
-		vh.head<3>(), kp, 
-		Eigen::Map<StereoFeatureArray::Descriptor>( 
-		    leftMatches.descriptors.ptr<float>(i), leftMatches.descriptors.cols ) );
+	if( binary )
+	    stereo_feature_pointer->push_back( 
+		    vh.head<3>(), kp, 
+		    leftMatches.descriptors.ptr<uint8_t>(i), leftMatches.descriptors.cols );
+	else
+	    stereo_feature_pointer->push_back( 
+		    vh.head<3>(), kp, 
+		    Eigen::Map<StereoFeatureArray::Descriptor>( 
+			leftMatches.descriptors.ptr<float>(i), leftMatches.descriptors.cols ) );
         // keep a running average of the mean z position
         stereo_feature_pointer->mean_z_value += vh[2];
     }
@@ -755,12 +972,10 @@ std::cout << "****************************************** mean_z: " << stereo_fea
 
 void StereoFeatures::calculateInterFrameCorrespondences( const StereoFeatureArray& frame1, const StereoFeatureArray& frame2, int filterMethod )
 {
-    // get features as cv::Mat from arrays
-    // need to const cast here, as opencv doesn't provide a way to supply a const void *
-    const cv::Mat feat1 = 
-	cv::Mat( frame1.size(), frame1.descriptorSize, cv::DataType<float>::type, const_cast<float*>(&frame1.descriptors[0]) ); 
-    const cv::Mat feat2 = 
-	cv::Mat( frame2.size(), frame2.descriptorSize, cv::DataType<float>::type, const_cast<float*>(&frame2.descriptors[0]) ); 
+    // get features as cv::Mat from arrays, float or packed binary
+    // descriptors depending on the descriptor type
+    const cv::Mat feat1 = frame1.getDescriptorMatrix();
+    const cv::Mat feat2 = frame2.getDescriptorMatrix();
 
     std::vector<Eigen::Vector3d> p1, p2;
     std::copy( frame1.points.begin(), frame1.points.end(), std::back_inserter( p1 ) );
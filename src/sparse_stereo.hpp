@@ -3,6 +3,11 @@
 
 #include <stereo/config.h>
 #include <stereo/sparse_stereo_types.h>
+#include <stereo/frame_input.h>
+#include <stereo/thread_pool.h>
+#include <stereo/epipolar_matcher.h>
+#include <stereo/keypoint_rectifier.h>
+#include <stereo/hamming_matcher.h>
 #include <frame_helper/CalibrationCv.h>
 #include <base/Time.hpp>
 #include <base/Eigen.hpp>
@@ -26,6 +31,19 @@ struct FeatureInfo
   cv::Mat descriptors;
 };
 
+/** removes the keypoints which were found by more than one tile of
+ * StereoFeatures' tiled detection, keeping the one with the strongest
+ * response. Keypoints of different tiles are the same feature if they are
+ * less than a pixel apart and have similar sizes. Keypoints of the same
+ * tile are always kept.
+ *
+ * @param keypoints keypoints of all tiles of an image, with positions in
+ *        the coordinates of the image
+ * @param tile_ids the tile each keypoint was found in, kept in sync with
+ *        keypoints
+ */
+void removeDuplicateKeypoints( std::vector<cv::KeyPoint> &keypoints, std::vector<int> &tile_ids );
+
 class StereoFeatures
 {
 public:
@@ -44,6 +62,18 @@ public:
      */
     void setDetectorConfiguration( const DetectorConfiguration &detector_config );
 
+    /** Set the number of threads findFeatures runs the detection and
+     * description on. The threads are started once and kept, so the
+     * frames don't pay for starting threads. Defaults to the number of
+     * CPUs, at most 8, which is the number of tasks with use_threading 2.
+     */
+    void setNumThreads( size_t num_threads );
+
+    /** pin the worker threads to the given CPUs, see
+     * ThreadPool::setAffinity
+     */
+    void setThreadAffinity( const std::vector<int> &cpus ) { thread_pool.setAffinity( cpus ); }
+
     /** optionally set the distance images before each call to process frame 
      * pair, in order to perform a perspective undistort of the features
      * before running the descriptor.
@@ -61,6 +91,13 @@ public:
      * storage, but in the storage provided.
      */
     void processFramePair( const cv::Mat &left_image, const cv::Mat &right_image, StereoFeatureArray *stereo_features = NULL );
+
+    /** processFramePair for frames as delivered by the camera drivers,
+     * without copying grayscale and BGR frames. Bayer frames are converted
+     * to gray of half the size, which needs the calibration of
+     * getHalfResolutionCalibration. See frameToMat.
+     */
+    void processFramePair( const base::samples::frame::Frame &left_frame, const base::samples::frame::Frame &right_frame, StereoFeatureArray *stereo_features = NULL );
      
     /** Get the result of the last stereo image processing step.
      */
@@ -74,6 +111,15 @@ public:
      */
     FeatureInfo& getFeatureInfoRight() { return rightFeatures; }
 
+    /** Get the left features of the stereo matches of the last frame pair,
+     * the i-th one matching the i-th feature of getMatchesRight.
+     */
+    FeatureInfo& getMatchesLeft() { return leftMatches; }
+
+    /** Get the right features of the stereo matches of the last frame pair
+     */
+    FeatureInfo& getMatchesRight() { return rightMatches; }
+
     /** calculate the relation between two stereo pairs
      */
     void calculateInterFrameCorrespondences( const StereoFeatureArray& frame1, const StereoFeatureArray& frame2, int filterMethod );
@@ -107,7 +153,9 @@ public:
     cv::Mat getInterFrameDebugImage( const cv::Mat& debug1, const StereoFeatureArray& frame1, const cv::Mat& debug2, const StereoFeatureArray& frame2 , std::vector<std::pair<long,long> > *correspondence = NULL);
 
 public:
-    // use threading parameter: 0 for no threads, 1 for 2 threads (one per image), 2 for 8 threads (4 per image).
+    // use threading parameter: 0 for no threads, 1 for 2 tasks (one per image), 2 for one task per tile of each image
+    // (see FeatureConfiguration::tileColumns).
+    // The tasks run on the threads set with setNumThreads.
     void findFeatures( const cv::Mat &left_image, const cv::Mat &right_image, int use_threading = 1, int crop_left = 0, int crop_right = 0); 
     bool getPutativeStereoCorrespondences();
     bool refineFeatureCorrespondences();
@@ -123,6 +171,27 @@ protected:
     void findFeatures2( const cv::Mat &image, FeatureInfo& info, bool left_frame = true, int crop_left = 0, int crop_right = 0 );
     void findFeatures_threading( const cv::Mat &image, FeatureInfo& info, bool left_frame = true, int crop_left = 0, int crop_right = 0);
 
+    /** detects the features of the images in tiles as configured in
+     * FeatureConfiguration, all tiles in parallel. Features found in the
+     * overlap of two tiles are removed before the descriptors are computed.
+     */
+    void findFeaturesTiled( const cv::Mat *images[], FeatureInfo *infos[], const bool left_frames[], size_t num_images, int crop_left, int crop_right );
+
+    /** a tile of an image as processed by findFeaturesTiled */
+    struct FeatureTile
+    {
+	/// the tile including the overlap
+	cv::Mat image;
+	/// position of the tile in the cropped image
+	cv::Point2f offset;
+	/// part of the cropped image the tile describes the features of
+	cv::Rect core;
+	size_t image_index;
+	std::vector<cv::KeyPoint> keypoints;
+	cv::Mat descriptors;
+    };
+    std::vector<FeatureTile> tiles;
+
     void crossCheckMatching( std::vector<std::vector<cv::DMatch> > matches12, std::vector<std::vector<cv::DMatch> > matches21, std::vector<cv::DMatch>& filteredMatches12, int knn = 1, float distanceFactor = 2.0);
 
     frame_helper::StereoCalibrationCv calib;
@@ -143,9 +212,23 @@ protected:
  
     cv::Mat homography;
 
+    cv::Mat left_frame_buffer, right_frame_buffer;
+
     cv::Mat debugImage;
     int debugRightOffset;
     const base::samples::DistanceImage *dist_left, *dist_right;
+
+    ///persistent worker threads of findFeatures
+    ThreadPool thread_pool;
+
+    ///matcher of the stereo features with FILTER_STEREO
+    EpipolarMatcher epipolar_matcher;
+
+    ///rectification of the keypoints with rectifyKeypoints
+    KeypointRectifier keypoint_rectifier;
+
+    ///matcher of crossCheckMatching for binary descriptors
+    HammingMatcher hamming_matcher;
     bool use_gpu_detector;
     cv::gpu::GpuMat descriptors_gpu_left;
     cv::gpu::GpuMat descriptors_gpu_right;
@@ -3,6 +3,7 @@
 
 #include <base/Eigen.hpp>
 #include <vector>
+#include <string>
 #include <base/Time.hpp>
 #include <opencv2/opencv.hpp>
 #include "store_vector.hpp"
@@ -19,6 +20,7 @@ enum DETECTOR
     DETECTOR_SIFT = 6,
     DETECTOR_FAST = 7,
     DETECTOR_SURF_CV_GPU = 8,
+    DETECTOR_ORB = 9,
 };
 
 enum FILTER
@@ -35,8 +37,18 @@ enum DESCRIPTOR
 {
     DESCRIPTOR_SURF = 1,
     DESCRIPTOR_PSURF = 2,
+    DESCRIPTOR_ORB = 3,
+    DESCRIPTOR_BRIEF = 4,
 };
 
+/** @return true for the descriptors which are packed bit strings and are
+ * compared with the Hamming distance
+ */
+inline bool isBinaryDescriptor( DESCRIPTOR type )
+{
+    return type == DESCRIPTOR_ORB || type == DESCRIPTOR_BRIEF;
+}
+
 
 struct DetectorConfiguration
 {
@@ -61,11 +73,17 @@ struct FeatureConfiguration
     : debugImage( true ),
       targetNumFeatures( 100 ),
       maxStereoYDeviation( 5 ),
+      maxStereoDisparity( 0 ),
       knn( 1 ),
       distanceFactor( 2.0 ),
       isometryFilterMaxSteps( 1000 ),
       isometryFilterThreshold( 0.1 ),
       adaptiveDetectorParam( false ),
+      tileColumns( 2 ),
+      tileRows( 2 ),
+      tileOverlap( 50 ),
+      tileFeatureBudget( false ),
+      rectifyKeypoints( false ),
       descriptorType( DESCRIPTOR_SURF ),
       detectorType( DETECTOR_SURF ),
       filterType( FILTER_STEREO )
@@ -85,6 +103,11 @@ struct FeatureConfiguration
      */
     int maxStereoYDeviation;
 
+    /** the largest disparity in pixels a stereo match may have, 0 for no
+     * limit. Used by FILTER_STEREO.
+     */
+    float maxStereoDisparity;
+
     /** number of neares neighbours to check for feature correspondence.  a
      * value of 1 will just check the next neighbour. A value of 2 will check
      * the two nearest neighbours and apply the distanceFactor criterion for
@@ -110,6 +133,36 @@ struct FeatureConfiguration
     double isometryFilterThreshold;
 
     bool adaptiveDetectorParam;
+
+    /** grid of tiles the images are split into when findFeatures runs with
+     * use_threading 2. The tiles are detected in parallel.
+     */
+    int tileColumns;
+    int tileRows;
+
+    /** number of pixels each tile extends into its neighbours, so that
+     * features at the tile borders are detected. Features found by two
+     * tiles are only described and matched once.
+     */
+    int tileOverlap;
+
+    /** if true, each tile keeps only the strongest
+     * targetNumFeatures / (tileColumns * tileRows) of the features it owns
+     * after the duplicates of the overlaps are removed, which spreads the
+     * features over the image. Only applies to the tiled detection of
+     * use_threading 2. Off by default, so that all use_threading modes
+     * return every detected feature.
+     */
+    bool tileFeatureBudget;
+
+    /** if true, the features are detected on the raw images, and only the
+     * keypoint positions are undistorted and rectified, see
+     * KeypointRectifier. The keypoints of the results are in rectified
+     * coordinates then. If false, the images are expected to be rectified
+     * already.
+     */
+    bool rectifyKeypoints;
+
     DetectorConfiguration detectorConfig;
 
     DESCRIPTOR descriptorType;
@@ -125,6 +178,7 @@ public:
     typedef float Scalar;
     typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1, Eigen::DontAlign> Descriptor;
 
+    /// number of elements of a descriptor, bytes for binary descriptors
     int descriptorSize;
     DESCRIPTOR descriptorType;
 
@@ -132,10 +186,12 @@ public:
     std::vector<cv::KeyPoint> keypoints;
     std::vector<Scalar> descriptors;
     std::vector<int> source_frame;
+    /// packed descriptors of the binary descriptor types
+    std::vector<uint8_t> binaryDescriptors;
 
     double mean_z_value;
 
-    StereoFeatureArray() : descriptorSize(0) {}
+    StereoFeatureArray() : descriptorSize(0), descriptorType(DESCRIPTOR_SURF) {}
 
     void push_back( const base::Vector3d& point, const cv::KeyPoint& keypoint, const Descriptor& descriptor, int _source_frame = -1 ) 
     {
@@ -149,11 +205,44 @@ public:
 
 	// try to have some efficiency in copying the descriptor data
 	descriptors.resize( descriptors.size() + descriptorSize );
-	memcpy( &descriptors[0] + descriptors.size() - descriptorSize, descriptor.data(), descriptorSize ); 
+	memcpy( &descriptors[0] + descriptors.size() - descriptorSize, descriptor.data(), descriptorSize * sizeof(Scalar) ); 
+
+        source_frame.push_back(_source_frame);
+    }
+
+    void push_back( const base::Vector3d& point, const cv::KeyPoint& keypoint, const uint8_t* descriptor, int size, int _source_frame = -1 ) 
+    {
+	points.push_back( point );
+	keypoints.push_back( keypoint );
+
+	if( descriptorSize == 0 )
+	    descriptorSize = size;
+
+	assert( descriptorSize == size );
+
+	binaryDescriptors.insert( binaryDescriptors.end(), descriptor, descriptor + size );
 
         source_frame.push_back(_source_frame);
     }
 
+    const uint8_t* getBinaryDescriptor( size_t index ) const
+    {
+	return &binaryDescriptors[index*descriptorSize];
+    }
+
+    /** @return the descriptors as one row per feature, CV_8U if the
+     * array holds binary descriptors and CV_32F otherwise. The matrix
+     * refers to the data of the array.
+     */
+    cv::Mat getDescriptorMatrix() const
+    {
+	if( size() == 0 )
+	    return cv::Mat();
+	if( !binaryDescriptors.empty() )
+	    return cv::Mat( size(), descriptorSize, CV_8U, const_cast<uint8_t*>( &binaryDescriptors[0] ) );
+	return cv::Mat( size(), descriptorSize, cv::DataType<Scalar>::type, const_cast<Scalar*>( &descriptors[0] ) );
+    }
+
     Eigen::Map<Descriptor> getDescriptor( size_t index )
     { 
 	return Eigen::Map<Descriptor>( &descriptors[index*descriptorSize], descriptorSize ); 
@@ -172,10 +261,12 @@ public:
     void clear() 
     { 
 	descriptorSize = 0;
+	descriptorType = DESCRIPTOR_SURF;
 	points.clear(); 
 	descriptors.clear(); 
 	keypoints.clear(); 
         source_frame.clear();
+	binaryDescriptors.clear();
     }
 
    void copyTo(StereoFeatureArray &target)
@@ -199,6 +290,7 @@ public:
      {
        target.source_frame.push_back(source_frame[i]);
      }
+     target.binaryDescriptors.insert(target.binaryDescriptors.end(), binaryDescriptors.begin(), binaryDescriptors.end());
    }
 
    bool operator == (StereoFeatureArray const& target) const
@@ -209,7 +301,8 @@ public:
             target.points.size() == points.size() &&
             target.keypoints.size() == keypoints.size() &&
             target.source_frame.size() == source_frame.size() &&
-            target.descriptors.size() == descriptors.size(); 
+            target.descriptors.size() == descriptors.size() &&
+            target.binaryDescriptors.size() == binaryDescriptors.size(); 
    }
 
 
@@ -229,6 +322,11 @@ public:
      os << "\n";
      StorePODVector(source_frame, os);
      os << "\n";
+     // the marker tells load that the binary descriptors follow. Stored as
+     // numbers, a vector of uint8_t would be written as characters.
+     os << "binary\n";
+     StorePODVector(std::vector<int>(binaryDescriptors.begin(), binaryDescriptors.end()), os);
+     os << "\n";
    }
 
    void load(std::istream& is)
@@ -259,8 +357,35 @@ public:
      is.ignore(10, '\n');
      LoadPODVector(source_frame, is); 
      is.ignore(10, '\n');
+     // files written before the binary descriptors existed have no marker
+     // and continue with the next array or end here. Looking at the buffer
+     // doesn't set eof or fail at the end of the stream.
+     binaryDescriptors.clear();
+     if( is.rdbuf()->sgetc() == 'b' )
+     {
+       std::string marker;
+       is >> marker;
+       is.ignore(10, '\n');
+       std::vector<int> binary;
+       LoadPODVector(binary, is);
+       is.ignore(10, '\n');
+       binaryDescriptors.assign(binary.begin(), binary.end());
+     }
    }
 };
+
+/** lets StoreClassVector and LoadClassVector store vectors of
+ * StereoFeatureArray
+ */
+inline void storeKeyPoint(const StereoFeatureArray& array, std::ostream& os)
+{
+    array.store(os);
+}
+
+inline void loadKeyPoint(StereoFeatureArray& array, std::istream& is)
+{
+    array.load(is);
+}
 }
 
 #endif
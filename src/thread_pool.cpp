@@ -0,0 +1,163 @@
+#include "thread_pool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace stereo;
+
+ThreadPool::ThreadPool( size_t num_threads )
+    : call( NULL ), context( NULL ), item_count( 0 ), next_item( 0 ), pending( 0 ),
+    generation( 0 ), busy( false ), stop( false )
+{
+    setNumThreads( num_threads );
+}
+
+ThreadPool::~ThreadPool()
+{
+    stopWorkers();
+}
+
+void ThreadPool::setNumThreads( size_t num_threads )
+{
+    // the calling thread always takes part, so we need one worker less
+    const size_t num_workers = num_threads > 1 ? num_threads - 1 : 0;
+    if( num_workers == workers.size() )
+	return;
+
+    stopWorkers();
+    startWorkers( num_workers );
+}
+
+void ThreadPool::startWorkers( size_t num_workers )
+{
+    stop = false;
+    for( size_t i = 0; i < num_workers; i++ )
+    {
+	workers.push_back( std::thread( &ThreadPool::workerLoop, this ) );
+	applyAffinity( i );
+    }
+}
+
+void ThreadPool::setAffinity( const std::vector<int> &cpus )
+{
+    affinity = cpus;
+    for( size_t i = 0; i < workers.size(); i++ )
+	applyAffinity( i );
+}
+
+void ThreadPool::applyAffinity( size_t worker )
+{
+#ifdef __linux__
+    const int pinned = affinity.empty() ? -1 : affinity[worker % affinity.size()];
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    if( pinned >= 0 && pinned < CPU_SETSIZE )
+	CPU_SET( pinned, &set );
+    else
+    {
+	for( int cpu = 0; cpu < CPU_SETSIZE; cpu++ )
+	    CPU_SET( cpu, &set );
+    }
+    // failing to pin a thread, e.g. to a CPU which doesn't exist, only
+    // costs performance
+    pthread_setaffinity_np( workers[worker].native_handle(), sizeof( set ), &set );
+#endif
+}
+
+void ThreadPool::stopWorkers()
+{
+    {
+	std::lock_guard<std::mutex> lock( mutex );
+	stop = true;
+    }
+    job_cond.notify_all();
+
+    for( size_t i = 0; i < workers.size(); i++ )
+	workers[i].join();
+    workers.clear();
+}
+
+void ThreadPool::run( size_t count, Call call, const void *context )
+{
+    if( count == 0 )
+	return;
+
+    std::unique_lock<std::mutex> lock( mutex );
+    if( busy || workers.empty() || count == 1 )
+    {
+	// nothing to gain from the workers, or they are occupied by
+	// another job. Do the work in the calling thread.
+	lock.unlock();
+	for( size_t i = 0; i < count; i++ )
+	    call( context, i );
+	return;
+    }
+
+    busy = true;
+    this->call = call;
+    this->context = context;
+    item_count = count;
+    next_item = 0;
+    pending = count;
+    error = std::exception_ptr();
+    generation++;
+    job_cond.notify_all();
+
+    // take part in the processing and wait for the stragglers
+    processItems( lock );
+    while( pending > 0 )
+	done_cond.wait( lock );
+
+    std::exception_ptr job_error = error;
+    error = std::exception_ptr();
+    busy = false;
+    lock.unlock();
+
+    if( job_error )
+	std::rethrow_exception( job_error );
+}
+
+void ThreadPool::processItems( std::unique_lock<std::mutex> &lock )
+{
+    while( next_item < item_count )
+    {
+	const size_t item = next_item++;
+	Call item_call = call;
+	const void *item_context = context;
+	lock.unlock();
+
+	std::exception_ptr item_error;
+	try
+	{
+	    item_call( item_context, item );
+	}
+	catch( ... )
+	{
+	    item_error = std::current_exception();
+	}
+
+	lock.lock();
+	if( item_error && !error )
+	    error = item_error;
+	if( --pending == 0 )
+	    done_cond.notify_all();
+    }
+}
+
+void ThreadPool::workerLoop()
+{
+    std::unique_lock<std::mutex> lock( mutex );
+    unsigned long seen = generation;
+    while( true )
+    {
+	while( !stop && generation == seen )
+	    job_cond.wait( lock );
+	if( stop )
+	    return;
+
+	seen = generation;
+	processItems( lock );
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef __STEREO_THREAD_POOL_H__
+#define __STEREO_THREAD_POOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+namespace stereo
+{
+
+/**
+ * Small pool of persistent worker threads.
+ *
+ * Work is distributed with parallelFor(), which blocks until all items have
+ * been processed. The calling thread takes part in the processing, so a pool
+ * with a single thread runs everything inline. Handing out work does not
+ * allocate memory, which makes the pool usable in per-frame code paths.
+ *
+ * Only one parallelFor() can be active on a pool at a time. If the pool is
+ * busy, e.g. because parallelFor() is called from within a running item or
+ * from a different thread, the items of the second call are processed
+ * sequentially by its caller instead.
+ */
+class ThreadPool
+{
+public:
+    /** @param num_threads number of threads taking part in a parallelFor,
+     *         including the calling thread
+     */
+    explicit ThreadPool( size_t num_threads = 1 );
+
+    ~ThreadPool();
+
+    /** change the number of threads taking part in a parallelFor, including
+     * the calling thread. Must not be called while a parallelFor is running.
+     */
+    void setNumThreads( size_t num_threads );
+
+    /** @return the number of threads taking part in a parallelFor */
+    size_t getNumThreads() const { return workers.size() + 1; }
+
+    /** pin the worker threads to CPUs, worker i runs on cpus[i % cpus.size()].
+     * The calling thread of parallelFor is left alone. An empty list lets
+     * the workers run on any CPU again. The setting also applies to
+     * workers started later by setNumThreads. Only supported on Linux,
+     * elsewhere this does nothing.
+     */
+    void setAffinity( const std::vector<int> &cpus );
+
+    /** call func( i ) for each i in [0, count) and wait until all calls
+     * have returned. Exceptions thrown by func are passed on to the caller
+     * (the first one wins).
+     */
+    template <class Func>
+    void parallelFor( size_t count, const Func& func )
+    {
+	run( count, &ThreadPool::invoke<Func>, &func );
+    }
+
+private:
+    typedef void (*Call)( const void *context, size_t item );
+
+    template <class Func>
+    static void invoke( const void *context, size_t item )
+    {
+	(*static_cast<const Func*>( context ))( item );
+    }
+
+    void run( size_t count, Call call, const void *context );
+    void processItems( std::unique_lock<std::mutex> &lock );
+    void workerLoop();
+    void startWorkers( size_t num_workers );
+    void stopWorkers();
+    void applyAffinity( size_t worker );
+
+    std::vector<std::thread> workers;
+    std::vector<int> affinity;
+
+    std::mutex mutex;
+    std::condition_variable job_cond, done_cond;
+
+    // state of the current job, guarded by mutex
+    Call call;
+    const void *context;
+    size_t item_count, next_item, pending;
+    unsigned long generation;
+    std::exception_ptr error;
+    bool busy;
+    bool stop;
+};
+
+}
+
+#endif
@@ -0,0 +1,434 @@
+#include <frame_helper/CalibrationCv.h>
+#include <stereo/densestereo.h>
+#include <stereo/disparity_conversion.h>
+#include <stereo/thread_pool.h>
+#include <stereo/gaussian_filter.h>
+#include <stereo/config.h>
+#ifdef HAS_SPARSE_STEREO
+#include <stereo/sparse_stereo.hpp>
+#endif
+#include <base/Time.hpp>
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include <boost/lexical_cast.hpp>
+#include <thread>
+#include <functional>
+#include <cstdio>
+
+// average wall-clock time of a single call to f in milliseconds, after one
+// warm-up call
+template <class F>
+double timeIt( size_t iterations, F f )
+{
+    f();
+    base::Time start = base::Time::now();
+    for( size_t i=0; i<iterations; i++ )
+	f();
+    return (base::Time::now() - start).toSeconds() * 1000.0 / iterations;
+}
+
+void benchmarkBandParallel( const cv::Mat& left, const cv::Mat& right, 
+	const frame_helper::StereoCalibration& calib, size_t iterations )
+{
+    std::cout << "band-parallel dense matching:" << std::endl;
+
+    const size_t max_threads = std::max( 1u, std::thread::hardware_concurrency() );
+    double single = 0;
+    for( size_t threads=1; threads<=max_threads; threads++ )
+    {
+	stereo::DenseStereo dense;
+	dense.setStereoCalibration( calib, left.size().width, left.size().height );
+	dense.setNumThreads( threads );
+
+	cv::Mat ldisp, rdisp;
+	const double ms = timeIt( iterations, [&]() 
+		{ dense.processFramePair( left, right, ldisp, rdisp ); } );
+	if( threads == 1 )
+	    single = ms;
+
+	std::cout << "  " << threads << " threads: " << ms << " ms/frame, speed-up " 
+	    << single / ms << std::endl;
+    }
+}
+
+void benchmarkLeftOnly( const cv::Mat& left, const cv::Mat& right, 
+	const frame_helper::StereoCalibration& calib, size_t iterations )
+{
+    std::cout << "left-only dense processing:" << std::endl;
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( calib, left.size().width, left.size().height );
+
+    base::samples::DistanceImage ldist, rdist;
+    const double both = timeIt( iterations, [&]() 
+	    { dense.getDistanceImages( left, right, ldist, rdist ); } );
+    const double left_only = timeIt( iterations, [&]() 
+	    { dense.getLeftDistanceImage( left, right, ldist ); } );
+
+    std::cout << "  left and right: " << both << " ms/frame, left only: " << left_only 
+	<< " ms/frame, saving " << both - left_only << " ms/frame" << std::endl;
+}
+
+void benchmarkCoarseToFine( const cv::Mat& left, const cv::Mat& right, 
+	const frame_helper::StereoCalibration& calib, size_t iterations )
+{
+    std::cout << "coarse-to-fine dense processing:" << std::endl;
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( calib, left.size().width, left.size().height );
+    dense.setNumThreads( std::max( 1u, std::thread::hardware_concurrency() ) );
+
+    // a wide disparity range, like it is needed for close obstacles
+    stereo::libElasConfiguration config;
+    config.disp_max = 255;
+    dense.setLibElasConfiguration( config );
+
+    cv::Mat ldist, rdist;
+    const double full = timeIt( iterations, [&]() 
+	    { dense.getDistanceImages( left, right, ldist, rdist ); } );
+    const int full_valid = cv::countNonZero( ldist == ldist );
+
+    dense.setCoarseToFine( true );
+    const double coarse = timeIt( iterations, [&]() 
+	    { dense.getDistanceImages( left, right, ldist, rdist ); } );
+    const int coarse_valid = cv::countNonZero( ldist == ldist );
+
+    std::cout << "  full range: " << full << " ms/frame, " << full_valid << " valid pixels" << std::endl;
+    std::cout << "  coarse-to-fine: " << coarse << " ms/frame, " << coarse_valid << " valid pixels" << std::endl;
+}
+
+void benchmarkEngines( const cv::Mat& left, const cv::Mat& right, 
+	const frame_helper::StereoCalibration& calib, size_t iterations )
+{
+    std::cout << "disparity engines:" << std::endl;
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( calib, left.size().width, left.size().height );
+    dense.setNumThreads( std::max( 1u, std::thread::hardware_concurrency() ) );
+
+    const stereo::DisparityEngineType engines[] = 
+	{ stereo::ENGINE_ELAS, stereo::ENGINE_SGM, stereo::ENGINE_CENSUS_BM };
+    const char* names[] = { "libelas", "semi-global matching", "census block matching" };
+    for( size_t i=0; i<3; i++ )
+    {
+	dense.setDisparityEngine( engines[i] );
+	cv::Mat ldist, rdist;
+	const double ms = timeIt( iterations, [&]() 
+		{ dense.getDistanceImages( left, right, ldist, rdist ); } );
+	std::cout << "  " << names[i] << ": " << ms << " ms/frame, " 
+	    << cv::countNonZero( ldist == ldist ) << " valid pixels" << std::endl;
+    }
+}
+
+// loads an image sequence from printf-style file name patterns, or
+// simulates a slowly moving camera by shifting the rectified single pair
+void loadSequence( const cv::Mat& left, const cv::Mat& right, 
+	const frame_helper::StereoCalibration& calib, int argc, char* argv[],
+	std::vector<cv::Mat>& lframes, std::vector<cv::Mat>& rframes, bool& rectified )
+{
+    if( argc > 6 )
+    {
+	char lname[1024], rname[1024];
+	for( int i=0;; i++ )
+	{
+	    snprintf( lname, sizeof(lname), argv[5], i );
+	    snprintf( rname, sizeof(rname), argv[6], i );
+	    cv::Mat l = cv::imread( lname ), r = cv::imread( rname );
+	    if( !l.data || !r.data )
+		break;
+	    lframes.push_back( l );
+	    rframes.push_back( r );
+	}
+	rectified = false;
+	return;
+    }
+
+    frame_helper::StereoCalibrationCv calibcv;
+    calibcv.setCalibration( calib );
+    calibcv.setImageSize( left.size() );
+    calibcv.initCv();
+    cv::Mat rleft, rright;
+    calibcv.camLeft.undistortAndRectify( left, rleft );
+    calibcv.camRight.undistortAndRectify( right, rright );
+
+    for( int i=0; i<30; i++ )
+    {
+	// half a pixel of vertical motion per frame
+	const cv::Mat shift = (cv::Mat_<double>(2,3) << 1, 0, 0, 0, 1, i * 0.5);
+	cv::Mat l, r;
+	cv::warpAffine( rleft, l, shift, rleft.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE );
+	cv::warpAffine( rright, r, shift, rright.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE );
+	lframes.push_back( l );
+	rframes.push_back( r );
+    }
+    rectified = true;
+}
+
+void benchmarkTemporalPrior( const std::vector<cv::Mat>& lframes, const std::vector<cv::Mat>& rframes,
+	bool rectified, const frame_helper::StereoCalibration& calib )
+{
+    std::cout << "temporal disparity prior on " << lframes.size() << " frames:" << std::endl;
+    if( lframes.empty() )
+	return;
+
+    for( int with_prior=0; with_prior<2; with_prior++ )
+    {
+	stereo::DenseStereo dense;
+	dense.setStereoCalibration( calib, lframes[0].size().width, lframes[0].size().height );
+	dense.setNumThreads( std::max( 1u, std::thread::hardware_concurrency() ) );
+
+	stereo::TemporalPriorConfiguration config;
+	config.enabled = with_prior;
+	dense.setTemporalPrior( config );
+
+	cv::Mat ldist, rdist;
+	double valid = 0;
+	base::Time start = base::Time::now();
+	for( size_t i=0; i<lframes.size(); i++ )
+	{
+	    dense.getDistanceImages( lframes[i], rframes[i], ldist, rdist, rectified );
+	    valid += cv::countNonZero( ldist == ldist );
+	}
+	const double ms = (base::Time::now() - start).toSeconds() * 1000.0 / lframes.size();
+
+	std::cout << "  " << (with_prior ? "with prior: " : "without prior: ") << ms 
+	    << " ms/frame, " << valid / lframes.size() << " valid pixels/frame" << std::endl;
+    }
+}
+
+// the scalar conversion loop DenseStereo used before the vectorized kernel
+void referenceDisparityToDistance( cv::Mat &disp, float dist_factor )
+{
+    cv::MatIterator_<float> it = disp.begin<float>(), it_end = disp.end<float>();
+    for(; it != it_end; ++it)
+    {
+	const float disparity = *it;
+	*it = disparity > 0 ? 
+	    dist_factor / disparity : 
+	    std::numeric_limits<float>::quiet_NaN();
+    }
+}
+
+void benchmarkDistanceConversion( size_t iterations )
+{
+    std::cout << "disparity to distance conversion:" << std::endl;
+
+    const cv::Size sizes[] = { cv::Size( 640, 480 ), cv::Size( 1024, 768 ), cv::Size( 2048, 1536 ) };
+    stereo::ThreadPool pool( std::max( 1u, std::thread::hardware_concurrency() ) );
+    for( size_t s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++ )
+    {
+	// disparities with a share of invalid pixels, like libelas produces
+	cv::Mat disp( sizes[s], CV_32FC1 ), dist;
+	for( int y=0; y<disp.rows; y++ )
+	    for( int x=0; x<disp.cols; x++ )
+		disp.at<float>( y, x ) = ( std::rand() % 1100 ) / 10.0 - 10.0;
+
+	const double reference = timeIt( iterations, [&]() 
+		{ disp.copyTo( dist ); referenceDisparityToDistance( dist, 7e4 ); } );
+	const double simd = timeIt( iterations, [&]() 
+		{ disp.copyTo( dist ); stereo::disparityToDistance( dist, dist, 7e4 ); } );
+	const double threaded = timeIt( iterations, [&]() 
+		{ disp.copyTo( dist ); stereo::disparityToDistance( dist, dist, 7e4, &pool ); } );
+
+	std::cout << "  " << sizes[s].width << "x" << sizes[s].height 
+	    << ": scalar " << reference << " ms, simd " << simd << " ms, simd with " 
+	    << pool.getNumThreads() << " threads " << threaded << " ms (including copy)" << std::endl;
+    }
+}
+
+// grayscale conversion and blur the way DenseStereo did it before the fused
+// kernel, with a separate pass for each step
+void referenceGrayscale( const cv::Mat &image, cv::Mat &conversion, cv::Mat &gray, int kernel_size )
+{
+    if( image.depth() == CV_16U )
+    {
+	image.convertTo( conversion, CV_8U, 1/256. );
+	cv::cvtColor( conversion, gray, cv::COLOR_BGR2GRAY );
+    }
+    else
+	cv::cvtColor( image, gray, cv::COLOR_BGR2GRAY );
+    cv::GaussianBlur( gray, gray, cv::Size( kernel_size, kernel_size ), 0 );
+}
+
+void benchmarkGrayscale( const cv::Mat& left, size_t iterations )
+{
+    std::cout << "grayscale conversion and gaussian blur:" << std::endl;
+
+    cv::Mat left16;
+    left.convertTo( left16, CV_16U, 256.0 );
+    const cv::Mat inputs[] = { left, left16 };
+    const char* names[] = { "8 bit bgr", "16 bit bgr" };
+
+    const int kernel_size = 5;
+    stereo::GaussianFilter filter;
+    filter.setKernelSize( kernel_size );
+    for( size_t i=0; i<2; i++ )
+    {
+	cv::Mat conversion, gray;
+	const double reference = timeIt( iterations, [&]() 
+		{ referenceGrayscale( inputs[i], conversion, gray, kernel_size ); } );
+	const double fused = timeIt( iterations, [&]() 
+		{ filter.apply( inputs[i], gray ); } );
+
+	std::cout << "  " << names[i] << ": separate passes " << reference 
+	    << " ms, fused " << fused << " ms" << std::endl;
+    }
+}
+
+#ifdef HAS_SPARSE_STEREO
+// the per-frame thread handling findFeatures did before the persistent
+// pool: two threads for the images, each starting four for the tiles
+void referenceFrameThreads( const std::function<void()> &task )
+{
+    std::thread *images[2];
+    for( int i=0; i<2; i++ )
+	images[i] = new std::thread( [&]()
+		{
+		    std::thread tiles[4];
+		    for( int j=0; j<4; j++ )
+			tiles[j] = std::thread( task );
+		    for( int j=0; j<4; j++ )
+			tiles[j].join();
+		} );
+    for( int i=0; i<2; i++ )
+    {
+	images[i]->join();
+	delete images[i];
+    }
+}
+
+void benchmarkStereoFeatures( const cv::Mat& left, const cv::Mat& right, 
+	const frame_helper::StereoCalibration& calib, size_t iterations )
+{
+    std::cout << "sparse stereo feature detection:" << std::endl;
+
+    // the dispatch alone, with tasks which do nothing
+    stereo::ThreadPool pool( 8 );
+    const std::function<void()> empty = [](){};
+    const double reference_dispatch = timeIt( iterations * 100, [&]() 
+	    { referenceFrameThreads( empty ); } );
+    const double pool_dispatch = timeIt( iterations * 100, [&]() 
+	    { pool.parallelFor( 8, [&]( size_t ) { empty(); } ); } );
+    std::cout << "  dispatch of 8 tasks: new threads " << reference_dispatch * 1000.0
+	<< " us, persistent pool " << pool_dispatch * 1000.0 << " us" << std::endl;
+
+    cv::Mat gleft, gright;
+    cv::cvtColor( left, gleft, cv::COLOR_BGR2GRAY );
+    cv::cvtColor( right, gright, cv::COLOR_BGR2GRAY );
+    stereo::StereoFeatures features;
+    features.setCalibration( calib );
+    for( int threading=0; threading<=2; threading++ )
+    {
+	const double t = timeIt( iterations, [&]() 
+		{ features.findFeatures( gleft, gright, threading ); } );
+	std::cout << "  findFeatures with use_threading " << threading << ": " << t << " ms" << std::endl;
+    }
+}
+
+void benchmarkStereoMatching( size_t iterations )
+{
+    std::cout << "sparse stereo matching of rectified features:" << std::endl;
+
+    // features of a 640x480 image pair with disparities up to 100
+    const int counts[] = { 500, 2000, 8000 };
+    stereo::StereoFeatures features;
+    stereo::EpipolarMatcher matcher( 5, 0, 0 );
+    for( size_t c=0; c<sizeof(counts)/sizeof(counts[0]); c++ )
+    {
+	const int count = counts[c];
+	std::vector<cv::KeyPoint> left( count ), right( count );
+	cv::Mat left_desc( count, 64, CV_32F ), right_desc( count, 64, CV_32F );
+	cv::randu( left_desc, 0, 1 );
+	cv::randu( right_desc, 0, 1 );
+	for( int i=0; i<count; i++ )
+	{
+	    left[i].pt = cv::Point2f( std::rand() % 640, std::rand() % 480 );
+	    right[i].pt = left[i].pt - cv::Point2f( std::rand() % 100, 0 );
+	}
+
+	std::vector<cv::DMatch> matches;
+	const double flann = timeIt( iterations, [&]() 
+		{ features.crossCheckMatching( left_desc, right_desc, matches ); } );
+	const double epipolar = timeIt( iterations, [&]() 
+		{ matcher.match( left, left_desc, right, right_desc, matches ); } );
+
+	std::cout << "  " << count << " features: flann cross check " << flann 
+	    << " ms, row buckets " << epipolar << " ms" << std::endl;
+    }
+}
+
+void benchmarkBinaryDescriptors( const cv::Mat& left, const cv::Mat& right, 
+	const frame_helper::StereoCalibration& calib, size_t iterations )
+{
+    std::cout << "sparse stereo descriptors:" << std::endl;
+
+    cv::Mat gleft, gright;
+    cv::cvtColor( left, gleft, cv::COLOR_BGR2GRAY );
+    cv::cvtColor( right, gright, cv::COLOR_BGR2GRAY );
+    const stereo::DESCRIPTOR types[] = { stereo::DESCRIPTOR_SURF, stereo::DESCRIPTOR_ORB, stereo::DESCRIPTOR_BRIEF };
+    const char* names[] = { "SURF", "ORB", "BRIEF" };
+    for( size_t d=0; d<sizeof(types)/sizeof(types[0]); d++ )
+    {
+	// the same keypoints for all descriptors
+	stereo::FeatureConfiguration config;
+	config.detectorType = stereo::DETECTOR_FAST;
+	config.targetNumFeatures = 2000;
+	config.descriptorType = types[d];
+	stereo::StereoFeatures features;
+	features.setConfiguration( config );
+	features.setCalibration( calib );
+
+	const double describe = timeIt( iterations, [&]() 
+		{ features.findFeatures( gleft, gright, 0 ); } );
+	const cv::Mat left_desc = features.getFeatureInfoLeft().descriptors;
+	const cv::Mat right_desc = features.getFeatureInfoRight().descriptors;
+	std::vector<cv::DMatch> matches;
+	const double match = timeIt( iterations, [&]() 
+		{ features.crossCheckMatching( left_desc, right_desc, matches ); } );
+
+	std::cout << "  " << names[d] << ": " << left_desc.rows << " features, detect and describe " << describe
+	    << " ms, cross check " << match << " ms, " << left_desc.cols * left_desc.elemSize() 
+	    << " bytes per descriptor" << std::endl;
+    }
+}
+#endif
+
+int main( int argc, char* argv[] )
+{
+    if( argc < 4 )
+    {
+	std::cout << "usage: benchmark leftimage rightimage calibration_file <iterations> <left_sequence right_sequence>" << std::endl;
+	std::cout << "  left_sequence and right_sequence are printf patterns for the frame file names, like left_%04d.png" << std::endl;
+	exit(0);
+    }
+
+    cv::Mat cleft = cv::imread( argv[1] );
+    cv::Mat cright = cv::imread( argv[2] );
+
+    size_t iterations = 10;
+    if( argc > 4 )
+	iterations = boost::lexical_cast<size_t>( argv[4] );
+
+    assert( cleft.size() == cright.size() );
+
+    const frame_helper::StereoCalibration calib = 
+	frame_helper::StereoCalibration::fromMatlabFile( argv[3], cleft.size().width, cleft.size().height );
+
+    benchmarkBandParallel( cleft, cright, calib, iterations );
+    benchmarkDistanceConversion( iterations );
+    benchmarkGrayscale( cleft, iterations );
+    benchmarkLeftOnly( cleft, cright, calib, iterations );
+    benchmarkCoarseToFine( cleft, cright, calib, iterations );
+    benchmarkEngines( cleft, cright, calib, iterations );
+#ifdef HAS_SPARSE_STEREO
+    benchmarkStereoFeatures( cleft, cright, calib, iterations );
+    benchmarkStereoMatching( iterations );
+    benchmarkBinaryDescriptors( cleft, cright, calib, iterations );
+#endif
+
+    std::vector<cv::Mat> lframes, rframes;
+    bool rectified;
+    loadSequence( cleft, cright, calib, argc, argv, lframes, rframes, rectified );
+    benchmarkTemporalPrior( lframes, rframes, rectified, calib );
+}
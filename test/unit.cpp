@@ -2,13 +2,25 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include <frame_helper/CalibrationCv.h>
+#include <stereo/config.h>
 #ifdef HAS_SPARSE_STEREO
 #include <stereo/sparse_stereo.hpp>
 #endif
 #include <stereo/densestereo.h>
+#include <stereo/dense_stereo_pipeline.h>
 #include <stereo/homography.h>
+#include <stereo/gaussian_filter.h>
+#include <stereo/disparity_conversion.h>
+#include <stereo/rectification_cache.h>
+#include <stereo/frame_input.h>
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <limits>
 #include "opencv2/opencv.hpp"
 #include "opencv2/highgui/highgui.hpp"
 
@@ -158,6 +170,249 @@ BOOST_AUTO_TEST_CASE( sparse_test )
 
     std::cout << "Finished all Sparse Stereo tests." << std::endl << std::endl;
 }
+
+BOOST_AUTO_TEST_CASE( sparse_tiling_test )
+{
+    const int width = 640, height = 480;
+    cv::Mat leftImage( height, width, CV_8UC1, cv::Scalar( 0 ) ), rightImage;
+    for( int i = 0; i < 300; ++i )
+      cv::circle( leftImage, cv::Point( std::rand() % width, std::rand() % height ), std::rand() % 10 + 2, cv::Scalar( std::rand() % 128 + 128 ), -1 );
+    cv::Mat transformation = ( cv::Mat_<double>(2,3) << 1, 0, -50, 0, 1, 0 );
+    cv::warpAffine( leftImage, rightImage, transformation, leftImage.size() );
+
+    stereo::FeatureConfiguration configuration;
+    configuration.tileColumns = 3;
+    configuration.tileRows = 2;
+    configuration.tileOverlap = 40;
+    configuration.targetNumFeatures = 120;
+    configuration.tileFeatureBudget = true;
+    stereo::StereoFeatures features;
+    features.setConfiguration( configuration );
+    features.findFeatures( leftImage, rightImage, 2 );
+
+    const stereo::FeatureInfo &info = features.getFeatureInfoLeft();
+    BOOST_CHECK( info.keypoints.size() > 0 );
+    BOOST_CHECK( info.keypoints.size() <= 120 );
+    BOOST_CHECK_EQUAL( info.descriptors.rows, (int)info.keypoints.size() );
+
+    // the features of the overlaps are only kept once
+    for( size_t i = 0; i < info.keypoints.size(); ++i )
+      for( size_t j = i + 1; j < info.keypoints.size(); ++j )
+      {
+	const cv::Point2f d = info.keypoints[i].pt - info.keypoints[j].pt;
+	BOOST_CHECK( d.x * d.x + d.y * d.y > 1e-6 || info.keypoints[i].size != info.keypoints[j].size );
+      }
+
+    // without budget, the tiles find what the whole image does. FAST only
+    // needs a few pixels around a feature, so the overlap gives every tile
+    // all the context of the whole image.
+    configuration.tileFeatureBudget = false;
+    configuration.detectorType = stereo::DETECTOR_FAST;
+    features.setConfiguration( configuration );
+    features.findFeatures( leftImage, rightImage, 2 );
+    const size_t tiled = features.getFeatureInfoLeft().keypoints.size();
+    features.findFeatures( leftImage, rightImage, 0 );
+    const size_t whole = features.getFeatureInfoLeft().keypoints.size();
+    BOOST_CHECK( whole > 0 );
+    BOOST_CHECK( std::abs( (int)tiled - (int)whole ) <= (int)whole / 50 );
+
+    // keypoints of different tiles less than a pixel apart with a similar
+    // size are the same feature, of which the strongest is kept
+    std::vector<cv::KeyPoint> keypoints;
+    std::vector<int> tile_ids;
+    keypoints.push_back( cv::KeyPoint( 100, 100, 10, -1, 5 ) );
+    tile_ids.push_back( 0 );
+    keypoints.push_back( cv::KeyPoint( 100.5, 100.3, 9, -1, 8 ) );
+    tile_ids.push_back( 1 );
+    // same tile as the strongest
+    keypoints.push_back( cv::KeyPoint( 100.2, 100, 10, -1, 3 ) );
+    tile_ids.push_back( 1 );
+    // different size
+    keypoints.push_back( cv::KeyPoint( 100, 100.5, 20, -1, 1 ) );
+    tile_ids.push_back( 2 );
+    // too far away
+    keypoints.push_back( cv::KeyPoint( 103, 100, 10, -1, 1 ) );
+    tile_ids.push_back( 2 );
+    stereo::removeDuplicateKeypoints( keypoints, tile_ids );
+    BOOST_REQUIRE_EQUAL( keypoints.size(), (size_t)4 );
+    BOOST_REQUIRE_EQUAL( tile_ids.size(), (size_t)4 );
+    const float responses[] = { 8, 3, 1, 1 };
+    const int tiles[] = { 1, 1, 2, 2 };
+    for( size_t i = 0; i < keypoints.size(); ++i )
+    {
+	BOOST_CHECK_EQUAL( keypoints[i].response, responses[i] );
+	BOOST_CHECK_EQUAL( tile_ids[i], tiles[i] );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( epipolar_matcher_test )
+{
+    // right features shifted by a positive disparity and a small y error,
+    // with distinct descriptors, in shuffled order
+    const int count = 500, size = 64;
+    std::vector<cv::KeyPoint> left( count ), right( count );
+    cv::Mat left_desc( count, size, CV_32F ), right_desc( count, size, CV_32F );
+    cv::randu( left_desc, 0, 1 );
+    std::vector<int> perm( count );
+    for( int i = 0; i < count; ++i )
+	perm[i] = ( i * 7919 ) % count;
+    for( int i = 0; i < count; ++i )
+    {
+	left[i].pt = cv::Point2f( std::rand() % 6400 / 10.0, std::rand() % 4800 / 10.0 );
+	right[perm[i]].pt = left[i].pt - cv::Point2f( std::rand() % 100 + 0.5, ( std::rand() % 30 - 15 ) / 10.0 );
+	left_desc.row( i ).copyTo( right_desc.row( perm[i] ) );
+    }
+
+    stereo::EpipolarMatcher matcher( 2, 0, 1.5 );
+    std::vector<cv::DMatch> matches;
+    matcher.match( left, left_desc, right, right_desc, matches );
+    BOOST_CHECK_EQUAL( matches.size(), (size_t)count );
+    for( size_t i = 0; i < matches.size(); ++i )
+	BOOST_CHECK_EQUAL( matches[i].trainIdx, perm[matches[i].queryIdx] );
+
+    // features outside the disparity range are not matched
+    stereo::EpipolarMatcher limited( 2, 50, 1.5 );
+    limited.match( left, left_desc, right, right_desc, matches );
+    for( size_t i = 0; i < matches.size(); ++i )
+	BOOST_CHECK( left[matches[i].queryIdx].pt.x - right[matches[i].trainIdx].pt.x <= 50 );
+    BOOST_CHECK( matches.size() < (size_t)count );
+
+    // the result is the one of brute force cross checking all pairs which
+    // pass the epipolar, disparity and distance factor tests. Integer
+    // descriptor values keep the float distances exact, and ties fail the
+    // distance factor test, so the order the candidates are visited in
+    // doesn't matter.
+    const int dense_count = 2000;
+    const float max_y = 2, max_disp = 60, factor = 1.5;
+    std::vector<cv::KeyPoint> dense_left( dense_count ), dense_right( dense_count );
+    cv::Mat dense_left_desc( dense_count, size, CV_32F ), dense_right_desc( dense_count, size, CV_32F );
+    for( int i = 0; i < dense_count; ++i )
+    {
+	dense_left[i].pt = cv::Point2f( std::rand() % 6400 / 10.0, std::rand() % 1200 / 10.0 + 2 );
+	dense_right[i].pt = dense_left[i].pt - cv::Point2f( std::rand() % 800 / 10.0 - 10, ( std::rand() % 40 - 20 ) / 10.0 );
+	for( int j = 0; j < size; ++j )
+	{
+	    const int value = std::rand() % 256;
+	    dense_left_desc.at<float>( i, j ) = value;
+	    // half of the right features are noisy copies of the left ones
+	    dense_right_desc.at<float>( i, j ) = i % 2 ? std::rand() % 256 : std::max( 0, value - std::rand() % 40 );
+	}
+    }
+
+    // best candidate of each query feature and whether it is distinct
+    const auto bruteForce = [&]( const std::vector<cv::KeyPoint> &query, const cv::Mat &query_desc,
+	    const std::vector<cv::KeyPoint> &train, const cv::Mat &train_desc, bool query_left,
+	    std::vector<int> &best_index, std::vector<bool> &distinct )
+    {
+	best_index.assign( query.size(), -1 );
+	distinct.assign( query.size(), false );
+	for( size_t q = 0; q < query.size(); ++q )
+	{
+	    float best = std::numeric_limits<float>::max(), second = best;
+	    for( size_t t = 0; t < train.size(); ++t )
+	    {
+		const float disparity = query_left ? query[q].pt.x - train[t].pt.x : train[t].pt.x - query[q].pt.x;
+		if( disparity <= 0 || disparity > max_disp || std::fabs( query[q].pt.y - train[t].pt.y ) >= max_y )
+		    continue;
+		float sum = 0;
+		for( int j = 0; j < size; ++j )
+		{
+		    const float d = query_desc.at<float>( q, j ) - train_desc.at<float>( t, j );
+		    sum += d * d;
+		}
+		const float distance = std::sqrt( sum );
+		if( distance < best )
+		{
+		    second = best;
+		    best = distance;
+		    best_index[q] = t;
+		}
+		else if( distance < second )
+		    second = distance;
+	    }
+	    distinct[q] = best_index[q] >= 0 && best * factor < second;
+	}
+    };
+    // the matches both directions agree on
+    const auto bruteForceMatches = [&]()
+    {
+	std::vector<int> forward, backward;
+	std::vector<bool> forward_distinct, backward_distinct;
+	bruteForce( dense_left, dense_left_desc, dense_right, dense_right_desc, true, forward, forward_distinct );
+	bruteForce( dense_right, dense_right_desc, dense_left, dense_left_desc, false, backward, backward_distinct );
+	std::vector<cv::DMatch> expected;
+	for( int l = 0; l < dense_count; ++l )
+	    if( forward_distinct[l] && backward[forward[l]] == l && backward_distinct[forward[l]] )
+		expected.push_back( cv::DMatch( l, forward[l], 0 ) );
+	return expected;
+    };
+
+    stereo::ThreadPool pool( 4 );
+    stereo::EpipolarMatcher dense_matcher( max_y, max_disp, factor );
+    for( int above = 0; above < 2; ++above )
+    {
+	// rectified keypoints may be above the image, at negative y
+	if( above )
+	    for( int i = 0; i < dense_count; ++i )
+	    {
+		dense_left[i].pt.y -= 200;
+		dense_right[i].pt.y -= 200;
+	    }
+
+	const std::vector<cv::DMatch> expected = bruteForceMatches();
+	dense_matcher.match( dense_left, dense_left_desc, dense_right, dense_right_desc, matches, &pool );
+	BOOST_CHECK( expected.size() > (size_t)dense_count / 4 );
+	BOOST_REQUIRE_EQUAL( matches.size(), expected.size() );
+	for( size_t i = 0; i < matches.size(); ++i )
+	{
+	    BOOST_CHECK_EQUAL( matches[i].queryIdx, expected[i].queryIdx );
+	    BOOST_CHECK_EQUAL( matches[i].trainIdx, expected[i].trainIdx );
+	}
+    }
+}
+
+BOOST_AUTO_TEST_CASE( hamming_matcher_test )
+{
+    // train descriptors and queries which are copies of them with a few
+    // flipped bits, or random
+    const int count = 4000, size = 32;
+    cv::Mat train( count, size, CV_8U ), query( 1000, size, CV_8U );
+    cv::randu( train, 0, 256 );
+    cv::randu( query, 0, 256 );
+    for( int i = 0; i < query.rows; i += 2 )
+    {
+	train.row( std::rand() % count ).copyTo( query.row( i ) );
+	for( int b = std::rand() % 20; b > 0; --b )
+	    query.at<uint8_t>( i, std::rand() % size ) ^= 1 << ( std::rand() % 8 );
+    }
+    // duplicates give ties, which are ordered by the train index
+    for( int i = 0; i < query.rows; i += 10 )
+	train.row( std::rand() % count ).copyTo( train.row( std::rand() % count ) );
+
+    int bits = 0;
+    for( int j = 0; j < size; ++j )
+	for( uint8_t x = train.at<uint8_t>( 0, j ) ^ train.at<uint8_t>( 1, j ); x; x >>= 1 )
+	    bits += x & 1;
+    BOOST_CHECK_EQUAL( stereo::hammingDistance( train.ptr<uint8_t>( 0 ), train.ptr<uint8_t>( 1 ), size ), bits );
+
+    // the index finds the same neighbours as brute force
+    stereo::ThreadPool pool( 4 );
+    stereo::HammingMatcher indexed, brute_force( count + 1 );
+    std::vector<std::vector<cv::DMatch> > indexed_matches, brute_force_matches;
+    indexed.knnMatch( query, train, indexed_matches, 2, &pool );
+    brute_force.knnMatch( query, train, brute_force_matches, 2 );
+    BOOST_REQUIRE_EQUAL( indexed_matches.size(), brute_force_matches.size() );
+    for( size_t i = 0; i < indexed_matches.size(); ++i )
+    {
+	BOOST_REQUIRE_EQUAL( indexed_matches[i].size(), (size_t)2 );
+	BOOST_REQUIRE_EQUAL( brute_force_matches[i].size(), (size_t)2 );
+	for( size_t k = 0; k < 2; ++k )
+	{
+	    BOOST_CHECK_EQUAL( indexed_matches[i][k].trainIdx, brute_force_matches[i][k].trainIdx );
+	    BOOST_CHECK_EQUAL( indexed_matches[i][k].distance, brute_force_matches[i][k].distance );
+	}
+    }
+}
 #endif
 
 
@@ -215,6 +470,564 @@ BOOST_AUTO_TEST_CASE( dense_test )
     cv::imwrite( prefix_out + "rdist.png", rdisp );
 }
 
+BOOST_AUTO_TEST_CASE( dense_pipeline_test ) 
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", left.size().width, left.size().height ), left.size().width, left.size().height );
+
+    // reference result from the synchronous interface
+    cv::Mat ldist, rdist;
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+
+    // run a number of frames through the pipeline and compare the results
+    const int frames = 5;
+    std::vector<int64_t> delivered;
+    {
+	stereo::DenseStereoPipeline pipeline( dense, 
+		[&]( const stereo::DenseStereoPipeline::Result& result )
+		{
+		    delivered.push_back( result.time.microseconds );
+		    // NaN never compares equal, so only the invalid pixels may differ
+		    BOOST_CHECK_EQUAL( cv::countNonZero( result.left_distance != ldist ), cv::countNonZero( ldist != ldist ) );
+		} );
+
+	for( int i=0; i<frames; i++ )
+	    pipeline.push( left, right, base::Time::fromMicroseconds( i ), true );
+	pipeline.flush();
+    }
+
+    // all frames need to be delivered in order
+    BOOST_REQUIRE_EQUAL( delivered.size(), (size_t)frames );
+    for( int i=0; i<frames; i++ )
+	BOOST_CHECK_EQUAL( delivered[i], i );
+}
+
+BOOST_AUTO_TEST_CASE( dense_roi_test )
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+    const cv::Size size = left.size();
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", size.width, size.height ), size.width, size.height );
+
+    // lower half of the image, without a block in the middle
+    const cv::Rect roi( 0, size.height / 2, size.width, size.height - size.height / 2 );
+    const cv::Rect hole( size.width / 2 - 20, size.height * 3 / 4 - 20, 40, 40 );
+    cv::Mat mask( size, CV_8UC1, cv::Scalar( 255 ) );
+    mask( hole ).setTo( cv::Scalar( 0 ) );
+    dense.setRegionOfInterest( roi );
+    dense.setMask( mask );
+
+    cv::Mat ldist, rdist;
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+
+    // everything outside the roi and the mask is invalid
+    cv::Mat valid = ldist == ldist;
+    BOOST_CHECK_EQUAL( cv::countNonZero( valid.rowRange( 0, roi.y ) ), 0 );
+    BOOST_CHECK_EQUAL( cv::countNonZero( valid( hole ) ), 0 );
+    BOOST_CHECK( cv::countNonZero( valid( roi ) ) > 0 );
+
+    // resetting roi and mask processes the whole image again
+    dense.setRegionOfInterest( cv::Rect() );
+    dense.setMask( cv::Mat() );
+    cv::Mat ldist_full, rdist_full;
+    dense.getDistanceImages( left, right, ldist_full, rdist_full, true );
+    BOOST_CHECK( cv::countNonZero( ldist_full == ldist_full ) > cv::countNonZero( valid ) );
+}
+
+BOOST_AUTO_TEST_CASE( dense_coarse_to_fine_test )
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", left.size().width, left.size().height ), left.size().width, left.size().height );
+
+    cv::Mat ldist, rdist;
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+
+    dense.setCoarseToFine( true, 4 );
+    cv::Mat ldist_c2f, rdist_c2f;
+    dense.getDistanceImages( left, right, ldist_c2f, rdist_c2f, true );
+    cv::imwrite( prefix_out + "ldist_c2f.png", ldist_c2f );
+
+    // the narrowed search may lose some pixels, but not most of them
+    BOOST_REQUIRE( ldist_c2f.size() == ldist.size() );
+    BOOST_CHECK( cv::countNonZero( ldist_c2f == ldist_c2f ) > cv::countNonZero( ldist == ldist ) / 2 );
+}
+
+BOOST_AUTO_TEST_CASE( dense_temporal_prior_test )
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", left.size().width, left.size().height ), left.size().width, left.size().height );
+    stereo::TemporalPriorConfiguration config;
+    config.enabled = true;
+    dense.setTemporalPrior( config );
+
+    // the first frame is matched with the full range, the repeated frame
+    // with the range of the first one, which needs to find the same
+    cv::Mat ldist, rdist, ldist_prior, rdist_prior;
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+    dense.getDistanceImages( left, right, ldist_prior, rdist_prior, true );
+
+    const int valid = cv::countNonZero( ldist == ldist );
+    BOOST_CHECK( cv::countNonZero( ldist_prior == ldist_prior ) > valid * 9 / 10 );
+}
+
+BOOST_AUTO_TEST_CASE( dense_batch_test )
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", left.size().width, left.size().height ), left.size().width, left.size().height );
+
+    // the batch workers match whole frames single-threaded, so the
+    // reference is matched in a single band as well
+    dense.setNumThreads( 1 );
+    cv::Mat ldist, rdist;
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+
+    std::vector<stereo::FramePair> pairs( 6, stereo::FramePair( left, right ) );
+    std::vector<cv::Mat> ldists, rdists;
+    dense.setNumThreads( 3 );
+    dense.processBatch( pairs, ldists, rdists, true );
+
+    BOOST_REQUIRE_EQUAL( ldists.size(), pairs.size() );
+    BOOST_REQUIRE_EQUAL( rdists.size(), pairs.size() );
+    for( size_t i=0; i<pairs.size(); i++ )
+    {
+	BOOST_REQUIRE( ldists[i].size() == ldist.size() );
+	BOOST_CHECK_EQUAL( cv::countNonZero( ldists[i] != ldist ), cv::countNonZero( ldist != ldist ) );
+    }
+
+    // the workers ignore the temporal prior, so the result is the same
+    stereo::TemporalPriorConfiguration prior;
+    prior.enabled = true;
+    dense.setTemporalPrior( prior );
+    std::vector<cv::Mat> ldists_prior, rdists_prior;
+    dense.processBatch( pairs, ldists_prior, rdists_prior, true );
+    for( size_t i=0; i<pairs.size(); i++ )
+	BOOST_CHECK_EQUAL( cv::countNonZero( ldists_prior[i] != ldist ), cv::countNonZero( ldist != ldist ) );
+}
+
+BOOST_AUTO_TEST_CASE( dense_point_cloud_test )
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", left.size().width, left.size().height ), left.size().width, left.size().height );
+
+    cv::Mat ldist;
+    dense.getLeftDistanceImage( left, right, ldist, true );
+    const int valid = cv::countNonZero( ldist == ldist );
+
+    // one point for each valid pixel, in front of the camera
+    base::samples::Pointcloud cloud;
+    dense.getPointCloud( left, right, cloud, true );
+    BOOST_CHECK_EQUAL( cloud.points.size(), (size_t)valid );
+    for( size_t i=0; i<cloud.points.size(); i++ )
+	BOOST_REQUIRE( cloud.points[i].z() > 0 );
+
+    // striding and the voxel grid reduce the number of points
+    stereo::PointCloudConfiguration config;
+    config.stride = 2;
+    dense.setPointCloudConfiguration( config );
+    base::samples::Pointcloud strided;
+    dense.getPointCloud( left, right, strided, true );
+    BOOST_CHECK( strided.points.size() < cloud.points.size() / 2 );
+
+    // voxels relative to the scene depth, as the unit depends on the calibration
+    double mean_z = 0;
+    for( size_t i=0; i<cloud.points.size(); i++ )
+	mean_z += cloud.points[i].z() / cloud.points.size();
+    config.stride = 1;
+    config.voxel_size = mean_z / 20;
+    dense.setPointCloudConfiguration( config );
+    base::samples::Pointcloud voxels;
+    dense.getPointCloud( left, right, voxels, true );
+    BOOST_CHECK( voxels.points.size() > 0 );
+    BOOST_CHECK( voxels.points.size() < cloud.points.size() );
+}
+
+BOOST_AUTO_TEST_CASE( dense_subsampling_test )
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+    const cv::Size size = left.size();
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", size.width, size.height ), size.width, size.height );
+    stereo::libElasConfiguration config;
+    config.subsampling = true;
+    dense.setLibElasConfiguration( config );
+
+    // half resolution output, also when matching in bands
+    for( size_t threads=1; threads<=3; threads++ )
+    {
+	dense.setNumThreads( threads );
+	cv::Mat ldist, rdist;
+	dense.getDistanceImages( left, right, ldist, rdist, true );
+	BOOST_CHECK( ldist.size() == cv::Size( size.width / 2, size.height / 2 ) );
+	BOOST_CHECK( rdist.size() == cv::Size( size.width / 2, size.height / 2 ) );
+	BOOST_CHECK( cv::countNonZero( ldist == ldist ) > 0 );
+    }
+
+    // the distance image describes every second pixel of the camera
+    base::samples::DistanceImage ldimage, rdimage;
+    dense.getDistanceImages( left, right, ldimage, rdimage, true );
+    BOOST_CHECK_EQUAL( ldimage.width, (size_t)size.width / 2 );
+    BOOST_CHECK_EQUAL( ldimage.height, (size_t)size.height / 2 );
+    const frame_helper::StereoCalibration calib = getTestCalibration( "", size.width, size.height );
+    BOOST_CHECK_CLOSE( ldimage.scale_x, 2.0 / calib.camLeft.fx, 1e-3 );
+    BOOST_CHECK_CLOSE( ldimage.center_x, -calib.camLeft.cx / calib.camLeft.fx, 1e-3 );
+
+    // upsampled to full resolution
+    dense.setUpsampling( true );
+    cv::Mat ldist, rdist;
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+    BOOST_CHECK( ldist.size() == size );
+    BOOST_CHECK( cv::countNonZero( ldist == ldist ) > 0 );
+}
+
+BOOST_AUTO_TEST_CASE( gaussian_filter_test )
+{
+    // random colour image with odd size, so the simd and scalar parts and
+    // the borders are covered
+    cv::Mat color( 37, 53, CV_8UC3 );
+    cv::randu( color, cv::Scalar::all( 0 ), cv::Scalar::all( 256 ) );
+    cv::Mat color16;
+    color.convertTo( color16, CV_16U, 256.0 );
+
+    cv::Mat gray, gray16;
+    cv::cvtColor( color, gray, cv::COLOR_BGR2GRAY );
+    gray.convertTo( gray16, CV_16U, 256.0 );
+
+    const cv::Mat inputs[] = { gray, gray16, color, color16 };
+    const int kernel_sizes[] = { 0, 3, 5, 7 };
+    for( size_t k=0; k<sizeof(kernel_sizes)/sizeof(kernel_sizes[0]); k++ )
+    {
+	cv::Mat expected;
+	if( kernel_sizes[k] > 1 )
+	    cv::GaussianBlur( gray, expected, cv::Size( kernel_sizes[k], kernel_sizes[k] ), 0 );
+	else
+	    expected = gray;
+
+	stereo::GaussianFilter filter;
+	filter.setKernelSize( kernel_sizes[k] );
+	for( size_t i=0; i<sizeof(inputs)/sizeof(inputs[0]); i++ )
+	{
+	    // the fixed-point kernel may be off by one
+	    cv::Mat result;
+	    filter.apply( inputs[i], result );
+	    BOOST_CHECK_EQUAL( result.type(), CV_8UC1 );
+	    BOOST_CHECK_LE( cv::norm( result, expected, cv::NORM_INF ), 1.0 );
+	}
+
+	// in place
+	cv::Mat inplace = gray.clone();
+	filter.apply( inplace, inplace );
+	BOOST_CHECK_LE( cv::norm( inplace, expected, cv::NORM_INF ), 1.0 );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( dense_compact_output_test )
+{
+    // helpers: round trip within the fixed-point precision, invalid values
+    // and values out of range map to COMPACT_INVALID
+    cv::Mat disp( 1, 5, CV_32FC1 ), compact, back;
+    disp.at<float>( 0 ) = 12.34f;
+    disp.at<float>( 1 ) = -10.0f;
+    disp.at<float>( 2 ) = 0.0f;
+    disp.at<float>( 3 ) = 2.0f;
+    disp.at<float>( 4 ) = 0.001f;
+    stereo::disparityToCompact( disp, compact );
+    BOOST_CHECK_EQUAL( compact.type(), CV_16UC1 );
+    BOOST_CHECK_EQUAL( compact.at<uint16_t>( 0 ), 197 );
+    BOOST_CHECK_EQUAL( compact.at<uint16_t>( 1 ), stereo::COMPACT_INVALID );
+    BOOST_CHECK_EQUAL( compact.at<uint16_t>( 2 ), stereo::COMPACT_INVALID );
+    stereo::compactToDisparity( compact, back );
+    BOOST_CHECK_CLOSE( back.at<float>( 0 ), 12.3125f, 1e-3 );
+    BOOST_CHECK_EQUAL( back.at<float>( 1 ), -10.0f );
+
+    // 100 / 0.001 is beyond the range of the distances
+    stereo::disparityToCompactDistance( disp, compact, 100.0f );
+    BOOST_CHECK_EQUAL( compact.at<uint16_t>( 0 ), 8104 );
+    BOOST_CHECK_EQUAL( compact.at<uint16_t>( 3 ), 50000 );
+    BOOST_CHECK_EQUAL( compact.at<uint16_t>( 4 ), stereo::COMPACT_INVALID );
+
+    base::samples::DistanceImage dimage;
+    stereo::compactToDistanceImage( compact, dimage );
+    BOOST_CHECK_EQUAL( dimage.width, 5 );
+    BOOST_CHECK_CLOSE( dimage.data[0], 8.104f, 1e-3 );
+    BOOST_CHECK( dimage.data[4] != dimage.data[4] );
+    cv::Mat compact2;
+    stereo::distanceImageToCompact( dimage, compact2 );
+    BOOST_CHECK_EQUAL( cv::norm( compact, compact2, cv::NORM_INF ), 0.0 );
+
+    // compact output of DenseStereo matches the float output
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+    const cv::Size size = left.size();
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", size.width, size.height ), size.width, size.height );
+    cv::Mat ldist, rdist, lcompact, rcompact;
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+    dense.setCompactOutput( true );
+    dense.getDistanceImages( left, right, lcompact, rcompact, true );
+    BOOST_CHECK_EQUAL( lcompact.type(), CV_16UC1 );
+
+    cv::Mat expected;
+    stereo::distanceToCompact( ldist, expected );
+    BOOST_CHECK_LE( cv::norm( lcompact, expected, cv::NORM_INF ), 1.0 );
+}
+
+BOOST_AUTO_TEST_CASE( dense_sgm_test )
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+    const cv::Size size = left.size();
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", size.width, size.height ), size.width, size.height );
+
+    cv::Mat ldist, rdist;
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+
+    dense.setDisparityEngine( stereo::ENGINE_SGM );
+    cv::Mat ldist_sgm, rdist_sgm;
+    dense.getDistanceImages( left, right, ldist_sgm, rdist_sgm, true );
+    cv::imwrite( prefix_out + "ldist_sgm.png", ldist_sgm );
+
+    // full resolution output, with about as many valid pixels as libelas
+    BOOST_REQUIRE( ldist_sgm.size() == size );
+    BOOST_CHECK( cv::countNonZero( ldist_sgm == ldist_sgm ) > cv::countNonZero( ldist == ldist ) / 2 );
+
+    // with bands, each band is matched by its own engine instance
+    dense.setNumThreads( 2 );
+    cv::Mat ldist_bands, rdist_bands;
+    dense.getDistanceImages( left, right, ldist_bands, rdist_bands, true );
+    BOOST_REQUIRE( ldist_bands.size() == size );
+    BOOST_CHECK( cv::countNonZero( ldist_bands == ldist_bands ) > cv::countNonZero( ldist_sgm == ldist_sgm ) / 2 );
+
+    // sgm computes both images anyway, so alternating left only and full
+    // requests gives the same left image
+    cv::Mat ldist_left;
+    dense.getLeftDistanceImage( left, right, ldist_left, true );
+    dense.getDistanceImages( left, right, ldist_bands, rdist_bands, true );
+    BOOST_CHECK_EQUAL( cv::countNonZero( ldist_left != ldist_bands ), cv::countNonZero( ldist_bands != ldist_bands ) );
+}
+
+BOOST_AUTO_TEST_CASE( dense_block_matching_test )
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+    const cv::Size size = left.size();
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", size.width, size.height ), size.width, size.height );
+    dense.setDisparityEngine( stereo::ENGINE_CENSUS_BM );
+
+    cv::Mat ldist, rdist;
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+    cv::imwrite( prefix_out + "ldist_bm.png", ldist );
+    BOOST_REQUIRE( ldist.size() == size );
+    BOOST_REQUIRE( rdist.size() == size );
+    const int checked = cv::countNonZero( ldist == ldist );
+    BOOST_CHECK( checked > 0 );
+
+    // without the left/right check, every pixel with a right pixel inside
+    // the image gets a disparity
+    stereo::BlockMatchingConfiguration config;
+    config.lr_threshold = -1;
+    dense.setBlockMatchingConfiguration( config );
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+    BOOST_CHECK( cv::countNonZero( ldist == ldist ) > checked );
+
+    config.window_size = 4;
+    BOOST_CHECK_THROW( dense.setBlockMatchingConfiguration( config ), std::runtime_error );
+}
+
+BOOST_AUTO_TEST_CASE( dense_confidence_test )
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+    const cv::Size size = left.size();
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", size.width, size.height ), size.width, size.height );
+    dense.setConfidenceOutput( true );
+
+    // whole image and bands
+    for( size_t threads=1; threads<=2; threads++ )
+    {
+	dense.setNumThreads( threads );
+	cv::Mat ldist, rdist;
+	dense.getDistanceImages( left, right, ldist, rdist, true );
+
+	const cv::Mat confidence = dense.getConfidence();
+	BOOST_REQUIRE( confidence.size() == ldist.size() );
+	BOOST_REQUIRE( confidence.type() == CV_8UC1 );
+	// invalid pixels have no confidence, and not all valid ones are trusted
+	BOOST_CHECK_EQUAL( cv::countNonZero( confidence & ( ldist != ldist ) ), 0 );
+	BOOST_CHECK( cv::countNonZero( confidence ) > 0 );
+	BOOST_CHECK( cv::countNonZero( confidence == 255 ) < cv::countNonZero( ldist == ldist ) );
+    }
+    cv::imwrite( prefix_out + "confidence.png", dense.getConfidence() );
+
+    dense.setConfidenceOutput( false );
+    cv::Mat ldist, rdist;
+    dense.getDistanceImages( left, right, ldist, rdist, true );
+    BOOST_CHECK( dense.getConfidence().empty() );
+}
+
+BOOST_AUTO_TEST_CASE( dense_rectification_cache_test )
+{
+    cv::Mat cleft = cv::imread( prefix + "left.png" );
+    cv::Mat cright = cv::imread( prefix + "right.png" );
+    const cv::Size size = cleft.size();
+    const frame_helper::StereoCalibration calib = getTestCalibration( "", size.width, size.height );
+
+    stereo::RectificationCache &cache = stereo::RectificationCache::instance();
+    const uint64_t key = stereo::RectificationCache::getKey( calib, size );
+    const std::string file_name = stereo::RectificationCache::getFileName( key, prefix_out );
+    std::remove( file_name.c_str() );
+    cache.clear();
+
+    stereo::DenseStereo dense;
+    dense.setRectificationCacheDirectory( prefix_out );
+    dense.setStereoCalibration( calib, size.width, size.height );
+    BOOST_CHECK( std::ifstream( file_name.c_str() ).good() );
+    cv::Mat ldisp, rdisp;
+    dense.processFramePair( cleft, cright, ldisp, rdisp );
+
+    // a new process only finds the file
+    cache.clear();
+    stereo::DenseStereo restarted;
+    restarted.setRectificationCacheDirectory( prefix_out );
+    restarted.setStereoCalibration( calib, size.width, size.height );
+    cv::Mat ldisp_cached, rdisp_cached;
+    restarted.processFramePair( cleft, cright, ldisp_cached, rdisp_cached );
+    BOOST_CHECK_EQUAL( cv::norm( ldisp, ldisp_cached, cv::NORM_INF ), 0 );
+
+    // which is in memory now
+    stereo::RectificationMaps maps;
+    BOOST_CHECK( cache.lookup( key, "", maps ) );
+    BOOST_CHECK( maps.left_map1.size() == size );
+
+    // a different size is a different calibration
+    BOOST_CHECK( stereo::RectificationCache::getKey( calib, cv::Size( size.width / 2, size.height / 2 ) ) != key );
+}
+
+BOOST_AUTO_TEST_CASE( dense_frame_input_test )
+{
+    using namespace base::samples::frame;
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+    const cv::Size size = left.size();
+    const frame_helper::StereoCalibration calib = getTestCalibration( "", size.width, size.height );
+
+    // grayscale frames are used without copying
+    Frame lframe( size.width, size.height, 8, MODE_GRAYSCALE ), rframe( size.width, size.height, 8, MODE_GRAYSCALE );
+    for( int y = 0; y < size.height; y++ )
+    {
+	memcpy( lframe.getImagePtr() + y * lframe.getRowSize(), left.ptr( y ), size.width );
+	memcpy( rframe.getImagePtr() + y * rframe.getRowSize(), right.ptr( y ), size.width );
+    }
+    cv::Mat buffer;
+    BOOST_CHECK( stereo::frameToMat( lframe, buffer ).data == lframe.getImageConstPtr() );
+    BOOST_CHECK( buffer.empty() );
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( calib, size.width, size.height );
+    cv::Mat ldisp, rdisp, lframe_disp, rframe_disp;
+    dense.processFramePair( left, right, ldisp, rdisp, true );
+    dense.processFramePair( lframe, rframe, lframe_disp, rframe_disp, true );
+    BOOST_CHECK_EQUAL( cv::norm( ldisp, lframe_disp, cv::NORM_INF ), 0 );
+
+    // RGGB mosaic of a color image, every 2x2 cell gives one gray pixel
+    cv::Mat color = cv::imread( prefix + "left.png" );
+    const frame_mode_t modes[4] = { MODE_BAYER_RGGB, MODE_BAYER_GRBG, MODE_BAYER_BGGR, MODE_BAYER_GBRG };
+    // BGR channel of the pixels of a cell for each mode
+    const int channels[4][4] = { { 2, 1, 1, 0 }, { 1, 2, 0, 1 }, { 0, 1, 1, 2 }, { 1, 0, 2, 1 } };
+    for( int m = 0; m < 4; m++ )
+    {
+	Frame bayer( color.cols, color.rows, 8, modes[m] );
+	for( int y = 0; y < color.rows; y++ )
+	    for( int x = 0; x < color.cols; x++ )
+		bayer.getImagePtr()[y * bayer.getRowSize() + x] = color.at<cv::Vec3b>( y, x )[channels[m][( y % 2 ) * 2 + x % 2]];
+
+	cv::Mat gray = stereo::frameToMat( bayer, buffer );
+	BOOST_REQUIRE( gray.size() == cv::Size( color.cols / 2, color.rows / 2 ) );
+	BOOST_REQUIRE( gray.type() == CV_8UC1 );
+	double max_diff = 0;
+	for( int y = 0; y < gray.rows; y++ )
+	    for( int x = 0; x < gray.cols; x++ )
+	    {
+		const cv::Vec3b &a = color.at<cv::Vec3b>( 2 * y, 2 * x ), &b = color.at<cv::Vec3b>( 2 * y, 2 * x + 1 ),
+		      &c = color.at<cv::Vec3b>( 2 * y + 1, 2 * x ), &d = color.at<cv::Vec3b>( 2 * y + 1, 2 * x + 1 );
+		const double v[4] = { (double)a[channels[m][0]], (double)b[channels[m][1]], (double)c[channels[m][2]], (double)d[channels[m][3]] };
+		double r = 0, g = 0, bl = 0;
+		for( int i = 0; i < 4; i++ )
+		    ( channels[m][i] == 2 ? r : channels[m][i] == 1 ? g : bl ) += v[i];
+		const double ref = 0.299 * r + 0.587 * g / 2 + 0.114 * bl;
+		max_diff = std::max( max_diff, std::fabs( ref - gray.at<uint8_t>( y, x ) ) );
+	    }
+	BOOST_CHECK( max_diff <= 1.5 );
+    }
+
+    // Bayer frames are matched at half resolution
+    Frame lbayer( size.width, size.height, 8, MODE_BAYER_RGGB ), rbayer( size.width, size.height, 8, MODE_BAYER_RGGB );
+    for( int y = 0; y < size.height; y++ )
+    {
+	memcpy( lbayer.getImagePtr() + y * lbayer.getRowSize(), left.ptr( y ), size.width );
+	memcpy( rbayer.getImagePtr() + y * rbayer.getRowSize(), right.ptr( y ), size.width );
+    }
+    stereo::DenseStereo half;
+    half.setStereoCalibration( stereo::getHalfResolutionCalibration( calib ), size.width / 2, size.height / 2 );
+    base::samples::DistanceImage ldist, rdist;
+    half.getDistanceImages( lbayer, rbayer, ldist, rdist, true );
+    BOOST_CHECK_EQUAL( ldist.width, size.width / 2 );
+    BOOST_CHECK_EQUAL( ldist.height, size.height / 2 );
+}
+
+BOOST_AUTO_TEST_CASE( dense_timing_test )
+{
+    cv::Mat left, right;
+    getTestImages( "", left, right );
+    const cv::Size size = left.size();
+
+    stereo::DenseStereo dense;
+    dense.setStereoCalibration( getTestCalibration("", size.width, size.height ), size.width, size.height );
+    dense.setTimingHistory( 3 );
+
+    cv::Mat ldist, rdist;
+    for( int i=0; i<5; i++ )
+	dense.getDistanceImages( left, right, ldist, rdist, true );
+
+    const stereo::DenseStereoTiming timing = dense.getTiming();
+    BOOST_CHECK( timing.matching.toMicroseconds() > 0 );
+    // rectified input skips the rectification
+    BOOST_CHECK( timing.rectification.isNull() );
+
+    const stereo::DenseStereoTimingStatistics stats = dense.getTimingStatistics();
+    BOOST_CHECK_EQUAL( stats.frames, 3u );
+    BOOST_CHECK( stats.min.matching.toMicroseconds() <= stats.mean.matching.toMicroseconds() );
+    BOOST_CHECK( stats.mean.matching.toMicroseconds() <= stats.max.matching.toMicroseconds() );
+    BOOST_CHECK( stats.p95.matching.toMicroseconds() <= stats.max.matching.toMicroseconds() );
+    BOOST_CHECK( stats.max.rectification.isNull() );
+}
+
+
 void testHomography( const base::samples::DistanceImage& dimage, cv::Mat& image )
 {
     // pick some test points in the image, calculate the homography and
@@ -330,4 +1143,119 @@ BOOST_AUTO_TEST_CASE( psurf_test )
     // write sparse stereo debug image 
     cv::imwrite( prefix_out + "sparse-surf.png", sparse.getDebugImage() );
 }
+
+BOOST_AUTO_TEST_CASE( keypoint_rectifier_test )
+{
+    cv::Mat cleft = cv::imread( prefix + "left.png" );
+    const cv::Size size = cleft.size();
+    frame_helper::StereoCalibrationCv calib;
+    calib.setCalibration( getTestCalibration( "", size.width, size.height ) );
+    calib.setImageSize( size );
+    calib.initCv();
+
+    stereo::KeypointRectifier rectifier;
+    rectifier.init( calib, size );
+
+    // the interpolated positions match the exact ones
+    cv::Mat points( 1000, 1, CV_32FC2 ), left, right;
+    cv::randu( points, 0, std::min( size.width, size.height ) );
+    cv::undistortPoints( points, left, calib.camLeft.camMatrix, calib.camLeft.distCoeffs, calib.R1, calib.P1 );
+    cv::undistortPoints( points, right, calib.camRight.camMatrix, calib.camRight.distCoeffs, calib.R2, calib.P2 );
+    double max_error = 0;
+    for( int i = 0; i < points.rows; ++i )
+    {
+	const cv::Point2f p = points.at<cv::Point2f>( i );
+	max_error = std::max( max_error, cv::norm( rectifier.rectify( p, true ) - left.at<cv::Point2f>( i ) ) );
+	max_error = std::max( max_error, cv::norm( rectifier.rectify( p, false ) - right.at<cv::Point2f>( i ) ) );
+    }
+    BOOST_CHECK( max_error < 0.05 );
+
+    // features of the raw images are matched on rectified positions, which
+    // fulfill the epipolar constraint
+    cv::Mat cright = cv::imread( prefix + "right.png" ), gleft, gright;
+    cv::cvtColor( cleft, gleft, CV_BGR2GRAY );
+    cv::cvtColor( cright, gright, CV_BGR2GRAY );
+    stereo::FeatureConfiguration config;
+    config.rectifyKeypoints = true;
+    stereo::StereoFeatures sparse;
+    sparse.setConfiguration( config );
+    sparse.setCalibration( getTestCalibration( "", size.width, size.height ) );
+    sparse.processFramePair( gleft, gright );
+    const stereo::StereoFeatureArray &features = sparse.getStereoFeatures();
+    BOOST_CHECK( features.keypoints.size() > 0 );
+    const std::vector<cv::KeyPoint> &left_matches = sparse.getMatchesLeft().keypoints;
+    const std::vector<cv::KeyPoint> &right_matches = sparse.getMatchesRight().keypoints;
+    BOOST_REQUIRE_EQUAL( left_matches.size(), right_matches.size() );
+    BOOST_CHECK( left_matches.size() > 0 );
+    for( size_t i = 0; i < left_matches.size(); ++i )
+    {
+	BOOST_CHECK( std::fabs( left_matches[i].pt.y - right_matches[i].pt.y ) < config.maxStereoYDeviation );
+	BOOST_CHECK( left_matches[i].pt.x - right_matches[i].pt.x > 0 );
+    }
+
+    // the stereo filter enforces the above, so also match on the
+    // descriptors only. Nearly all of these matches are epipolar on the
+    // rectified positions, only the false matches are not.
+    config.filterType = stereo::FILTER_NONE;
+    sparse.setConfiguration( config );
+    sparse.processFramePair( gleft, gright );
+    const std::vector<cv::KeyPoint> &left_unfiltered = sparse.getMatchesLeft().keypoints;
+    const std::vector<cv::KeyPoint> &right_unfiltered = sparse.getMatchesRight().keypoints;
+    BOOST_REQUIRE_EQUAL( left_unfiltered.size(), right_unfiltered.size() );
+    BOOST_REQUIRE( left_unfiltered.size() > 0 );
+    size_t epipolar = 0;
+    for( size_t i = 0; i < left_unfiltered.size(); ++i )
+    {
+	if( std::fabs( left_unfiltered[i].pt.y - right_unfiltered[i].pt.y ) < config.maxStereoYDeviation
+		&& left_unfiltered[i].pt.x - right_unfiltered[i].pt.x > 0 )
+	    epipolar++;
+    }
+    BOOST_CHECK( epipolar >= left_unfiltered.size() * 9 / 10 );
+}
+
+BOOST_AUTO_TEST_CASE( binary_descriptor_test )
+{
+    cv::Mat cleft = cv::imread( prefix + "left.png" );
+    cv::Mat cright = cv::imread( prefix + "right.png" ), left, right;
+    cv::cvtColor( cleft, left, CV_BGR2GRAY );
+    cv::cvtColor( cright, right, CV_BGR2GRAY );
+
+    stereo::FeatureConfiguration config;
+    config.detectorType = stereo::DETECTOR_ORB;
+    config.descriptorType = stereo::DESCRIPTOR_ORB;
+    config.targetNumFeatures = 500;
+    stereo::StereoFeatures sparse;
+    sparse.setConfiguration( config );
+    sparse.setCalibration( getTestCalibration( "", left.size().width, left.size().height ) );
+    stereo::StereoFeatureArray features;
+    sparse.processFramePair( left, right, &features );
+    BOOST_CHECK( features.size() > 0 );
+    BOOST_CHECK_EQUAL( features.descriptorType, stereo::DESCRIPTOR_ORB );
+    BOOST_CHECK_EQUAL( features.binaryDescriptors.size(), features.size() * features.descriptorSize );
+    BOOST_CHECK_EQUAL( features.getDescriptorMatrix().type(), CV_8UC1 );
+
+    // the packed bits survive storing
+    std::stringstream stream;
+    features.store( stream );
+    stereo::StereoFeatureArray loaded;
+    loaded.load( stream );
+    BOOST_CHECK( loaded.binaryDescriptors == features.binaryDescriptors );
+    BOOST_CHECK( !stream.fail() );
+
+    // and so do the ones of the arrays after it in a stored vector
+    std::vector<stereo::StereoFeatureArray> arrays( 2, features ), loaded_arrays;
+    std::stringstream vector_stream;
+    StoreClassVector( arrays, vector_stream );
+    LoadClassVector( loaded_arrays, vector_stream );
+    BOOST_REQUIRE_EQUAL( loaded_arrays.size(), (size_t)2 );
+    BOOST_CHECK( loaded_arrays[1] == features );
+    BOOST_CHECK( loaded_arrays[1].binaryDescriptors == features.binaryDescriptors );
+
+    // a frame corresponds to itself
+    if( features.size() >= 5 )
+    {
+	sparse.calculateInterFrameCorrespondences( features, loaded, stereo::FILTER_NONE );
+	BOOST_CHECK( sparse.getInterFrameCorrespondences().size() > features.size() / 2 );
+    }
+}
 #endif